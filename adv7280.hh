@@ -3,14 +3,13 @@
 #include <yaal/requirements.hh>
 
 #ifdef __YAAL__
-#include <yaal/io/ports.hh>
-
+#include "hal.hh"
 #include "i2c_helpers.hh"
 
 #define AVGLPF 0
 
 namespace ad_decoder {
-    using namespace yaal;
+    using namespace koryuu::hal;
     using namespace i2c_helpers;
 
     enum InputSelection : uint8_t {
@@ -61,6 +60,36 @@ namespace ad_decoder {
         I2P_ALG_DEINTERLACE = 0x18,
     };
 
+    // Delay the I2P core adds to the video path, in microseconds: the
+    // nominal figure of each algorithm, not a measurement. Line doubling
+    // buffers one line (64 us), the deinterlacer the previous field.
+    constexpr uint16_t i2p_latency_us(I2P_Algorithm alg, bool is_50hz)
+    {
+        return alg == I2P_ALG_LINEDOUBLE ? 64 : (is_50hz ? 20000 : 16683);
+    }
+
+    // The VPP map is a separate I2C target, enabled by programming its
+    // address into the user map register 0xfd. The value written there
+    // is the 8-bit (write) form of the address, as in the AD scripts.
+    class VppMap {
+    public:
+        uint8_t address; // 7-bit
+
+        VppMap(uint8_t reg_addr) : address(reg_addr >> 1) {}
+
+        void write(uint8_t reg, uint8_t val) {
+            I2C_WRITE(address, reg, val);
+        }
+
+        uint8_t read(uint8_t reg) {
+            return I2C_READ_ONE(address, reg);
+        }
+
+        void update(uint8_t reg, uint8_t mask, uint8_t val) {
+            write(reg, (read(reg) & ~mask) | (val & mask));
+        }
+    };
+
     enum InterruptDriveLevel : uint8_t {
         IDL_OPEN_DRAIN  = 0x00,
         IDL_ACTIVE_LOW  = 0x01,
@@ -74,6 +103,42 @@ namespace ad_decoder {
         ID_MUST_CLEAR = 0xc0,
     };
 
+    // Interrupt causes, as latched in the interrupt status registers
+    // 0x42, 0x46 and 0x4a and cleared through the register after each.
+    enum InterruptCause1 : uint8_t {
+        INTR1_SD_LOCK        = 0x01,
+        INTR1_SD_UNLOCK      = 0x02,
+        INTR1_FREERUN_CHANGE = 0x20,
+        INTR1_MV_PS_CS       = 0x40,
+        INTR1_ALL            = 0x63,
+    };
+
+    enum InterruptCause2 : uint8_t {
+        INTR2_CCAPD           = 0x01,
+        INTR2_SD_FIELD_CHANGE = 0x10,
+        INTR2_CHX_MIN_MAX     = 0x20,
+        INTR2_MANUAL          = 0x80,
+        INTR2_ALL             = 0xb1,
+    };
+
+    enum InterruptCause3 : uint8_t {
+        INTR3_SD_OP_CHANGE         = 0x01,
+        INTR3_SD_VSYNC_LOCK_CHANGE = 0x02,
+        INTR3_SD_HSYNC_LOCK_CHANGE = 0x04,
+        INTR3_SD_AD_RESULT_CHANGE  = 0x08,
+        INTR3_SECAM_LOCK_CHANGE    = 0x10,
+        INTR3_PAL_SW_LOCK_CHANGE   = 0x20,
+        INTR3_ALL                  = 0x3f,
+    };
+
+    // The causes of a decoder interrupt, see read_interrupts().
+    struct InterruptCauses {
+        uint8_t causes1; // InterruptCause1
+        uint8_t causes2; // InterruptCause2
+        uint8_t causes3; // InterruptCause3
+        uint8_t raw2;    // Raw status 2 (0x45): SD even field (0x10)
+    };
+
     enum VS_COAST_MODE : uint8_t {
         COAST_MODE_AUTO = 0x00,
         COAST_MODE_576I = 0x04,
@@ -113,9 +178,15 @@ namespace ad_decoder {
 
         uint8_t address;
         uint8_t vpp_address;
+        VppMap vpp;
+        // The interrupt masks last written, see read_interrupts().
+        uint8_t intr_mask1;
+        uint8_t intr_mask2;
+        uint8_t intr_mask3;
 
         ADV7280A(uint8_t addr, uint8_t vpp_addr = 0x84)
-            : address(addr), vpp_address(vpp_addr) {
+            : address(addr), vpp_address(vpp_addr), vpp(vpp_addr),
+            intr_mask1(0), intr_mask2(0), intr_mask3(0) {
             intrq.mode = INPUT_PULLUP;
             reset.mode = OUTPUT;
             reset = false;
@@ -194,21 +265,30 @@ namespace ad_decoder {
             I2C_WRITE(address, 0x4d, cti_dnr);
         }
 
+        void enable_vpp_map() {
+            // VPP slave address: User sub map, subaddress 0xfd
+            I2C_WRITE(address, 0xfd, vpp_address);
+        }
+
         void deinterlace_reset() {
-            // TODO
-            // VPP slave address: User sub map, subaddress 0xfd, bits 6:0
+            enable_vpp_map();
             // VPP Map, subaddress 0x41, bit 0
+            vpp.update(0x41, 0x01, 0x01);
         }
 
         void deinterlace_control(bool enable,
                 I2P_Algorithm alg = I2P_ALG_DEINTERLACE) {
-            // TODO
-            // VPP slave address: User sub map, subaddress 0xfd, bits 6:0
-            // Deinterlace enable: VPP Map, subaddress 0x55, bit 7
+            enable_vpp_map();
+            // ADI required write
+            vpp.write(0xa3, 0x00);
+            // Advanced timing mode: VPP Map, subaddress 0x5b, bit 7 (negative)
+            vpp.update(0x5b, 0x80, enable ? 0x00 : 0x80);
             // Algorithm selection (undocumented): VPP Map, subaddress 0x5a, bits 4:3
             //     0b00: Simple line doubling
             //     0b11: Proprietary deinterlacing algorithm
-            // Advanced timing mode: VPP Map, subaddress 0x5b, bit 7 (negative)
+            vpp.update(0x5a, 0x18, alg);
+            // Deinterlace enable: VPP Map, subaddress 0x55, bit 7
+            vpp.update(0x55, 0x80, enable ? 0x80 : 0x00);
         }
 
 #if AVGLPF
@@ -293,6 +373,7 @@ namespace ad_decoder {
             if (unmask_mv_ps_cs)
                 imsk1 |= 0x40;
             I2C_WRITE(address, 0x44, imsk1);
+            intr_mask1 = imsk1;
 
             if (setup_submap)
                 select_submap(DEC_SUBMAP_USER);
@@ -337,6 +418,67 @@ namespace ad_decoder {
             if (unmask_manual_intr)
                 imsk2 |= 0x80;
             I2C_WRITE(address, 0x48, imsk2);
+            intr_mask2 = imsk2;
+
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_USER);
+        }
+
+        // Latched interrupt status 2: CCAPD (0x01), SD field change
+        // (0x10), CHX min/max (0x20), manual interrupt (0x80).
+        uint8_t interrupt_status2(bool setup_submap = true)
+        {
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_INTR_VDP);
+
+            const uint8_t ists2 = I2C_READ_ONE(address, 0x46);
+
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_USER);
+            return ists2;
+        }
+
+        // Reads the latched interrupt status of the three banks, 0x42 to
+        // 0x4a with the raw status 2 in between, in one transaction. The
+        // causes are the latched bits that are unmasked, i.e. that pull
+        // INTRQ. If the read fails, every cause is reported, so that none
+        // is lost, and true is returned.
+        bool read_interrupts(InterruptCauses &irq, bool setup_submap = true)
+        {
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_INTR_VDP);
+
+            uint8_t r[0x4a - 0x42 + 1];
+            const bool err = I2C_READ(address, 0x42, r, sizeof(r));
+            if (err) {
+                irq = { INTR1_ALL, INTR2_ALL, INTR3_ALL, 0x00 };
+            } else {
+                irq.causes1 = r[0x42 - 0x42] & intr_mask1;
+                irq.causes2 = r[0x46 - 0x42] & intr_mask2;
+                irq.causes3 = r[0x4a - 0x42] & intr_mask3;
+                irq.raw2 = r[0x45 - 0x42];
+            }
+
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_USER);
+            return err;
+        }
+
+        // Clears the causes in irq and nothing else, skipping the banks
+        // without any: a cause latched after read_interrupts() keeps
+        // INTRQ asserted.
+        void interrupt_clear(const InterruptCauses &irq,
+                bool setup_submap = true)
+        {
+            if (setup_submap)
+                select_submap(DEC_SUBMAP_INTR_VDP);
+
+            if (irq.causes1)
+                I2C_WRITE(address, 0x43, irq.causes1);
+            if (irq.causes2)
+                I2C_WRITE(address, 0x47, irq.causes2);
+            if (irq.causes3)
+                I2C_WRITE(address, 0x4b, irq.causes3);
 
             if (setup_submap)
                 select_submap(DEC_SUBMAP_USER);
@@ -397,6 +539,7 @@ namespace ad_decoder {
             if (unmask_pal_sw_lock_change)
                 imsk3 |= 0x20;
             I2C_WRITE(address, 0x4c, imsk3);
+            intr_mask3 = imsk3;
 
             if (setup_submap)
                 select_submap(DEC_SUBMAP_USER);
@@ -3,11 +3,10 @@
 #include <yaal/requirements.hh>
 
 #ifdef __YAAL__
-#include <yaal/io/ports.hh>
-#include <yaal/communication/i2c_hw.hh>
+#include "hal.hh"
 
 namespace ad_encoder {
-	using namespace yaal;
+	using namespace koryuu::hal;
 
 	template<typename RESET>
 	class ADV7391 {
@@ -5,6 +5,7 @@
 
 #ifdef __YAAL__
 #include <yaal/types/autounion.hh>
+#include "hal.hh"
 
 /*
  * Based on a simple public domain implementation of the standard CRC32
@@ -25,23 +26,17 @@ namespace crc {
         }
 
         template<uint32_t size>
-        struct crc32_shim {
-            using arr_type = uint32_t[size];
-            arr_type arr;
-        };
-
-        template<uint32_t size>
-        constexpr auto crc32_table() -> const crc32_shim<size> {
-            crc32_shim<size> ret = { 0UL };
+        constexpr auto crc32_table() -> koryuu::hal::FlashTable<uint32_t, size>
+        {
+            koryuu::hal::FlashTable<uint32_t, size> ret = {{ 0UL }};
             for (uint32_t i = 0; i < size; ++i) {
-                ret.arr[i] = crc32_for_byte(i);
+                ret.data[i] = crc32_for_byte(i);
             }
             return ret;
         }
 
-        // Requires 1 kB of data memory, which is about 50% of it.
-        // Hopefully this won't be a problem.
-        const constexpr auto crc32table = crc32_table<0x100UL>();
+        // 1 kB, in flash: half of the RAM otherwise.
+        constexpr auto crc32table HAL_PROGMEM = crc32_table<0x100UL>();
     }
 
     template<typename T>
@@ -49,7 +44,7 @@ namespace crc {
             const uint32_t *const init = nullptr)
     {
         using yaal::autounion;
-        const constexpr auto &table = internal::crc32table.arr;
+        const auto &table = internal::crc32table;
         const uint8_t *data = reinterpret_cast<const uint8_t *>(data_T);
         autounion<uint32_t, true> crc(init ? *init : 0UL);
 
@@ -3,59 +3,139 @@
 #include <yaal/requirements.hh>
 
 #ifdef __YAAL__
-#include <yaal/io/ports.hh>
-
-#include <avr/interrupt.h>
+#include "hal.hh"
 
 namespace koryuu {
-        template<typename ButtonPort>
+        // Lanes of a ButtonBank: bit n of PIND is lane n, bit n of PINB
+        // lane 8 + n.
+        constexpr uint8_t LANE_D = 0;
+        constexpr uint8_t LANE_B = 8;
+
+        constexpr uint8_t lane_count(uint16_t lanes)
+        {
+                return lanes ? (lanes & 1) + lane_count(lanes >> 1) : 0;
+        }
+
+        // Debounces all the buttons (active low) of ports D and B at once:
+        // both ports are sampled once per tick and a vertical counter, one
+        // 16-bit word per counter bit, counts the samples that differ from
+        // the debounced level in every lane in parallel. A lane changes
+        // level after 16 differing samples in a row. The interrupt takes
+        // the same time however many buttons there are.
+        template<uint16_t LANES>
+        class ButtonBank {
+                static constexpr uint8_t COUNTER_BITS = 4;
+                static constexpr uint8_t NUM_BUTTONS = lane_count(LANES);
+
+                uint16_t counter[COUNTER_BITS];
+                volatile uint16_t state;
+                // Timer ticks of the last debounced edges, per button in
+                // lane order.
+                volatile uint16_t press_time[NUM_BUTTONS];
+                volatile uint16_t release_time[NUM_BUTTONS];
+
+                static constexpr uint8_t slot(uint8_t lane)
+                {
+                        return lane_count(LANES & ((1u << lane) - 1));
+                }
+
+        public:
+                ButtonBank()
+                        : counter{}, state(0), press_time{}, release_time{}
+                {}
+
+                // From the timer interrupt, now in timer ticks. Returns
+                // the lanes that changed level; the interrupt hands them
+                // on to the main loop, see event_queue.hh.
+                uint16_t debounce(uint16_t now)
+                {
+                        const uint16_t down = ~(hal::pin_levels_d() |
+                                (uint16_t)hal::pin_levels_b() << 8) & LANES;
+                        const uint16_t differs = down ^ state;
+
+                        // Count up the lanes that differ, restart the rest.
+                        // The carry out of the top bit is the lanes that
+                        // reached 16.
+                        uint16_t carry = differs;
+                        for (uint8_t i = 0; i < COUNTER_BITS; ++i) {
+                                const uint16_t c = counter[i] & differs;
+                                counter[i] = c ^ carry;
+                                carry &= c;
+                        }
+                        if (!carry)
+                                return 0;
+
+                        state ^= carry;
+                        for (uint8_t lane = 0, s = 0; lane < 16; ++lane) {
+                                const uint16_t bit = 1u << lane;
+                                if (!(LANES & bit))
+                                        continue;
+                                if (carry & bit) {
+                                        if (down & bit)
+                                                press_time[s] = now;
+                                        else
+                                                release_time[s] = now;
+                                }
+                                ++s;
+                        }
+                        return carry;
+                }
+
+                // Debounced levels, a bit set while the button is held down.
+                YAAL_INLINE("ButtonBank::held()")
+                uint16_t held() const
+                {
+                        return state;
+                }
+
+                // When the debounced level of a lane last went down and up.
+                // Read with the interrupts off, or from the timer interrupt.
+                YAAL_INLINE("ButtonBank::pressed_at()")
+                uint16_t pressed_at(uint8_t lane) const
+                {
+                        return press_time[slot(lane)];
+                }
+
+                YAAL_INLINE("ButtonBank::released_at()")
+                uint16_t released_at(uint8_t lane) const
+                {
+                        return release_time[slot(lane)];
+                }
+        };
+
+        // One button of a ButtonBank, with the pin it is on.
+        template<typename Bank, typename ButtonPort, uint8_t LANE>
         class DebouncedButton {
+                static constexpr uint16_t BIT = 1u << LANE;
+
                 ButtonPort button;
-                uint8_t counter;
-                const uint8_t debounce_factor;
-                bool state;
-                volatile bool is_down;
+                Bank &bank;
         public:
-                DebouncedButton(uint8_t db_factor = 16)
-                        : button(), counter(0), debounce_factor(db_factor),
-                        state(false), is_down(false)
-                {}
+                DebouncedButton(Bank &b) : button(), bank(b) {}
 
                 YAAL_INLINE("DBButton::set_mode()")
-                void set_mode(yaal::Mode mode)
+                void set_mode(hal::Mode mode)
                 {
                         button.mode = mode;
                 }
 
-                YAAL_INLINE("DBButton::debounce()")
-                void debounce()
+                // Debounced level, true while the button is held down.
+                YAAL_INLINE("DBButton::held()")
+                bool held() const
                 {
-                        bool curr_state = !button;
+                        return bank.held() & BIT;
+                }
 
-                        if (curr_state != state) {
-                            if (++counter == debounce_factor) {
-                                state = curr_state;
-                                if (state) {
-                                    // Will be reset to false when read
-                                    // in read().
-                                    is_down = true;
-                                }
-                                counter = 0;
-                            }
-                        }
-                        else {
-                            counter = 0;
-                        }
+                YAAL_INLINE("DBButton::pressed_at()")
+                uint16_t pressed_at() const
+                {
+                        return bank.pressed_at(LANE);
                 }
 
-                YAAL_INLINE("DBButton::read()")
-                bool read()
+                YAAL_INLINE("DBButton::released_at()")
+                uint16_t released_at() const
                 {
-                        cli();
-                        const bool ret = is_down;
-                        is_down = false;
-                        sei();
-                        return ret;
+                        return bank.released_at(LANE);
                 }
         };
 }
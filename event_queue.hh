@@ -0,0 +1,81 @@
+#ifndef KORYUU_EVENT_QUEUE_HH
+#define KORYUU_EVENT_QUEUE_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+
+// Events from the interrupt handlers to the main loop, in the order they
+// were posted. The handlers are the single producer (they do not nest on
+// the AVR), the main loop the single consumer. Neither side masks the
+// interrupts: each index is written by one side only, in a single byte
+// store, after the slot it covers.
+namespace koryuu {
+    enum EventType : uint8_t {
+        EVENT_BUTTON = 1,   // Debounced edge: lane, BUTTON_DOWN if pressed
+        EVENT_GESTURE = 2,  // Gesture or'ed with the button, see gesture.hh
+        EVENT_INTRQ = 3,    // Falling edge of the decoder INTRQ
+    };
+    constexpr uint8_t BUTTON_DOWN = 0x80;
+
+    struct Event {
+        uint8_t type;
+        uint8_t payload;
+        uint16_t time; // Timer ticks
+    };
+
+    // N, the capacity, is a power of two no larger than 128: the free
+    // running indices differ by at most N.
+    template<uint8_t N>
+    class EventQueue {
+        static_assert(N && !(N & (N - 1)) && N <= 128,
+            "EventQueue capacity must be a power of two up to 128");
+
+        Event slots[N];
+        volatile uint8_t head;    // Written by the producer
+        volatile uint8_t tail;    // Written by the consumer
+        volatile uint8_t dropped; // Written by the producer
+
+    public:
+        EventQueue() : slots{}, head(0), tail(0), dropped(0) {}
+
+        // Producer side. A full queue drops the event and counts it.
+        bool post(uint8_t type, uint8_t payload, uint16_t time) {
+            const uint8_t h = head;
+            if ((uint8_t)(h - tail) == N) {
+                if (dropped != 0xff)
+                    dropped = dropped + 1;
+                return false;
+            }
+            // The consumer is done with the slot before it is reused.
+            hal::memory_barrier();
+            Event &e = slots[h & (N - 1)];
+            e.type = type;
+            e.payload = payload;
+            e.time = time;
+            hal::memory_barrier();
+            head = h + 1;
+            return true;
+        }
+
+        // Consumer side: the oldest event, false if there is none.
+        bool take(Event &e) {
+            const uint8_t t = tail;
+            if (head == t)
+                return false;
+            hal::memory_barrier();
+            e = slots[t & (N - 1)];
+            hal::memory_barrier();
+            tail = t + 1;
+            return true;
+        }
+
+        // Events dropped on a full queue since reset, saturating.
+        YAAL_INLINE("EventQueue::dropped_count()")
+        uint8_t dropped_count() const {
+            return dropped;
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_EVENT_QUEUE_HH
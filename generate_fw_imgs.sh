@@ -4,6 +4,7 @@ FW_PREFIX="koryuu-fw"
 TARGETS="hex hex_ntp debug debug_ntp debug2 debug2_ntp no_panic no_autoreset"
 ARCHIVE_NAME="${FW_PREFIX}_images.zip"
 HEX_TARGETS=""
+SIZE_REPORTS=""
 
 SEVENZIP_CANDIDATES="7z 7za"
 SEVENZIP=""
@@ -21,9 +22,10 @@ for target in ${TARGETS}; do
 	[ "x${target}" = "xhex" ] && target="default"
 	[ "x${target}" = "xhex_ntp" ] && target="ntp"
 	HEX_TARGETS="${HEX_TARGETS} ${FW_PREFIX}_${target}.hex"
+	SIZE_REPORTS="${SIZE_REPORTS} ${FW_PREFIX}_${target}_size.txt"
 done
 
-rm -f ${HEX_TARGETS} "${ARCHIVE_NAME}"
+rm -f ${HEX_TARGETS} ${SIZE_REPORTS} "${ARCHIVE_NAME}"
 
 # Ugly repetition of the HEX_TARGETS logic... ideas anyone?
 for target in ${TARGETS}; do
@@ -31,9 +33,11 @@ for target in ${TARGETS}; do
 	[ "x${target}" = "xhex" ] && target="default"
 	[ "x${target}" = "xhex_ntp" ] && target="ntp"
 	mv "${FW_PREFIX}.hex" "${FW_PREFIX}_${target}.hex" || exit 1
+	mv "${FW_PREFIX}_size.txt" "${FW_PREFIX}_${target}_size.txt" || exit 1
 done
 
 rm -f "${FW_PREFIX}.hex"
 ln -s "${FW_PREFIX}_default.hex" "${FW_PREFIX}.hex"
 ls -al ${HEX_TARGETS}
-${COMPRESS} ${HEX_TARGETS}
+# All images share the log message table.
+${COMPRESS} ${HEX_TARGETS} ${SIZE_REPORTS} "${FW_PREFIX}_log.json"
@@ -0,0 +1,141 @@
+#ifndef KORYUU_GESTURE_HH
+#define KORYUU_GESTURE_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+#include "event_queue.hh"
+
+namespace koryuu {
+    enum GestureButton : uint8_t {
+        GESTURE_INPUT = 0,
+        GESTURE_OPTION = 1,
+    };
+
+    // A gesture of one button is or'ed with the button.
+    enum Gesture : uint8_t {
+        GESTURE_NONE = 0x00,
+        GESTURE_PRESS = 0x10,        // Released, no second press followed
+        GESTURE_DOUBLE_PRESS = 0x20, // Second press released
+        GESTURE_LONG_PRESS = 0x30,   // Still held, delivered once
+        GESTURE_CHORD = 0x40,        // Both pressed together
+    };
+
+    // Times in timer ticks.
+    struct GestureTimings {
+        uint16_t chord;       // Most time between the presses of a chord
+        uint16_t double_gap;  // Most time from a release to the next press
+        uint16_t long_press;  // Hold time of a long press
+    };
+
+    // Gesture recognizer, run from the timer interrupt after the
+    // debouncing: the press and release times of the buttons decide,
+    // not when the main loop gets to look. Gestures are posted to the
+    // event queue (EVENT_GESTURE).
+    //
+    // A press is only known to be single once the double press gap has
+    // passed after its release. A chord, or a long press, is not also
+    // delivered as the presses it is made of.
+    template<typename Queue>
+    class GestureRecognizer {
+        enum TrackState : uint8_t {
+            TRACK_IDLE,
+            TRACK_DOWN,      // First press held
+            TRACK_WAIT,      // Released, a second press may follow
+            TRACK_DOWN2,     // Second press held
+            TRACK_SUPPRESS,  // Used up, until released
+        };
+
+        const GestureTimings &timings;
+        Queue &events;
+        TrackState track[2];
+        bool was_held[2];
+
+        // A full queue drops the gesture: the main loop is far behind.
+        void push(uint8_t g, uint16_t now) {
+            events.post(EVENT_GESTURE, g, now);
+        }
+
+        template<typename Button, typename Other>
+        void update_one(uint8_t b, const Button &btn, uint8_t other_b,
+                const Other &other, uint16_t now) {
+            const bool held = btn.held();
+            const bool pressed = held && !was_held[b];
+            const bool released = !held && was_held[b];
+            was_held[b] = held;
+
+            switch (track[b]) {
+            case TRACK_IDLE:
+                if (!pressed)
+                    break;
+                track[b] = TRACK_DOWN;
+                if (track[other_b] == TRACK_DOWN &&
+                    (uint16_t)(btn.pressed_at() - other.pressed_at()) <=
+                        timings.chord)
+                {
+                    push(GESTURE_CHORD, now);
+                    track[b] = track[other_b] = TRACK_SUPPRESS;
+                }
+                break;
+            case TRACK_DOWN:
+            case TRACK_DOWN2:
+                if (released) {
+                    if (track[b] == TRACK_DOWN) {
+                        track[b] = TRACK_WAIT;
+                    }
+                    else {
+                        push(GESTURE_DOUBLE_PRESS | b, now);
+                        track[b] = TRACK_IDLE;
+                    }
+                }
+                else if ((uint16_t)(now - btn.pressed_at()) >=
+                    timings.long_press)
+                {
+                    push(GESTURE_LONG_PRESS | b, now);
+                    track[b] = TRACK_SUPPRESS;
+                }
+                break;
+            case TRACK_WAIT:
+                if (pressed) {
+                    track[b] = TRACK_DOWN2;
+                }
+                else if ((uint16_t)(now - btn.released_at()) >
+                    timings.double_gap)
+                {
+                    push(GESTURE_PRESS | b, now);
+                    track[b] = TRACK_IDLE;
+                }
+                break;
+            case TRACK_SUPPRESS:
+                if (!held)
+                    track[b] = TRACK_IDLE;
+                break;
+            }
+        }
+
+    public:
+        GestureRecognizer(const GestureTimings &t, Queue &q)
+            : timings(t), events(q), track{ TRACK_IDLE, TRACK_IDLE },
+              was_held{ false, false }
+        {}
+
+        // From the timer interrupt, after debouncing both buttons.
+        template<typename Input, typename Option>
+        void update(const Input &input, const Option &option,
+                uint16_t now) {
+            update_one(GESTURE_INPUT, input, GESTURE_OPTION, option, now);
+            update_one(GESTURE_OPTION, option, GESTURE_INPUT, input, now);
+        }
+
+        // Drops the gestures in progress; buttons held down are ignored
+        // until released. Gestures already posted are not taken back.
+        void cancel() {
+            hal::irq_disable();
+            for (uint8_t b = 0; b < 2; ++b)
+                track[b] = was_held[b] ? TRACK_SUPPRESS : TRACK_IDLE;
+            hal::irq_enable();
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_GESTURE_HH
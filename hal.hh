@@ -0,0 +1,73 @@
+#ifndef KORYUU_HAL_HH
+#define KORYUU_HAL_HH
+#include <yaal/requirements.hh>
+
+// Hardware abstraction layer: everything the firmware needs from the MCU
+// goes through koryuu::hal, so that the control logic also builds as a
+// native host executable (see host/ and 'make host').
+//
+// GPIO:    pin types PortXn with yaal's interface (mode, assignment,
+//          conversion to bool) and the Mode values INPUT, OUTPUT and
+//          INPUT_PULLUP; pin_levels_b(), pin_levels_d() read the input
+//          levels of a whole port (PINB, PIND)
+// I2C:     i2c_setup(), i2c_write(addr, bytes...) (true on failure, as
+//          yaal's I2c_HW), i2c_read_one(addr, reg), i2c_read(addr, reg,
+//          buf, n) for n registers in one transaction, i2c_set_trace()
+// EEPROM:  HAL_EEMEM objects, eeprom_read() and eeprom_update()
+// Flash:   HAL_PSTR(), flash_read_byte(), flash_strlen(), flash_read(),
+//          HAL_PROGMEM objects, FlashTable below
+// Timer:   setup_tick_timer() runs HAL_ISR(TIMER0_COMPA_vect) at
+//          1 / TICK_US; delay_ms(); busy_wait() in every loop that polls
+//          for an interrupt or peripheral, where the host build lets
+//          its clock run; cpu_sleep() until the next interrupt;
+//          led_timer_start() runs HAL_ISR(TIMER2_COMPA_vect) at
+//          1 / LED_TICK_US until led_timer_stop()
+// INT0:    int0_setup() runs HAL_ISR(INT0_vect) on falling edges of
+//          PD2
+// UART:    uart_setup(), uart_tx_irq(), uart_data_empty(),
+//          uart_put_data(), uart_get_data(), with HAL_ISR(USART_UDRE_vect)
+//          and HAL_ISR(USART_RX_vect)
+// Misc:    irq_disable(), irq_enable(), irq_enabled(), memory_barrier()
+//          (orders memory accesses around it, e.g. between an ISR and
+//          the main loop), watchdog_off(),
+//          watchdog_enable_2s(), watchdog_enable_4s(), watchdog_kick(),
+//          take_reset_flags() (MCUSR, cleared), profile_mark() for the
+//          section markers of profile.hh
+// RAM:     static_ram() bytes of .data and .bss, stack_unused() bytes
+//          the stack has never reached since reset (0 on the host),
+//          HAL_NOINIT objects that keep their value over a watchdog
+//          reset
+#ifdef KORYUU_HOST
+#include "host/hal_host.hh"
+#else
+#include "hal_avr.hh"
+#endif
+
+namespace koryuu {
+    namespace hal {
+        // 1 MHz / 1024 / (OCR0A + 1), see setup_tick_timer().
+        constexpr uint16_t TICK_US = 5120;
+        // 1 MHz / 8 / (OCR2A + 1), see led_timer_start().
+        constexpr uint16_t LED_TICK_US = 2000;
+
+        // A constant table kept in flash and read one element at a time,
+        // e.g.
+        //   constexpr FlashTable<uint8_t, 2> T HAL_PROGMEM = {{ 1, 2 }};
+        // Plain constexpr arrays indexed at runtime are copied to RAM
+        // on the AVR.
+        template<typename T, size_t N>
+        struct FlashTable {
+            T data[N];
+
+            T operator[](size_t i) const
+            {
+                T v;
+                flash_read(&v, &data[i], sizeof(T));
+                return v;
+            }
+
+            static constexpr size_t size() { return N; }
+        };
+    }
+}
+#endif // KORYUU_HAL_HH
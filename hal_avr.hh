@@ -0,0 +1,378 @@
+#ifndef KORYUU_HAL_AVR_HH
+#define KORYUU_HAL_AVR_HH
+#include <yaal/requirements.hh>
+
+// AVR backend of the HAL (see hal.hh): yaal and avr-libc.
+#ifdef __YAAL__
+#include <yaal/io/ports.hh>
+#include <yaal/communication/i2c_hw.hh>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+
+#define HAL_ISR(vector) ISR(vector)
+#define HAL_EEMEM EEMEM
+#define HAL_PSTR(s) PSTR(s)
+#define HAL_PROGMEM PROGMEM
+#define HAL_NOINIT __attribute__((section(".noinit")))
+
+namespace koryuu {
+    namespace hal {
+        using yaal::Mode;
+        using yaal::INPUT;
+        using yaal::OUTPUT;
+        using yaal::INPUT_PULLUP;
+
+        using yaal::PortB1;
+        using yaal::PortB2;
+        using yaal::PortB6;
+        using yaal::PortB7;
+        using yaal::PortC2;
+        using yaal::PortC4;
+        using yaal::PortC5;
+        using yaal::PortD2;
+        using yaal::PortD5;
+        using yaal::PortD6;
+        using yaal::PortD7;
+
+        using i2c_trace_f_t = void (*)(uint8_t addr, const uint8_t *begin,
+            const uint8_t *end, bool start, bool stop);
+
+        inline void irq_disable()
+        {
+            cli();
+        }
+
+        inline void irq_enable()
+        {
+            sei();
+        }
+
+        inline bool irq_enabled()
+        {
+            return SREG & _BV(SREG_I);
+        }
+
+        // One core, so keeping the compiler from moving accesses across
+        // is enough.
+        inline void memory_barrier()
+        {
+            __asm__ __volatile__("" ::: "memory");
+        }
+
+        // _delay_ms() needs a compile-time constant, hence always inline.
+        __attribute__((always_inline))
+        inline void delay_ms(double ms)
+        {
+            _delay_ms(ms);
+        }
+
+        inline void busy_wait()
+        {
+        }
+
+        // Idle mode: the timers, the UART and TWI keep running and wake
+        // the CPU with their interrupts.
+        inline void cpu_sleep()
+        {
+            set_sleep_mode(SLEEP_MODE_IDLE);
+            sleep_mode();
+        }
+
+        template<typename ...Ts>
+        inline void i2c_setup(Ts... args)
+        {
+            yaal::I2c_HW.setup(args...);
+        }
+
+        inline void i2c_deinit()
+        {
+            yaal::I2c_HW.deinit();
+        }
+
+        // Returns true on failure.
+        template<bool start = true, bool stop = true, typename ...Ts>
+        inline bool i2c_write(uint8_t addr, Ts... args)
+        {
+            return yaal::I2c_HW.write<start, stop>(addr, args...);
+        }
+
+        inline uint8_t i2c_read_one(uint8_t addr, uint8_t reg)
+        {
+            yaal::I2c_HW.write<true, false>(addr, reg);
+            return yaal::I2c_HW.read(addr);
+        }
+
+        // Polls of the TWI before a step counts as failed: about 5 ms at
+        // 1 MHz, dozens of byte times at 100 kHz. A stuck bus then fails
+        // the transfer instead of hanging until the watchdog fires.
+        constexpr uint16_t TWI_SPIN_LIMIT = 1000;
+        // twi_step() result for a step that did not complete; not a TWSR
+        // status code.
+        constexpr uint8_t TWI_TIMEOUT = 0xff;
+
+        // Starts a TWI step and waits for it to finish. Returns the status
+        // code of TWSR, or TWI_TIMEOUT.
+        inline uint8_t twi_step(uint8_t twcr)
+        {
+            TWCR = twcr;
+            for (uint16_t n = TWI_SPIN_LIMIT; n; --n) {
+                if (TWCR & _BV(TWINT))
+                    return TWSR & 0xf8;
+            }
+            return TWI_TIMEOUT;
+        }
+
+        // Sends a STOP and waits until it is off the bus, so that the next
+        // START is not issued over it. Returns true on failure.
+        inline bool twi_stop()
+        {
+            TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+            for (uint16_t n = TWI_SPIN_LIMIT; n; --n) {
+                if (!(TWCR & _BV(TWSTO)))
+                    return false;
+            }
+            return true;
+        }
+
+        // Reads n > 0 consecutive registers from reg on, in a single
+        // transaction: the register write, a repeated start and the
+        // reads, ACKed but the last. yaal's I2c_HW reads one byte per
+        // transaction, so the read phase drives the TWI directly.
+        // Returns true on failure, including a bus that got stuck.
+        inline bool i2c_read(uint8_t addr, uint8_t reg, uint8_t *buf,
+            uint8_t n)
+        {
+            bool err = yaal::I2c_HW.write<true, false>(addr, reg);
+            // Repeated start, SLA+R
+            if (!err)
+                err = twi_step(_BV(TWINT) | _BV(TWSTA) | _BV(TWEN)) != 0x10;
+            if (!err) {
+                TWDR = (uint8_t)(addr << 1) | 1;
+                err = twi_step(_BV(TWINT) | _BV(TWEN)) != 0x40;
+            }
+            for (; !err && n; --n) {
+                const bool last = n == 1;
+                err = twi_step(_BV(TWINT) | _BV(TWEN) |
+                    (last ? 0 : _BV(TWEA))) != (last ? 0x58 : 0x50);
+                *buf++ = TWDR;
+            }
+            if (twi_stop())
+                err = true;
+            return err;
+        }
+
+        inline void i2c_set_trace(i2c_trace_f_t f)
+        {
+            yaal::I2c_HW.set_trace(f);
+        }
+
+        inline void eeprom_read(void *dst, const void *src, size_t n)
+        {
+            eeprom_read_block(dst, src, n);
+        }
+
+        inline void eeprom_update(const void *src, void *dst, size_t n)
+        {
+            eeprom_update_block(src, dst, n);
+        }
+
+        inline uint8_t flash_read_byte(const void *p)
+        {
+            return pgm_read_byte(p);
+        }
+
+        inline size_t flash_strlen(const char *p)
+        {
+            return strlen_P(p);
+        }
+
+        // Single LPM sequences for the sizes that have one.
+        __attribute__((always_inline))
+        inline void flash_read(void *dst, const void *src, size_t n)
+        {
+            if (__builtin_constant_p(n) && n == 1)
+                *static_cast<uint8_t *>(dst) = pgm_read_byte(src);
+            else if (__builtin_constant_p(n) && n == 2)
+                *static_cast<uint16_t *>(dst) = pgm_read_word(src);
+            else if (__builtin_constant_p(n) && n == 4)
+                *static_cast<uint32_t *>(dst) = pgm_read_dword(src);
+            else
+                memcpy_P(dst, src, n);
+        }
+
+        // Stack painting: .init1 fills the RAM between the static data
+        // and the top of the stack with STACK_PAINT before the C runtime
+        // starts, stack_unused() counts the bytes the stack has never
+        // reached since. There is no heap.
+        constexpr uint8_t STACK_PAINT = 0xc5;
+
+        // Linker symbols.
+        extern "C" uint8_t __data_start;
+        extern "C" uint8_t _end;
+        extern "C" uint8_t __stack;
+
+        // No stack yet and r1 is not cleared: registers only.
+        __attribute__((naked, used, section(".init1")))
+        static void stack_paint()
+        {
+            asm volatile(
+                "    ldi r30, lo8(_end)\n"
+                "    ldi r31, hi8(_end)\n"
+                "    ldi r24, %0\n"
+                "    ldi r25, hi8(__stack)\n"
+                "    rjmp 2f\n"
+                "1:  st Z+, r24\n"
+                "2:  cpi r30, lo8(__stack)\n"
+                "    cpc r31, r25\n"
+                "    brlo 1b\n"
+                "    breq 1b\n"
+                :: "i" (STACK_PAINT));
+        }
+
+        inline uint16_t stack_unused()
+        {
+            const uint8_t *p = &_end;
+            while (p <= &__stack && *p == STACK_PAINT)
+                ++p;
+            return p - &_end;
+        }
+
+        // .data and .bss.
+        inline uint16_t static_ram()
+        {
+            return &_end - &__data_start;
+        }
+
+        inline uint8_t pin_levels_b()
+        {
+            return PINB;
+        }
+
+        inline uint8_t pin_levels_d()
+        {
+            return PIND;
+        }
+
+        inline void int0_setup()
+        {
+            // Falling edge
+            EICRA = _BV(ISC01);
+            EIFR = _BV(INTF0);
+            EIMSK = _BV(INT0);
+        }
+
+        inline void setup_tick_timer()
+        {
+            // CTC mode, prescaler 1024, frequency 195 Hz
+            TCCR0A = _BV(WGM01);
+            TCCR0B = _BV(CS00) | _BV(CS02);
+            OCR0A = 4;
+
+            // Generate an interrupt on compare match
+            TIMSK0 = _BV(OCIE0A);
+        }
+
+        inline void led_timer_start()
+        {
+            // CTC mode, prescaler 8, frequency 500 Hz
+            TCCR2A = _BV(WGM21);
+            OCR2A = 249;
+            TCNT2 = 0;
+            TIFR2 = _BV(OCF2A);
+            TIMSK2 = _BV(OCIE2A);
+            TCCR2B = _BV(CS21);
+        }
+
+        // Stops the clock of the timer too.
+        inline void led_timer_stop()
+        {
+            TCCR2B = 0;
+            TIMSK2 = 0;
+        }
+
+        // Must be called early: the watchdog stays enabled after it has
+        // reset the MCU.
+        inline void watchdog_off()
+        {
+            cli();
+            wdt_reset();
+            MCUSR &= ~_BV(WDRF);
+            WDTCSR |= _BV(WDE) | _BV(WDCE);
+            WDTCSR = 0x00;
+            sei();
+        }
+
+        inline void watchdog_enable_2s()
+        {
+            wdt_enable(WDTO_2S);
+        }
+
+        inline void watchdog_enable_4s()
+        {
+            wdt_enable(WDTO_4S);
+        }
+
+        inline void watchdog_kick()
+        {
+            wdt_reset();
+        }
+
+        // Must be called before watchdog_off(), which clears WDRF.
+        inline uint8_t take_reset_flags()
+        {
+            const uint8_t f = MCUSR;
+            MCUSR = 0;
+            return f;
+        }
+
+        // A single OUT instruction; GPIOR0 is otherwise unused.
+        inline void profile_mark(uint8_t v)
+        {
+            GPIOR0 = v;
+        }
+
+        // USART0, 8N1, with the receive interrupt enabled.
+        inline void uart_setup(uint32_t baud)
+        {
+            // Double speed mode: 9600 baud is off by 0.2% at 1 MHz.
+            const uint16_t ubrr = (F_CPU + 4 * baud) / (8 * baud) - 1;
+            UBRR0H = ubrr >> 8;
+            UBRR0L = ubrr;
+            UCSR0A = _BV(U2X0);
+            UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+            UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+        }
+
+        // Data register empty interrupt.
+        inline void uart_tx_irq(bool enable)
+        {
+            if (enable)
+                UCSR0B |= _BV(UDRIE0);
+            else
+                UCSR0B &= ~_BV(UDRIE0);
+        }
+
+        inline bool uart_data_empty()
+        {
+            return UCSR0A & _BV(UDRE0);
+        }
+
+        inline void uart_put_data(uint8_t c)
+        {
+            UDR0 = c;
+        }
+
+        inline uint8_t uart_get_data()
+        {
+            return UDR0;
+        }
+    }
+}
+#endif // __YAAL__
+#endif // KORYUU_HAL_AVR_HH
@@ -0,0 +1,480 @@
+#include "hal.hh"
+
+#include <stdio.h>
+#include <deque>
+#include <map>
+#include <utility>
+
+// Bounds of the HAL_EEMEM objects, provided by the linker.
+extern "C" uint8_t __start_koryuu_eeprom[] __attribute__((weak));
+extern "C" uint8_t __stop_koryuu_eeprom[] __attribute__((weak));
+
+namespace koryuu {
+    namespace hal {
+        namespace host {
+            // Constant initialized, the firmware's global constructors
+            // already set up pins.
+            PortState ports[3] = {
+                { 0x00, 0x00, 0xff },
+                { 0x00, 0x00, 0xff },
+                { 0x00, 0x00, 0xff },
+            };
+            Stats stats;
+
+            namespace {
+                // Time of the next event of a kind, NEVER if none is due.
+                constexpr uint64_t NEVER = ~0ull;
+                // Page erase and write of one EEPROM byte.
+                constexpr uint64_t EEPROM_WRITE_US = 3400;
+
+                uint64_t now = 0;
+                uint64_t limit = 0;
+                bool irq_on = false;
+                bool in_isr = false;
+
+                uint64_t next_tick = NEVER;
+                bool tick_pending = false;
+                bool int0_on = false;
+                bool int0_pending = false;
+                uint64_t next_led_tick = NEVER;
+                bool led_tick_pending = false;
+
+                uint64_t wdt_period = 0;
+                uint64_t wdt_expiry = NEVER;
+                uint8_t reset_flags = 0x01;
+
+                std::multimap<uint64_t, std::function<void()>> scheduled;
+
+                uint32_t i2c_hz = 100000;
+                std::map<uint8_t, I2cDevice *> i2c_devices;
+                i2c_trace_f_t i2c_trace = nullptr;
+                std::function<void(const I2cEvent &)> i2c_observer;
+
+                uint32_t byte_us = 1042;
+                bool uart_on = false;
+                bool udrie = false;
+                bool udr_full = false;
+                uint8_t udr;
+                uint64_t shift_done = NEVER;
+                uint8_t shift;
+                void (*uart_out)(uint8_t c) = nullptr;
+                std::deque<uint8_t> rx_queue;
+                uint64_t next_rx = NEVER;
+                bool rxc = false;
+                uint8_t rx_data;
+
+                // Clears the interrupt flag for the duration of an ISR.
+                class IsrScope {
+                    bool prev;
+                public:
+                    IsrScope() : prev(in_isr) { in_isr = true; }
+                    ~IsrScope() { in_isr = prev; }
+                };
+
+                void run_isr(void (*isr)())
+                {
+                    IsrScope scope;
+                    if (isr)
+                        isr();
+                }
+
+                // Runs the interrupts that are pending, highest priority
+                // (lowest vector) first as on the ATmega328P.
+                void service()
+                {
+                    while (irq_on && !in_isr) {
+                        if (int0_pending) {
+                            int0_pending = false;
+                            ++stats.int0_irqs;
+                            run_isr(hal_isr_INT0_vect);
+                        } else if (led_tick_pending) {
+                            led_tick_pending = false;
+                            ++stats.led_timer_irqs;
+                            run_isr(hal_isr_TIMER2_COMPA_vect);
+                        } else if (tick_pending) {
+                            tick_pending = false;
+                            ++stats.timer_irqs;
+                            run_isr(hal_isr_TIMER0_COMPA_vect);
+                        } else if (rxc && hal_isr_USART_RX_vect) {
+                            run_isr(hal_isr_USART_RX_vect);
+                            // An ISR that does not read UDR0 fires once.
+                            rxc = false;
+                        } else if (uart_on && udrie && !udr_full &&
+                                hal_isr_USART_UDRE_vect) {
+                            run_isr(hal_isr_USART_UDRE_vect);
+                            if (!udr_full)
+                                break;
+                        } else {
+                            break;
+                        }
+                    }
+                }
+
+                void start_shift()
+                {
+                    shift = udr;
+                    udr_full = false;
+                    shift_done = now + byte_us;
+                }
+
+                uint64_t next_event()
+                {
+                    uint64_t t = next_tick;
+                    if (next_led_tick < t)
+                        t = next_led_tick;
+                    if (shift_done < t)
+                        t = shift_done;
+                    if (next_rx < t)
+                        t = next_rx;
+                    if (wdt_expiry < t)
+                        t = wdt_expiry;
+                    if (!scheduled.empty() && scheduled.begin()->first < t)
+                        t = scheduled.begin()->first;
+                    return t;
+                }
+
+                void run_events()
+                {
+                    if (now >= next_tick) {
+                        tick_pending = true;
+                        next_tick += TICK_US;
+                    }
+                    if (now >= next_led_tick) {
+                        led_tick_pending = true;
+                        next_led_tick += LED_TICK_US;
+                    }
+                    if (now >= shift_done) {
+                        ++stats.uart_tx_bytes;
+                        if (uart_out)
+                            uart_out(shift);
+                        shift_done = NEVER;
+                        if (udr_full)
+                            start_shift();
+                    }
+                    if (now >= next_rx) {
+                        rx_data = rx_queue.front();
+                        rx_queue.pop_front();
+                        rxc = true;
+                        ++stats.uart_rx_bytes;
+                        next_rx = rx_queue.empty() ? NEVER : now + byte_us;
+                    }
+                    if (now >= wdt_expiry) {
+                        ++stats.watchdog_resets;
+                        fprintf(stderr, "watchdog reset at %llu ms\n",
+                            (unsigned long long)(now / 1000));
+                        wdt_expiry = now + wdt_period;
+                    }
+                    while (!scheduled.empty() &&
+                            scheduled.begin()->first <= now) {
+                        const auto f = std::move(scheduled.begin()->second);
+                        scheduled.erase(scheduled.begin());
+                        f();
+                    }
+                }
+            }
+
+            bool RegisterFile::write(const uint8_t *data, uint8_t n,
+                    bool start)
+            {
+                if (start && n) {
+                    ptr = *data++;
+                    --n;
+                }
+                while (n--)
+                    regs[ptr++] = *data++;
+                return true;
+            }
+
+            uint8_t RegisterFile::read()
+            {
+                return regs[ptr++];
+            }
+
+            uint64_t now_us()
+            {
+                return now;
+            }
+
+            void advance_us(uint64_t us)
+            {
+                const uint64_t target = now + us;
+                for (;;) {
+                    const uint64_t t = next_event();
+                    const uint64_t stop_at = target < t ? target : t;
+                    if (limit && stop_at > limit) {
+                        now = limit;
+                        throw Stop();
+                    }
+                    if (t > target)
+                        break;
+                    now = t;
+                    run_events();
+                    service();
+                }
+                now = target;
+            }
+
+            void set_time_limit_us(uint64_t us)
+            {
+                limit = us;
+            }
+
+            void wait_event()
+            {
+                const uint64_t t = next_event();
+                advance_us(t == NEVER ? TICK_US : t > now ? t - now : 0);
+            }
+
+            void schedule(uint64_t at_us, std::function<void()> f)
+            {
+                scheduled.emplace(at_us < now ? now : at_us, std::move(f));
+            }
+
+            void set_input(char port, uint8_t bit, bool level)
+            {
+                PortState &s = ports[port - 'B'];
+                // INT0 on a falling edge of PD2.
+                if (int0_on && port == 'D' && bit == 2 && !level &&
+                        (s.pin & (1u << bit)))
+                    int0_pending = true;
+                if (level)
+                    s.pin |= 1u << bit;
+                else
+                    s.pin &= ~(1u << bit);
+            }
+
+            bool output_level(char port, uint8_t bit)
+            {
+                const PortState &s = ports[port - 'B'];
+                return (s.ddr & s.port) & (1u << bit);
+            }
+
+            void i2c_attach(uint8_t addr, I2cDevice *dev)
+            {
+                if (dev)
+                    i2c_devices[addr] = dev;
+                else
+                    i2c_devices.erase(addr);
+            }
+
+            void i2c_set_speed(uint32_t hz)
+            {
+                i2c_hz = hz;
+            }
+
+            bool i2c_transfer(uint8_t addr, const uint8_t *data, uint8_t n,
+                    bool start, bool stop)
+            {
+                if (i2c_trace)
+                    i2c_trace(addr, data, data + n, start, stop);
+                ++stats.i2c_transfers;
+                stats.i2c_bytes += n;
+                // Address and data bytes of 9 bits, start and stop.
+                const uint32_t bus_us = ((start ? n + 1u : n) * 9u + 2u) *
+                    1000000ull / i2c_hz;
+                advance_us(bus_us);
+
+                const auto dev = i2c_devices.find(addr);
+                const bool ack = dev != i2c_devices.end() &&
+                    dev->second->write(data, n, start);
+                if (!ack)
+                    ++stats.i2c_nacks;
+                if (i2c_observer)
+                    i2c_observer({ addr, false, start, stop, ack, data, n,
+                        bus_us });
+                return !ack;
+            }
+
+            uint8_t i2c_read(uint8_t addr)
+            {
+                uint8_t v;
+                i2c_read(addr, &v, 1);
+                return v;
+            }
+
+            bool i2c_read(uint8_t addr, uint8_t *buf, uint8_t n)
+            {
+                ++stats.i2c_transfers;
+                stats.i2c_bytes += n;
+                const uint32_t bus_us = ((n + 1u) * 9u + 2u) * 1000000ull /
+                    i2c_hz;
+                advance_us(bus_us);
+
+                const auto dev = i2c_devices.find(addr);
+                const bool ack = dev != i2c_devices.end();
+                for (uint8_t i = 0; i < n; ++i)
+                    buf[i] = ack ? dev->second->read() : 0xff;
+                if (!ack)
+                    ++stats.i2c_nacks;
+                if (i2c_observer)
+                    i2c_observer({ addr, true, true, true, ack, buf, n,
+                        bus_us });
+                return !ack;
+            }
+
+            void i2c_monitor(std::function<void(const I2cEvent &)> f)
+            {
+                i2c_observer = std::move(f);
+            }
+
+            void uart_set_output(void (*out)(uint8_t c))
+            {
+                uart_out = out;
+            }
+
+            void uart_inject(const uint8_t *data, size_t n)
+            {
+                if (!n)
+                    return;
+                if (rx_queue.empty() && uart_on)
+                    next_rx = now + byte_us;
+                rx_queue.insert(rx_queue.end(), data, data + n);
+            }
+
+            size_t eeprom_size()
+            {
+                return __stop_koryuu_eeprom - __start_koryuu_eeprom;
+            }
+
+            bool eeprom_load(const char *path)
+            {
+                FILE *f = fopen(path, "rb");
+                if (!f)
+                    return false;
+                const bool ok = fread(__start_koryuu_eeprom, 1,
+                    eeprom_size(), f) == eeprom_size();
+                fclose(f);
+                return ok;
+            }
+
+            bool eeprom_save(const char *path)
+            {
+                FILE *f = fopen(path, "wb");
+                if (!f)
+                    return false;
+                bool ok = fwrite(__start_koryuu_eeprom, 1,
+                    eeprom_size(), f) == eeprom_size();
+                ok = fclose(f) == 0 && ok;
+                return ok;
+            }
+
+            bool led_timer_running()
+            {
+                return next_led_tick != NEVER;
+            }
+
+            void watchdog_set(uint64_t period_us)
+            {
+                wdt_period = period_us;
+                wdt_expiry = period_us ? now + period_us : NEVER;
+            }
+
+            void watchdog_kick()
+            {
+                if (wdt_period)
+                    wdt_expiry = now + wdt_period;
+            }
+
+            void set_reset_flags(uint8_t mcusr)
+            {
+                reset_flags = mcusr;
+            }
+
+            uint8_t take_reset_flags()
+            {
+                const uint8_t f = reset_flags;
+                reset_flags = 0;
+                return f;
+            }
+
+            bool irq_flag()
+            {
+                return irq_on && !in_isr;
+            }
+
+            void set_irq_flag(bool enabled)
+            {
+                irq_on = enabled;
+                service();
+            }
+        }
+
+        void i2c_set_trace(i2c_trace_f_t f)
+        {
+            host::i2c_trace = f;
+        }
+
+        void eeprom_update(const void *src, void *dst, size_t n)
+        {
+            const uint8_t *s = static_cast<const uint8_t *>(src);
+            uint8_t *d = static_cast<uint8_t *>(dst);
+            for (size_t i = 0; i < n; ++i) {
+                if (d[i] == s[i])
+                    continue;
+                d[i] = s[i];
+                ++host::stats.eeprom_writes;
+                host::advance_us(host::EEPROM_WRITE_US);
+            }
+        }
+
+        void setup_tick_timer()
+        {
+            host::next_tick = host::now + TICK_US;
+        }
+
+        void int0_setup()
+        {
+            host::int0_on = true;
+            host::int0_pending = false;
+        }
+
+        void led_timer_start()
+        {
+            host::next_led_tick = host::now + LED_TICK_US;
+        }
+
+        void led_timer_stop()
+        {
+            host::next_led_tick = host::NEVER;
+            host::led_tick_pending = false;
+        }
+
+        void uart_setup(uint32_t baud)
+        {
+            // Start bit, 8 data bits and a stop bit.
+            host::byte_us = (10000000u + baud / 2) / baud;
+            host::uart_on = true;
+            // Bytes queued before wait for the receiver.
+            if (!host::rx_queue.empty() && host::next_rx == host::NEVER)
+                host::next_rx = host::now + host::byte_us;
+        }
+
+        void uart_tx_irq(bool enable)
+        {
+            host::udrie = enable;
+            if (enable)
+                host::service();
+        }
+
+        bool uart_data_empty()
+        {
+            return !host::udr_full;
+        }
+
+        void uart_put_data(uint8_t c)
+        {
+            if (!host::uart_on)
+                return;
+            host::udr = c;
+            host::udr_full = true;
+            if (host::shift_done == host::NEVER)
+                host::start_shift();
+        }
+
+        uint8_t uart_get_data()
+        {
+            host::rxc = false;
+            return host::rx_data;
+        }
+    }
+}
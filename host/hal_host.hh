@@ -0,0 +1,378 @@
+#ifndef KORYUU_HAL_HOST_HH
+#define KORYUU_HAL_HOST_HH
+#include <yaal/requirements.hh>
+
+// Host backend of the HAL (see hal.hh). Runs the firmware as a native
+// executable against a virtual clock: time advances only through
+// delay_ms(), I2C and serial traffic and busy waits, and the timer, INT0
+// and UART interrupts fire in between, whenever interrupts are enabled.
+#ifdef __YAAL__
+#include <string.h>
+#include <functional>
+
+#define HAL_ISR(vector) extern "C" void hal_isr_##vector()
+// EEMEM objects are the EEPROM, kept together so that host::eeprom_load()
+// and host::eeprom_save() can move the image from and to a file.
+#define HAL_EEMEM __attribute__((section("koryuu_eeprom"), used))
+#define HAL_PSTR(s) (s)
+#define HAL_PROGMEM
+// Zeroed at start; the host does not reset.
+#define HAL_NOINIT
+
+// Vectors the firmware may leave out.
+extern "C" void hal_isr_INT0_vect() __attribute__((weak));
+extern "C" void hal_isr_TIMER2_COMPA_vect() __attribute__((weak));
+extern "C" void hal_isr_TIMER0_COMPA_vect() __attribute__((weak));
+extern "C" void hal_isr_USART_UDRE_vect() __attribute__((weak));
+extern "C" void hal_isr_USART_RX_vect() __attribute__((weak));
+
+namespace koryuu {
+    namespace hal {
+        namespace host {
+            // Thrown by the clock when the run time limit is reached.
+            struct Stop {};
+
+            // Port registers B, C and D. pin holds the level driven from
+            // outside, see set_input(); nothing pulls the inputs low
+            // initially, e.g. the buttons are up.
+            struct PortState {
+                uint8_t ddr;
+                uint8_t port;
+                uint8_t pin;
+            };
+            extern PortState ports[3];
+
+            // An I2C target on the virtual bus.
+            class I2cDevice {
+            public:
+                virtual ~I2cDevice() {}
+                // Bytes written after a start condition (start) or as
+                // a continuation of the previous write. Returns false to
+                // NACK.
+                virtual bool write(const uint8_t *data, uint8_t n,
+                    bool start) = 0;
+                virtual uint8_t read() = 0;
+            };
+
+            // Registers and an auto-incrementing subaddress.
+            class RegisterFile : public I2cDevice {
+                uint8_t ptr;
+            public:
+                uint8_t regs[256];
+
+                RegisterFile() : ptr(0) { memset(regs, 0, sizeof(regs)); }
+                bool write(const uint8_t *data, uint8_t n,
+                    bool start) override;
+                uint8_t read() override;
+            };
+
+            struct Stats {
+                uint32_t i2c_transfers;
+                uint32_t i2c_bytes;
+                uint32_t i2c_nacks;
+                uint32_t uart_tx_bytes;
+                uint32_t uart_rx_bytes;
+                uint32_t eeprom_writes;
+                uint32_t timer_irqs;
+                uint32_t led_timer_irqs;
+                uint32_t int0_irqs;
+                // Times the watchdog expired; the firmware keeps running.
+                uint32_t watchdog_resets;
+            };
+            extern Stats stats;
+
+            // A completed transfer, see i2c_monitor().
+            struct I2cEvent {
+                uint8_t addr;
+                bool read;
+                bool start;
+                bool stop;      // Always set for reads
+                bool ack;       // A device answered and took all bytes
+                const uint8_t *data; // Bytes written or read
+                uint8_t n;
+                uint32_t bus_us;
+            };
+
+            uint64_t now_us();
+            // Runs the clock forward, firing due interrupts.
+            void advance_us(uint64_t us);
+            // Throws Stop once the clock passes this time. 0 for none.
+            void set_time_limit_us(uint64_t us);
+            // Advances the clock to the next event, for busy waits.
+            void wait_event();
+            // Runs f at the given time, outside of interrupt context,
+            // e.g. a change of the simulated video signal. Events at the
+            // same time run in the order they were scheduled.
+            void schedule(uint64_t at_us, std::function<void()> f);
+
+            // port is 'B', 'C' or 'D'.
+            void set_input(char port, uint8_t bit, bool level);
+            bool output_level(char port, uint8_t bit);
+
+            // Devices are not owned by the bus; nullptr detaches.
+            void i2c_attach(uint8_t addr, I2cDevice *dev);
+            // Transfers are clocked at this rate, 100 kHz by default.
+            void i2c_set_speed(uint32_t hz);
+            bool i2c_transfer(uint8_t addr, const uint8_t *data, uint8_t n,
+                bool start, bool stop);
+            uint8_t i2c_read(uint8_t addr);
+            // Reads n bytes in one transfer, true on a NACK.
+            bool i2c_read(uint8_t addr, uint8_t *buf, uint8_t n);
+            // Calls f after every transfer, e.g. for bus statistics.
+            // nullptr removes the monitor.
+            void i2c_monitor(std::function<void(const I2cEvent &)> f);
+
+            // Transmitted bytes go to out() in the order they leave the
+            // virtual wire.
+            void uart_set_output(void (*out)(uint8_t c));
+            // Queues bytes to be received at the configured baud rate.
+            void uart_inject(const uint8_t *data, size_t n);
+
+            size_t eeprom_size();
+            bool eeprom_load(const char *path);
+            bool eeprom_save(const char *path);
+
+            // Between led_timer_start() and led_timer_stop().
+            bool led_timer_running();
+
+            // Period of the watchdog, 0 stops it.
+            void watchdog_set(uint64_t period_us);
+            void watchdog_kick();
+            // MCUSR as the firmware finds it at start, power-on by default.
+            void set_reset_flags(uint8_t mcusr);
+            uint8_t take_reset_flags();
+
+            // The I flag of SREG; false while an ISR runs.
+            bool irq_flag();
+            void set_irq_flag(bool enabled);
+        }
+
+        enum Mode : uint8_t {
+            INPUT,
+            OUTPUT,
+            INPUT_PULLUP,
+        };
+
+        // GPIO with the interface of yaal's ports.
+        template<char PORT, uint8_t BIT>
+        class HostPin {
+            static_assert(PORT >= 'B' && PORT <= 'D', "No such port");
+            static constexpr uint8_t MASK = 1u << BIT;
+
+            static host::PortState &state() {
+                return host::ports[PORT - 'B'];
+            }
+
+        public:
+            class ModeProxy {
+            public:
+                ModeProxy &operator=(Mode m) {
+                    host::PortState &s = state();
+                    if (m == OUTPUT) {
+                        s.ddr |= MASK;
+                    } else {
+                        s.ddr &= ~MASK;
+                        if (m == INPUT_PULLUP)
+                            s.port |= MASK;
+                        else
+                            s.port &= ~MASK;
+                    }
+                    return *this;
+                }
+
+                operator Mode() const {
+                    const host::PortState &s = state();
+                    if (s.ddr & MASK)
+                        return OUTPUT;
+                    return s.port & MASK ? INPUT_PULLUP : INPUT;
+                }
+            } mode;
+
+            HostPin &operator=(bool v) {
+                host::PortState &s = state();
+                if (v)
+                    s.port |= MASK;
+                else
+                    s.port &= ~MASK;
+                return *this;
+            }
+
+            operator bool() const {
+                const host::PortState &s = state();
+                return (s.ddr & MASK ? s.port : s.pin) & MASK;
+            }
+        };
+
+        // Outputs read back the level driven, as on the AVR.
+        inline uint8_t pin_levels_b()
+        {
+            const host::PortState &s = host::ports['B' - 'B'];
+            return (s.ddr & s.port) | (~s.ddr & s.pin);
+        }
+
+        inline uint8_t pin_levels_d()
+        {
+            const host::PortState &s = host::ports['D' - 'B'];
+            return (s.ddr & s.port) | (~s.ddr & s.pin);
+        }
+
+        using PortB1 = HostPin<'B', 1>;
+        using PortB2 = HostPin<'B', 2>;
+        using PortB6 = HostPin<'B', 6>;
+        using PortB7 = HostPin<'B', 7>;
+        using PortC2 = HostPin<'C', 2>;
+        using PortC4 = HostPin<'C', 4>;
+        using PortC5 = HostPin<'C', 5>;
+        using PortD2 = HostPin<'D', 2>;
+        using PortD5 = HostPin<'D', 5>;
+        using PortD6 = HostPin<'D', 6>;
+        using PortD7 = HostPin<'D', 7>;
+
+        using i2c_trace_f_t = void (*)(uint8_t addr, const uint8_t *begin,
+            const uint8_t *end, bool start, bool stop);
+
+        inline void irq_disable()
+        {
+            host::set_irq_flag(false);
+        }
+
+        inline void irq_enable()
+        {
+            host::set_irq_flag(true);
+        }
+
+        inline bool irq_enabled()
+        {
+            return host::irq_flag();
+        }
+
+        // A full fence, so that the host can also run code on threads.
+        inline void memory_barrier()
+        {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+
+        inline void delay_ms(double ms)
+        {
+            host::advance_us((uint64_t)(ms * 1000));
+        }
+
+        inline void busy_wait()
+        {
+            host::wait_event();
+        }
+
+        inline void cpu_sleep()
+        {
+            host::wait_event();
+        }
+
+        template<typename ...Ts>
+        inline void i2c_setup(Ts...)
+        {
+        }
+
+        inline void i2c_deinit()
+        {
+        }
+
+        void i2c_set_trace(i2c_trace_f_t f);
+
+        // Returns true on failure.
+        template<bool start = true, bool stop = true, typename ...Ts>
+        inline bool i2c_write(uint8_t addr, Ts... args)
+        {
+            const uint8_t data[] = { static_cast<uint8_t>(args)... };
+            return host::i2c_transfer(addr, data, sizeof(data), start, stop);
+        }
+
+        inline uint8_t i2c_read_one(uint8_t addr, uint8_t reg)
+        {
+            host::i2c_transfer(addr, &reg, 1, true, false);
+            return host::i2c_read(addr);
+        }
+
+        // Returns true on failure.
+        inline bool i2c_read(uint8_t addr, uint8_t reg, uint8_t *buf,
+            uint8_t n)
+        {
+            return host::i2c_transfer(addr, &reg, 1, true, false) |
+                host::i2c_read(addr, buf, n);
+        }
+
+        inline void eeprom_read(void *dst, const void *src, size_t n)
+        {
+            memcpy(dst, src, n);
+        }
+
+        void eeprom_update(const void *src, void *dst, size_t n);
+
+        inline uint8_t flash_read_byte(const void *p)
+        {
+            return *static_cast<const uint8_t *>(p);
+        }
+
+        inline size_t flash_strlen(const char *p)
+        {
+            return strlen(p);
+        }
+
+        inline void flash_read(void *dst, const void *src, size_t n)
+        {
+            memcpy(dst, src, n);
+        }
+
+        // There is no painted stack on the host.
+        inline uint16_t stack_unused()
+        {
+            return 0;
+        }
+
+        inline uint16_t static_ram()
+        {
+            return 0;
+        }
+
+        void int0_setup();
+        void setup_tick_timer();
+        void led_timer_start();
+        void led_timer_stop();
+
+        inline void watchdog_off()
+        {
+            host::watchdog_set(0);
+        }
+
+        inline void watchdog_enable_2s()
+        {
+            host::watchdog_set(2000000);
+        }
+
+        inline void watchdog_enable_4s()
+        {
+            host::watchdog_set(4000000);
+        }
+
+        inline void watchdog_kick()
+        {
+            host::watchdog_kick();
+        }
+
+        inline uint8_t take_reset_flags()
+        {
+            return host::take_reset_flags();
+        }
+
+        inline void profile_mark(uint8_t)
+        {
+        }
+
+        void uart_setup(uint32_t baud);
+        void uart_tx_irq(bool enable);
+        bool uart_data_empty();
+        void uart_put_data(uint8_t c);
+        uint8_t uart_get_data();
+    }
+}
+#endif // __YAAL__
+#endif // KORYUU_HAL_HOST_HH
@@ -0,0 +1,58 @@
+# Native build of the firmware against the host HAL, see host/hal_host.hh.
+# Included from the Makefile; also usable on its own without yaamake:
+#   make -f host/host.mk host
+HOST_CXX ?= g++
+HOST_CXXFLAGS ?= -std=gnu++14 -O1 -g -Wall -Wno-unused-function
+HOST_DEFS ?=
+HOST_BUILD := host/build
+HOST_BIN := $(HOST_BUILD)/koryuu-host
+HOST_SRC := host/hal_host.cpp host/host_main.cpp $(wildcard host/sim/*.cpp)
+HOST_DEPS := main.cpp $(wildcard *.hh *.def host/*.hh host/sim/*.hh \
+	host/yaal/*.hh host/yaal/types/*.hh) $(HOST_SRC)
+# Host headers shadow yaal's, and main() becomes koryuu_firmware_main().
+HOST_FLAGS = $(HOST_CXXFLAGS) $(HOST_DEFS) -DKORYUU_HOST \
+	-DF_CPU=1000000UL -Ihost -I.
+
+host: $(HOST_BIN)
+
+$(HOST_BIN): $(HOST_DEPS)
+	mkdir -p $(HOST_BUILD)
+	$(HOST_CXX) $(HOST_FLAGS) -Dmain=koryuu_firmware_main \
+		-c main.cpp -o $(HOST_BUILD)/firmware.o
+	$(HOST_CXX) $(HOST_FLAGS) $(HOST_BUILD)/firmware.o $(HOST_SRC) -o $@
+
+# Plays every scenario, fails if an assertion does not hold.
+HOST_SCENARIOS := $(wildcard host/scenarios/*.scn)
+host_scenarios: $(HOST_BIN)
+	@failed=0; for s in $(HOST_SCENARIOS); do \
+		echo "== $$s"; \
+		$(HOST_BIN) --scenario $$s || failed=1; \
+	done; exit $$failed
+
+# I2C benchmarks: one JSON report per scenario in host/build/bench/, fails
+# if a budget is exceeded. The budgets hold at the default HOST_SCL.
+HOST_SCL ?= 100000
+HOST_BENCH := $(wildcard host/bench/*.scn)
+host_bench: $(HOST_BIN)
+	mkdir -p $(HOST_BUILD)/bench
+	@failed=0; for s in $(HOST_BENCH); do \
+		echo "== $$s"; \
+		$(HOST_BIN) --scenario $$s --scl $(HOST_SCL) \
+			--report $(HOST_BUILD)/bench/$$(basename $$s .scn).json \
+			|| failed=1; \
+	done; exit $$failed
+
+# Event queue stress test on two threads.
+HOST_STRESS := $(HOST_BUILD)/event_queue_stress
+$(HOST_STRESS): host/stress/event_queue_stress.cpp event_queue.hh hal.hh \
+		host/hal_host.hh
+	mkdir -p $(HOST_BUILD)
+	$(HOST_CXX) $(HOST_FLAGS) -O2 -pthread $< -o $@
+
+host_stress: $(HOST_STRESS)
+	$(HOST_STRESS)
+
+host_clean:
+	rm -rf $(HOST_BUILD)
+
+.PHONY: host host_scenarios host_bench host_stress host_clean
@@ -0,0 +1,171 @@
+// Runs the firmware natively for a given time of the virtual clock, see
+// hal_host.hh. main.cpp is built with -Dmain=koryuu_firmware_main.
+#include "hal.hh"
+#include "sim/adv7280_sim.hh"
+#include "sim/adv7391_sim.hh"
+#include "sim/scenario.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+int koryuu_firmware_main();
+
+namespace {
+    using namespace koryuu::hal;
+
+    FILE *uart_file;
+
+    void write_uart(uint8_t c)
+    {
+        if (uart_file)
+            fputc(c, uart_file);
+        koryuu::sim::Scenario::uart_tx(c);
+    }
+
+    void usage(const char *argv0)
+    {
+        fprintf(stderr,
+            "usage: %s [--ms N] [--scenario FILE] [--report FILE] "
+            "[--scl HZ] [--uart-out FILE] [--uart-in FILE] "
+            "[--eeprom FILE] [--mcusr N]\n"
+            "  --ms N          run for N ms of virtual time (2000)\n"
+            "  --scenario F    play the scenario in F, see sim/scenario.hh;\n"
+            "                  its end overrides --ms\n"
+            "  --report F      write the scenario's I2C measurements to F\n"
+            "                  as JSON\n"
+            "  --scl HZ        I2C clock rate (100000)\n"
+            "  --uart-out F    write the transmitted bytes to F\n"
+            "  --uart-in F     feed the contents of F to the receiver\n"
+            "  --eeprom F      load the EEPROM image from F if it exists,\n"
+            "                  save it there at the end\n"
+            "  --mcusr N       reset flags at start, e.g. 8 after a\n"
+            "                  watchdog reset (1: power-on)\n",
+            argv0);
+    }
+
+    bool inject_file(const char *path)
+    {
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            return false;
+        uint8_t buf[256];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)))
+            host::uart_inject(buf, n);
+        fclose(f);
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ms = 2000;
+    const char *uart_out = nullptr;
+    const char *uart_in = nullptr;
+    const char *eeprom = nullptr;
+    const char *scenario_file = nullptr;
+    const char *report = nullptr;
+    unsigned long scl_hz = 100000;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_arg = i + 1 < argc;
+        if (!strcmp(argv[i], "--ms") && has_arg) {
+            ms = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--uart-out") && has_arg) {
+            uart_out = argv[++i];
+        } else if (!strcmp(argv[i], "--uart-in") && has_arg) {
+            uart_in = argv[++i];
+        } else if (!strcmp(argv[i], "--scenario") && has_arg) {
+            scenario_file = argv[++i];
+        } else if (!strcmp(argv[i], "--report") && has_arg) {
+            report = argv[++i];
+        } else if (!strcmp(argv[i], "--scl") && has_arg) {
+            scl_hz = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--eeprom") && has_arg) {
+            eeprom = argv[++i];
+        } else if (!strcmp(argv[i], "--mcusr") && has_arg) {
+            host::set_reset_flags(strtoul(argv[++i], nullptr, 0));
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!scl_hz || (report && !scenario_file)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    static koryuu::sim::Adv7280Sim decoder;
+    static koryuu::sim::Adv7391Sim encoder;
+    decoder.attach();
+    encoder.attach();
+    koryuu::sim::Scenario scenario(decoder, encoder);
+    if (scenario_file) {
+        if (!scenario.load(scenario_file))
+            return 2;
+        ms = scenario.end_us() / 1000;
+        scenario.start();
+    }
+
+    if (uart_out) {
+        uart_file = fopen(uart_out, "wb");
+        if (!uart_file) {
+            perror(uart_out);
+            return 1;
+        }
+    }
+    if (uart_out || scenario_file)
+        host::uart_set_output(write_uart);
+    if (uart_in && !inject_file(uart_in)) {
+        perror(uart_in);
+        return 1;
+    }
+    if (eeprom)
+        host::eeprom_load(eeprom);
+    host::i2c_set_speed(scl_hz);
+
+    host::set_time_limit_us((uint64_t)ms * 1000);
+    int ret = 0;
+    bool stopped = false;
+    try {
+        ret = koryuu_firmware_main();
+    } catch (const host::Stop &) {
+        stopped = true;
+    }
+
+    if (eeprom && !host::eeprom_save(eeprom)) {
+        perror(eeprom);
+        ret = 1;
+    }
+    if (uart_file)
+        fclose(uart_file);
+
+    const host::Stats &s = host::stats;
+    fprintf(stderr,
+        "%s after %llu us: %u timer interrupts, %u LED timer interrupts, "
+        "%u INT0 interrupts, %u I2C transfers (%u bytes, %u NACKs), "
+        "UART %u bytes out, %u in, %u EEPROM writes, %u watchdog resets\n",
+        stopped ? "stopped" : "returned",
+        (unsigned long long)host::now_us(), s.timer_irqs, s.led_timer_irqs,
+        s.int0_irqs, s.i2c_transfers, s.i2c_bytes, s.i2c_nacks,
+        s.uart_tx_bytes, s.uart_rx_bytes, s.eeprom_writes,
+        s.watchdog_resets);
+    if (scenario_file && scenario.report(stdout))
+        ret = 1;
+    if (report) {
+        FILE *f = fopen(report, "w");
+        if (!f) {
+            perror(report);
+            return 1;
+        }
+        // The scenario's file name without directory and extension.
+        const char *base = strrchr(scenario_file, '/');
+        std::string name = base ? base + 1 : scenario_file;
+        name = name.substr(0, name.rfind('.'));
+        scenario.write_json(f, name.c_str(), scl_hz);
+        fclose(f);
+    }
+    return ret;
+}
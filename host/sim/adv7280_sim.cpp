@@ -0,0 +1,450 @@
+#include "sim/adv7280_sim.hh"
+
+namespace koryuu {
+    namespace sim {
+        namespace host = hal::host;
+
+        namespace {
+            // Pins of the decoder, see main.cpp.
+            constexpr char RESET_PORT = 'D';
+            constexpr uint8_t RESET_BIT = 6;
+            constexpr char PWRDWN_PORT = 'C';
+            constexpr uint8_t PWRDWN_BIT = 2;
+            constexpr char INTRQ_PORT = 'D';
+            constexpr uint8_t INTRQ_BIT = 2;
+
+            constexpr uint32_t UPDATE_US = 1000;
+
+            struct RegDefault {
+                DecMap map;
+                uint8_t reg;
+                uint8_t value;
+            };
+
+            constexpr RegDefault DEFAULTS[] = {
+                { DMAP_USER, 0x02, 0x04 },     // Autodetect PAL/NTSC-J/SECAM
+                { DMAP_USER, 0x03, 0x0c },     // Output control
+                { DMAP_USER, 0x04, 0x37 },     // Extended output control
+                { DMAP_USER, 0x11, 0x41 },     // IDENT
+                { DMAP_INTR_VDP, 0x40, 0x10 }, // Interrupt configuration
+            };
+
+            bool is_50hz(uint8_t vstd)
+            {
+                return vstd == STD_PAL_BGHID || vstd == STD_SECAM ||
+                    vstd == STD_PAL_COMB_N;
+            }
+
+            bool is_pal(uint8_t vstd)
+            {
+                return vstd == STD_PAL_M || vstd == STD_PAL_60 ||
+                    vstd == STD_PAL_BGHID || vstd == STD_PAL_COMB_N;
+            }
+
+            bool is_secam(uint8_t vstd)
+            {
+                return vstd == STD_SECAM || vstd == STD_SECAM_525;
+            }
+        }
+
+        bool Adv7280Sim::Port::write(const uint8_t *data, uint8_t n,
+                bool start)
+        {
+            // A lone register pointer is the first half of a read.
+            if (!chip.accessible(!start || n > 1))
+                return false;
+            if (start && n) {
+                ptr = *data++;
+                --n;
+            }
+            while (n--)
+                if (!chip.write_reg(vpp, ptr++, *data++))
+                    return false;
+            return true;
+        }
+
+        uint8_t Adv7280Sim::Port::read()
+        {
+            if (!chip.accessible(false))
+                return 0xff;
+            return chip.read_reg(vpp, ptr++);
+        }
+
+        Adv7280Sim::Adv7280Sim(uint8_t addr)
+            : lock_us(50000), reset_busy_us(5000), address(addr),
+              vpp_address(0), user_port(*this, false), vpp_port(*this, true),
+              settle_from(0), busy_until(0), nacks_pending(0),
+              nack_writes_only(false),
+              prev_locked(false), lost_lock(false), ad_result(STD_NTSC_MJ),
+              prev_status3(0), prev_raw3(0), prev_mv(0), last_field(0),
+              intrq_high(true), n_resets(0), n_nacks(0)
+        {
+            reset_registers();
+        }
+
+        void Adv7280Sim::attach()
+        {
+            host::i2c_attach(address, &user_port);
+            tick();
+        }
+
+        void Adv7280Sim::tick()
+        {
+            update();
+            host::schedule(host::now_us() + UPDATE_US, [this] { tick(); });
+        }
+
+        void Adv7280Sim::set_signal(const Signal &s)
+        {
+            update();
+            sig = s;
+            settle_from = host::now_us();
+            update();
+        }
+
+        void Adv7280Sim::reset_registers()
+        {
+            memset(regs, 0, sizeof(regs));
+            for (const RegDefault &d : DEFAULTS)
+                regs[d.map][d.reg] = d.value;
+            if (vpp_address)
+                host::i2c_attach(vpp_address, nullptr);
+            vpp_address = 0;
+            lost_lock = false;
+            settle_from = host::now_us();
+            // Comes up unlocked and running free, nothing latched.
+            prev_locked = false;
+            prev_mv = 0;
+            prev_status3 = 0x10 | (is_50hz(ad_result) ? 0x04 : 0x00);
+            prev_raw3 = is_50hz(ad_result) ? 0x01 : 0x00;
+        }
+
+        bool Adv7280Sim::powered() const
+        {
+            return host::output_level(RESET_PORT, RESET_BIT) &&
+                host::output_level(PWRDWN_PORT, PWRDWN_BIT);
+        }
+
+        bool Adv7280Sim::accessible(bool writing)
+        {
+            if (!powered() || host::now_us() < busy_until) {
+                ++n_nacks;
+                return false;
+            }
+            if (nacks_pending && (writing || !nack_writes_only)) {
+                --nacks_pending;
+                ++n_nacks;
+                return false;
+            }
+            return true;
+        }
+
+        DecMap Adv7280Sim::current_map() const
+        {
+            switch (regs[DMAP_USER][0x0e]) {
+            case 0x20:
+                return DMAP_INTR_VDP;
+            case 0x40:
+                return DMAP_USER2;
+            case 0x80:
+                return DMAP_0x80;
+            default:
+                return DMAP_USER;
+            }
+        }
+
+        bool Adv7280Sim::input_selected() const
+        {
+            const uint8_t insel = regs[DMAP_USER][0x00] & 0x1f;
+            switch (sig.input) {
+            case SIG_CVBS:
+                return insel == 0x00;
+            case SIG_SVIDEO:
+                return insel == 0x09;
+            case SIG_COMPONENT:
+                return insel == 0x0c;
+            }
+            return false;
+        }
+
+        // VID_SEL, user map 0x02 bits 7:4. PAL N is the data sheet's
+        // name for PAL B/G/H/I/D with pedestal, not Combination N.
+        bool Adv7280Sim::allows_standard(uint8_t vstd) const
+        {
+            switch (regs[DMAP_USER][0x02] >> 4) {
+            case 0x0:
+            case 0x1:
+            case 0x2:
+            case 0x3:
+                return vstd != STD_PAL_COMB_N;
+            case 0x4:
+            case 0x5:
+                return vstd == STD_NTSC_MJ;
+            case 0x6:
+                return vstd == STD_PAL_60;
+            case 0x7:
+                return vstd == STD_NTSC_443;
+            case 0x8:
+            case 0x9:
+                return vstd == STD_PAL_BGHID;
+            case 0xc:
+            case 0xd:
+                return vstd == STD_PAL_COMB_N;
+            case 0xa:
+            case 0xb:
+                return vstd == STD_PAL_M;
+            default:
+                return is_secam(vstd);
+            }
+        }
+
+        bool Adv7280Sim::locked()
+        {
+            return powered() && !(regs[DMAP_USER][0x0f] & 0x20) &&
+                sig.present && input_selected() &&
+                allows_standard(sig.vstd) &&
+                host::now_us() - settle_from >= lock_us;
+        }
+
+        uint8_t Adv7280Sim::status1()
+        {
+            const bool l = locked();
+            uint8_t s = ad_result << 4;
+            if (l)
+                s |= 0x01;
+            if (lost_lock)
+                s |= 0x02;
+            if (l && !sig.fsc_nonstandard && !is_secam(sig.vstd))
+                s |= 0x04;
+            if (l && !sig.color)
+                s |= 0x80;
+            return s;
+        }
+
+        uint8_t Adv7280Sim::status2() const
+        {
+            if (!prev_locked)
+                return 0x00;
+            uint8_t s = sig.macrovision & 0x0f;
+            if (sig.ll_nonstandard)
+                s |= 0x10;
+            if (sig.fsc_nonstandard)
+                s |= 0x20;
+            return s;
+        }
+
+        uint8_t Adv7280Sim::status3()
+        {
+            const bool l = locked();
+            uint8_t s = 0x00;
+            if (l)
+                s |= 0x01;
+            if (is_50hz(ad_result))
+                s |= 0x04;
+            if (!l)
+                s |= 0x10;
+            if (l && !sig.ll_nonstandard)
+                s |= 0x20;
+            if (l && sig.interlaced)
+                s |= 0x40;
+            if (l && is_pal(sig.vstd))
+                s |= 0x80;
+            return s;
+        }
+
+        uint8_t Adv7280Sim::raw_status3()
+        {
+            const bool l = locked();
+            uint8_t s = is_50hz(ad_result) ? 0x01 : 0x00;
+            if (l)
+                s |= 0x06;
+            if (l && is_secam(sig.vstd))
+                s |= 0x10;
+            return s;
+        }
+
+        void Adv7280Sim::update()
+        {
+            const uint64_t now = host::now_us();
+            uint8_t *const intr = regs[DMAP_INTR_VDP];
+
+            if (!host::output_level(RESET_PORT, RESET_BIT))
+                reset_registers();
+
+            const bool l = locked();
+            const uint8_t prev_ad = ad_result;
+            if (l)
+                ad_result = sig.vstd & 0x07;
+
+            // Interrupt status 1
+            if (l && !prev_locked)
+                intr[0x42] |= 0x01;
+            if (!l && prev_locked) {
+                intr[0x42] |= 0x02;
+                lost_lock = true;
+            }
+            const uint8_t s3 = status3();
+            if ((s3 ^ prev_status3) & 0x10)
+                intr[0x42] |= 0x20;
+            const uint8_t mv = l ? sig.macrovision : 0;
+            if (mv != prev_mv)
+                intr[0x42] |= 0x40;
+
+            // Interrupt status 2: field changes, activity on the selected
+            // input (CHX min/max), manual interrupt.
+            if (l && sig.interlaced) {
+                const uint64_t field_us = is_50hz(sig.vstd) ? 20000 : 16683;
+                const uint64_t field = (now - settle_from) / field_us;
+                if (field != last_field)
+                    intr[0x46] |= 0x10;
+                last_field = field;
+            }
+            if (sig.present && powered() && !(regs[DMAP_USER][0x0f] & 0x20) &&
+                    input_selected())
+                intr[0x46] |= 0x20;
+            if (intr[0x40] & 0x04)
+                intr[0x46] |= 0x80;
+
+            // Interrupt status 3
+            const uint8_t raw3 = raw_status3();
+            intr[0x4a] |= (raw3 ^ prev_raw3) & 0x17;
+            if (ad_result != prev_ad)
+                intr[0x4a] |= 0x08;
+            if ((s3 ^ prev_status3) & 0x80)
+                intr[0x4a] |= 0x20;
+
+            prev_locked = l;
+            prev_status3 = s3;
+            prev_raw3 = raw3;
+            prev_mv = mv;
+
+            // INTRQ: only "active until cleared" is long enough for the
+            // firmware to see, the pulse modes last a few XTAL cycles.
+            const bool active = ((intr[0x42] & intr[0x44]) |
+                (intr[0x46] & intr[0x48]) | (intr[0x4a] & intr[0x4c])) &&
+                (intr[0x40] & 0xc0) == 0xc0 && powered();
+            switch (intr[0x40] & 0x03) {
+            case 0x02: // Active high
+                intrq_high = active;
+                break;
+            default:   // Active low or open drain with a pull-up
+                intrq_high = !active;
+                break;
+            }
+            host::set_input(INTRQ_PORT, INTRQ_BIT, intrq_high);
+        }
+
+        bool Adv7280Sim::write_reg(bool vpp, uint8_t reg, uint8_t v)
+        {
+            if (vpp) {
+                regs[DMAP_VPP][reg] = v;
+                return true;
+            }
+            update();
+            uint8_t *const user = regs[DMAP_USER];
+            if (reg == 0x0e) {
+                user[0x0e] = v;
+                return true;
+            }
+            const DecMap map = current_map();
+            if (map == DMAP_USER) {
+                switch (reg) {
+                case 0x00:
+                case 0x02:
+                    if (user[reg] != v)
+                        settle_from = host::now_us();
+                    break;
+                case 0x0f:
+                    if (v & 0x80) {
+                        // The reset cuts the transfer short.
+                        reset_registers();
+                        busy_until = host::now_us() + reset_busy_us;
+                        ++n_resets;
+                        return false;
+                    }
+                    // Leaving power down starts the lock over.
+                    if ((user[0x0f] & 0x20) && !(v & 0x20))
+                        settle_from = host::now_us();
+                    break;
+                case 0x10:
+                case 0x11:
+                case 0x12:
+                case 0x13:
+                    return true;
+                case 0xfd:
+                    if (vpp_address)
+                        host::i2c_attach(vpp_address, nullptr);
+                    vpp_address = v >> 1;
+                    if (vpp_address)
+                        host::i2c_attach(vpp_address, &vpp_port);
+                    break;
+                }
+            } else if (map == DMAP_INTR_VDP) {
+                switch (reg) {
+                case 0x43:
+                case 0x47:
+                case 0x4b:
+                    // Clear registers: write 1 to clear the status bits
+                    // one register below, they read back as 0.
+                    regs[map][reg - 1] &= ~v;
+                    update();
+                    return true;
+                case 0x42:
+                case 0x45:
+                case 0x46:
+                case 0x49:
+                case 0x4a:
+                    return true;
+                }
+            }
+            regs[map][reg] = v;
+            if (map == DMAP_INTR_VDP)
+                update();
+            return true;
+        }
+
+        uint8_t Adv7280Sim::read_reg(bool vpp, uint8_t reg)
+        {
+            if (vpp)
+                return regs[DMAP_VPP][reg];
+            update();
+            if (reg == 0x0e)
+                return regs[DMAP_USER][0x0e];
+            const DecMap map = current_map();
+            if (map == DMAP_USER && reg == 0x10) {
+                const uint8_t s = status1();
+                lost_lock = false;
+                return s;
+            }
+            return peek(map, reg);
+        }
+
+        uint8_t Adv7280Sim::peek(DecMap map, uint8_t reg)
+        {
+            update();
+            if (map == DMAP_USER) {
+                switch (reg) {
+                case 0x10:
+                    return status1();
+                case 0x12:
+                    return status2();
+                case 0x13:
+                    return status3();
+                }
+            } else if (map == DMAP_INTR_VDP) {
+                switch (reg) {
+                case 0x43:
+                case 0x47:
+                case 0x4b:
+                    return 0x00;
+                case 0x45:
+                    return prev_locked && sig.interlaced && (last_field & 1) ?
+                        0x10 : 0x00;
+                case 0x49:
+                    return raw_status3();
+                }
+            }
+            return regs[map][reg];
+        }
+    }
+}
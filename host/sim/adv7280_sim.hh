@@ -0,0 +1,157 @@
+#ifndef KORYUU_SIM_ADV7280_SIM_HH
+#define KORYUU_SIM_ADV7280_SIM_HH
+#include "hal.hh"
+
+// Behavioral model of the ADV7280A for the host build: register maps
+// with the 0x0e submap switch and the VPP map, status registers 0x10,
+// 0x12 and 0x13 derived from a simulated input signal, latched
+// interrupts with clear and mask registers driving the INTRQ pin,
+// software reset and power down, and injected NACKs.
+//
+// Only what the firmware relies on is modeled. Registers without
+// behavior just store the value written; power-on values are 0x00
+// except for the few in adv7280_sim.cpp.
+namespace koryuu {
+    namespace sim {
+        enum SimInput : uint8_t {
+            SIG_CVBS,      // Ain1
+            SIG_SVIDEO,    // Ain3/Ain4
+            SIG_COMPONENT, // Ain1/Ain2/Ain3
+        };
+
+        // AD_RESULT codes of status 1, as video_standards::VideoStandard.
+        // The firmware headers are not included here, they belong to the
+        // translation unit of main.cpp.
+        enum SimStandard : uint8_t {
+            STD_NTSC_MJ    = 0x00,
+            STD_NTSC_443   = 0x01,
+            STD_PAL_M      = 0x02,
+            STD_PAL_60     = 0x03,
+            STD_PAL_BGHID  = 0x04,
+            STD_SECAM      = 0x05,
+            STD_PAL_COMB_N = 0x06,
+            STD_SECAM_525  = 0x07,
+        };
+
+        // The source connected to the converter.
+        struct Signal {
+            bool present;
+            SimInput input;
+            uint8_t vstd;         // SimStandard
+            bool interlaced;
+            bool color;           // false: the decoder kills the color
+            bool fsc_nonstandard; // e.g. a VCR's unstable subcarrier
+            bool ll_nonstandard;  // Nonstandard line length
+            uint8_t macrovision;  // Status 2 bits 3:0
+
+            Signal()
+                : present(false), input(SIG_CVBS), vstd(0), interlaced(true),
+                  color(true), fsc_nonstandard(false), ll_nonstandard(false),
+                  macrovision(0)
+            {}
+        };
+
+        enum DecMap : uint8_t {
+            DMAP_USER,
+            DMAP_INTR_VDP,
+            DMAP_USER2,
+            DMAP_0x80,
+            DMAP_VPP,
+            NUM_DMAPS,
+        };
+
+        class Adv7280Sim {
+        public:
+            // Time from a signal, input or standard change to lock.
+            uint32_t lock_us;
+            // The chip does not answer this long after a software reset.
+            uint32_t reset_busy_us;
+
+            Adv7280Sim(uint8_t addr = 0x20);
+
+            // Attaches to the bus and starts following the clock.
+            void attach();
+
+            void set_signal(const Signal &s);
+            const Signal &signal() const { return sig; }
+            // NACKs the next n transfers to the user or VPP map, or only
+            // the next n that write a register.
+            void inject_nacks(uint32_t n, bool writes_only = false) {
+                nacks_pending = n;
+                nack_writes_only = writes_only;
+            }
+
+            // The registers go back to their power-on values without a
+            // transfer, as a brownout or an ESD hit would do it.
+            void glitch() {
+                update();
+                reset_registers();
+            }
+
+            // Register value as the firmware would read it, without the
+            // side effects of a read (e.g. status 1 LOST_LOCK).
+            uint8_t peek(DecMap map, uint8_t reg);
+            bool locked();
+            // Level of the INTRQ pin, true if high.
+            bool intrq_level() const { return intrq_high; }
+
+            uint32_t resets() const { return n_resets; }
+            uint32_t nacks() const { return n_nacks; }
+
+        private:
+            class Port : public hal::host::I2cDevice {
+                Adv7280Sim &chip;
+                bool vpp;
+                uint8_t ptr;
+            public:
+                Port(Adv7280Sim &c, bool is_vpp)
+                    : chip(c), vpp(is_vpp), ptr(0) {}
+                bool write(const uint8_t *data, uint8_t n,
+                    bool start) override;
+                uint8_t read() override;
+            };
+
+            const uint8_t address;
+            uint8_t vpp_address; // 7-bit, 0 while the VPP map is off
+            Port user_port;
+            Port vpp_port;
+            uint8_t regs[NUM_DMAPS][256];
+            Signal sig;
+            // Time the lock timer was last restarted.
+            uint64_t settle_from;
+            uint64_t busy_until;
+            uint32_t nacks_pending;
+            bool nack_writes_only;
+
+            bool prev_locked;
+            bool lost_lock;       // Status 1 bit 1, cleared by reading
+            uint8_t ad_result;    // Held while not locked
+            uint8_t prev_status3;
+            uint8_t prev_raw3;
+            uint8_t prev_mv;
+            uint64_t last_field;
+            bool intrq_high;
+            uint32_t n_resets;
+            uint32_t n_nacks;
+
+            DecMap current_map() const;
+            bool accessible(bool writing);
+            bool powered() const;
+            bool allows_standard(uint8_t vstd) const;
+            bool input_selected() const;
+            uint8_t status1();
+            uint8_t status2() const;
+            uint8_t status3();
+            uint8_t raw_status3();
+            void reset_registers();
+            // Returns false to NACK.
+            bool write_reg(bool vpp, uint8_t reg, uint8_t v);
+            uint8_t read_reg(bool vpp, uint8_t reg);
+            // Latches the interrupts of what changed since the last call
+            // and drives INTRQ.
+            void update();
+            void tick();
+        };
+    }
+}
+#endif // KORYUU_SIM_ADV7280_SIM_HH
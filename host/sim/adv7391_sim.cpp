@@ -0,0 +1,69 @@
+#include "sim/adv7391_sim.hh"
+
+namespace koryuu {
+    namespace sim {
+        namespace host = hal::host;
+
+        namespace {
+            // /RESET of the encoder, see main.cpp.
+            constexpr char RESET_PORT = 'D';
+            constexpr uint8_t RESET_BIT = 7;
+        }
+
+        Adv7391Sim::Adv7391Sim(uint8_t addr)
+            : address(addr), ptr(0), nacks_pending(0), nack_writes_only(false),
+              n_resets(0),
+              n_nacks(0)
+        {
+            memset(regs, 0, sizeof(regs));
+        }
+
+        void Adv7391Sim::attach()
+        {
+            host::i2c_attach(address, this);
+        }
+
+        bool Adv7391Sim::accessible(bool writing)
+        {
+            if (!host::output_level(RESET_PORT, RESET_BIT)) {
+                memset(regs, 0, sizeof(regs));
+                ++n_nacks;
+                return false;
+            }
+            if (nacks_pending && (writing || !nack_writes_only)) {
+                --nacks_pending;
+                ++n_nacks;
+                return false;
+            }
+            return true;
+        }
+
+        bool Adv7391Sim::write(const uint8_t *data, uint8_t n, bool start)
+        {
+            // A lone register pointer is the first half of a read.
+            if (!accessible(!start || n > 1))
+                return false;
+            if (start && n) {
+                ptr = *data++;
+                --n;
+            }
+            for (; n; --n, ++ptr, ++data) {
+                if (ptr == 0x17 && (*data & 0x02)) {
+                    // Software reset, the bit clears itself.
+                    memset(regs, 0, sizeof(regs));
+                    ++n_resets;
+                    continue;
+                }
+                regs[ptr] = *data;
+            }
+            return true;
+        }
+
+        uint8_t Adv7391Sim::read()
+        {
+            if (!accessible(false))
+                return 0xff;
+            return regs[ptr++];
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef KORYUU_SIM_ADV7391_SIM_HH
+#define KORYUU_SIM_ADV7391_SIM_HH
+#include "hal.hh"
+
+// Behavioral model of the ADV7391 for the host build: a register file
+// with software reset (0x17 bit 1), the /RESET pin and injected NACKs.
+// Power-on values are 0x00.
+namespace koryuu {
+    namespace sim {
+        class Adv7391Sim : public hal::host::I2cDevice {
+            const uint8_t address;
+            uint8_t ptr;
+            uint32_t nacks_pending;
+            bool nack_writes_only;
+            uint32_t n_resets;
+            uint32_t n_nacks;
+
+            bool accessible(bool writing);
+
+        public:
+            uint8_t regs[256];
+
+            Adv7391Sim(uint8_t addr = 0x2a);
+
+            void attach();
+            // NACKs the next n transfers, or only the next n that write a
+            // register.
+            void inject_nacks(uint32_t n, bool writes_only = false) {
+                nacks_pending = n;
+                nack_writes_only = writes_only;
+            }
+
+            // The registers go back to their power-on values without a
+            // transfer, as a brownout or an ESD hit would do it.
+            void glitch() {
+                memset(regs, 0, sizeof(regs));
+            }
+
+            bool write(const uint8_t *data, uint8_t n, bool start) override;
+            uint8_t read() override;
+
+            uint32_t resets() const { return n_resets; }
+            uint32_t nacks() const { return n_nacks; }
+        };
+    }
+}
+#endif // KORYUU_SIM_ADV7391_SIM_HH
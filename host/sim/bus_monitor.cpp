@@ -0,0 +1,142 @@
+#include "sim/bus_monitor.hh"
+
+namespace koryuu {
+    namespace sim {
+        namespace host = hal::host;
+
+        namespace {
+            constexpr uint8_t NO_SUBMAP = 0xff;
+
+            enum Chip : uint8_t { DECODER, VPP, ENCODER, OTHER };
+
+            struct Strobe {
+                Chip chip;
+                uint8_t submap;
+                uint8_t reg;
+            };
+
+            // Registers where writing the same value again is an action,
+            // not a redundant write: software resets, the decoder's
+            // interrupt clear registers and the deinterlacer reset.
+            constexpr Strobe STROBES[] = {
+                { DECODER, 0x00, 0x0f },
+                { DECODER, 0x20, 0x43 },
+                { DECODER, 0x20, 0x47 },
+                { DECODER, 0x20, 0x4b },
+                { VPP, NO_SUBMAP, 0x41 },
+                { ENCODER, NO_SUBMAP, 0x17 },
+            };
+
+            uint32_t key(uint8_t addr, uint8_t submap, uint8_t reg)
+            {
+                return (uint32_t)addr << 16 | (uint32_t)submap << 8 | reg;
+            }
+        }
+
+        BusCounters BusCounters::operator-(const BusCounters &o) const
+        {
+            return { transactions - o.transactions, writes - o.writes,
+                reads - o.reads, bytes - o.bytes, switches - o.switches,
+                redundant - o.redundant, nacks - o.nacks,
+                bus_us - o.bus_us };
+        }
+
+        BusMonitor::BusMonitor(uint8_t decoder_addr, uint8_t vpp_addr,
+                uint8_t encoder_addr)
+            : decoder(decoder_addr), vpp(vpp_addr), encoder(encoder_addr),
+              total(),
+              open(false), submap(0x00)
+        {}
+
+        void BusMonitor::attach()
+        {
+            host::i2c_monitor([this](const host::I2cEvent &e) {
+                on_transfer(e);
+            });
+        }
+
+        void BusMonitor::forget(uint8_t addr)
+        {
+            for (auto i = written.begin(); i != written.end(); )
+                if (i->first >> 16 == addr)
+                    i = written.erase(i);
+                else
+                    ++i;
+        }
+
+        void BusMonitor::on_write(uint8_t addr, uint8_t reg, uint8_t v,
+                bool ack)
+        {
+            ++total.writes;
+            const bool is_decoder = addr == decoder;
+            const uint8_t map = is_decoder ? submap : NO_SUBMAP;
+
+            if (is_decoder && reg == 0x0e) {
+                // One register in every submap.
+                ++total.switches;
+                if (v == submap)
+                    ++total.redundant;
+                if (ack)
+                    submap = v;
+                return;
+            }
+
+            const Chip chip = is_decoder ? DECODER : addr == vpp ? VPP :
+                addr == encoder ? ENCODER : OTHER;
+            bool strobe = false;
+            for (const Strobe &s : STROBES)
+                if (s.chip == chip && s.submap == map && s.reg == reg)
+                    strobe = true;
+
+            const auto last = written.find(key(addr, map, reg));
+            if (!strobe && last != written.end() && last->second == v)
+                ++total.redundant;
+
+            // The decoder NACKs its own reset, which forgets the VPP
+            // map too.
+            if (is_decoder && reg == 0x0f && (v & 0x80)) {
+                for (auto i = written.begin(); i != written.end(); )
+                    if (i->first >> 16 != encoder)
+                        i = written.erase(i);
+                    else
+                        ++i;
+                submap = 0x00;
+                return;
+            }
+            if (addr == encoder && reg == 0x17 && (v & 0x02)) {
+                forget(encoder);
+                return;
+            }
+            if (!ack)
+                return;
+            if (!strobe)
+                written[key(addr, map, reg)] = v;
+        }
+
+        void BusMonitor::on_transfer(const host::I2cEvent &e)
+        {
+            if (!open)
+                ++total.transactions;
+            open = !e.stop;
+            total.bytes += e.n;
+            total.bus_us += e.bus_us;
+            if (!e.ack)
+                ++total.nacks;
+
+            uint8_t &p = ptr[e.addr];
+            if (e.read) {
+                total.reads += e.n;
+                p += e.n;
+                return;
+            }
+            const uint8_t *data = e.data;
+            uint8_t n = e.n;
+            if (e.start && n) {
+                p = *data++;
+                --n;
+            }
+            for (; n; --n, ++p)
+                on_write(e.addr, p, *data++, e.ack);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef KORYUU_SIM_BUS_MONITOR_HH
+#define KORYUU_SIM_BUS_MONITOR_HH
+#include "hal.hh"
+
+#include <map>
+
+// Counts the I2C traffic of the firmware for the benchmarks: transactions,
+// register writes and reads, bytes and bus time, decoder submap switches
+// and redundant writes, i.e. writes of the value a register already got
+// from the last write. A software reset of a chip forgets what was written
+// to it.
+namespace koryuu {
+    namespace sim {
+        struct BusCounters {
+            uint32_t transactions; // START to STOP, repeated starts included
+            uint32_t writes;       // Register writes
+            uint32_t reads;        // Register reads
+            uint32_t bytes;        // Without the address bytes
+            uint32_t switches;     // Writes to the decoder's 0x0e
+            uint32_t redundant;
+            uint32_t nacks;
+            uint64_t bus_us;
+
+            BusCounters operator-(const BusCounters &o) const;
+        };
+
+        class BusMonitor {
+        public:
+            BusMonitor(uint8_t decoder_addr, uint8_t vpp_addr,
+                uint8_t encoder_addr);
+
+            // Installs the monitor on the host bus.
+            void attach();
+            const BusCounters &counters() const { return total; }
+
+        private:
+            const uint8_t decoder;
+            const uint8_t vpp;
+            const uint8_t encoder;
+            BusCounters total;
+            bool open;              // Between START and STOP
+            uint8_t submap;         // Decoder 0x0e
+            std::map<uint8_t, uint8_t> ptr;
+            // Last value written, by address, submap and register.
+            std::map<uint32_t, uint8_t> written;
+
+            void on_transfer(const hal::host::I2cEvent &e);
+            void on_write(uint8_t addr, uint8_t reg, uint8_t v, bool ack);
+            void forget(uint8_t addr);
+        };
+    }
+}
+#endif // KORYUU_SIM_BUS_MONITOR_HH
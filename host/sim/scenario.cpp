@@ -0,0 +1,679 @@
+#include "sim/scenario.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+namespace koryuu {
+    namespace sim {
+        namespace host = hal::host;
+
+        namespace {
+            constexpr uint32_t POLL_US = 1000;
+
+            // Addresses of the decoder, its VPP map and the encoder, see
+            // main.cpp.
+            constexpr uint8_t DECODER_ADDR = 0x20;
+            constexpr uint8_t VPP_ADDR = 0x42;
+            constexpr uint8_t ENCODER_ADDR = 0x2a;
+
+            // Control protocol, see koryuu_proto.hh.
+            constexpr uint8_t PROTO_REQUEST = 'C';
+            constexpr uint8_t PROTO_RESPONSE = 'R';
+            constexpr uint8_t CMD_GET_VAR = 0x03;
+            constexpr uint8_t PS_OK = 0;
+            // How long a state variable request may go unanswered.
+            constexpr uint32_t REPLY_US = 100000;
+
+            enum CounterKey : uint8_t {
+                KEY_TRANSACTIONS,
+                KEY_WRITES,
+                KEY_READS,
+                KEY_BYTES,
+                KEY_SWITCHES,
+                KEY_REDUNDANT,
+                KEY_NACKS,
+                KEY_BUS_US,
+                NUM_KEYS,
+            };
+
+            constexpr const char *KEYS[NUM_KEYS] = {
+                "transactions", "writes", "reads", "bytes", "switches",
+                "redundant", "nacks", "bus_us",
+            };
+
+            uint64_t counter(const BusCounters &c, uint8_t key)
+            {
+                switch (key) {
+                case KEY_TRANSACTIONS:
+                    return c.transactions;
+                case KEY_WRITES:
+                    return c.writes;
+                case KEY_READS:
+                    return c.reads;
+                case KEY_BYTES:
+                    return c.bytes;
+                case KEY_SWITCHES:
+                    return c.switches;
+                case KEY_REDUNDANT:
+                    return c.redundant;
+                case KEY_NACKS:
+                    return c.nacks;
+                case KEY_BUS_US:
+                    return c.bus_us;
+                }
+                return 0;
+            }
+
+            struct Name {
+                const char *name;
+                uint8_t value;
+            };
+
+            constexpr Name INPUTS[] = {
+                { "cvbs", SIG_CVBS },
+                { "svideo", SIG_SVIDEO },
+                { "component", SIG_COMPONENT },
+            };
+
+            constexpr Name STANDARDS[] = {
+                { "ntsc", STD_NTSC_MJ },
+                { "ntsc443", STD_NTSC_443 },
+                { "palm", STD_PAL_M },
+                { "pal60", STD_PAL_60 },
+                { "pal", STD_PAL_BGHID },
+                { "secam", STD_SECAM },
+                { "paln", STD_PAL_COMB_N },
+                { "secam525", STD_SECAM_525 },
+            };
+
+            constexpr Name MAPS[] = {
+                { "user", DMAP_USER },
+                { "user2", DMAP_USER2 },
+                { "intr", DMAP_INTR_VDP },
+                { "map80", DMAP_0x80 },
+                { "vpp", DMAP_VPP },
+            };
+
+            struct Pin {
+                const char *name;
+                char port;
+                uint8_t bit;
+            };
+
+            // See main.cpp.
+            constexpr Pin PINS[] = {
+                { "intrq", 'D', 2 },
+                { "led_cvbs", 'B', 1 },
+                { "led_yc", 'B', 2 },
+                { "led_opt", 'B', 6 },
+                { "dec_reset", 'D', 6 },
+                { "dec_pwrdwn", 'C', 2 },
+                { "enc_reset", 'D', 7 },
+                { "button_input", 'D', 5 },
+                { "button_option", 'B', 7 },
+            };
+
+            template<size_t N>
+            bool lookup(const Name (&names)[N], const std::string &s,
+                    uint8_t &v)
+            {
+                for (const Name &n : names)
+                    if (s == n.name) {
+                        v = n.value;
+                        return true;
+                    }
+                return false;
+            }
+
+            bool number(const std::string &s, uint32_t &v)
+            {
+                char *end;
+                v = strtoul(s.c_str(), &end, 0);
+                return !s.empty() && !*end;
+            }
+
+            bool pin_level(char port, uint8_t bit)
+            {
+                const host::PortState &s = host::ports[port - 'B'];
+                const uint8_t mask = 1u << bit;
+                return (s.ddr & mask ? s.port : s.pin) & mask;
+            }
+
+            // The zlib CRC32 of crc32.hh.
+            uint32_t crc32(const uint8_t *data, size_t n)
+            {
+                uint32_t crc = 0xffffffffu;
+                while (n--) {
+                    crc ^= *data++;
+                    for (uint8_t j = 0; j < 8; ++j)
+                        crc = crc >> 1 ^ (crc & 1 ? 0xedb88320u : 0);
+                }
+                return ~crc;
+            }
+
+            std::string hex(uint32_t v)
+            {
+                char buf[16];
+                snprintf(buf, sizeof(buf), "0x%02x", (unsigned)v);
+                return buf;
+            }
+        }
+
+        Scenario *Scenario::active = nullptr;
+
+        Scenario::Scenario(Adv7280Sim &dec, Adv7391Sim &enc)
+            : decoder(dec), encoder(enc), end_ms(3000),
+              monitor(DECODER_ADDR, VPP_ADDR, ENCODER_ADDR), rx_len(0),
+              var_value(), var_replies()
+        {}
+
+        bool Scenario::find_measure(const std::string &name,
+                size_t &idx) const
+        {
+            for (idx = 0; idx < measures.size(); ++idx)
+                if (measures[idx].name == name)
+                    return true;
+            return false;
+        }
+
+        bool Scenario::parse_cond(const std::vector<std::string> &w,
+                size_t i, Cond &c, std::string &err) const
+        {
+            c.map = DMAP_USER;
+            c.reg = 0;
+            c.mask = 0xff;
+            c.port = 0;
+            c.bit = 0;
+            uint32_t v;
+
+            if (i >= w.size()) {
+                err = "condition expected";
+                return false;
+            }
+            const std::string target = w[i++];
+            const std::string item = i < w.size() ? w[i++] : "";
+            const bool is_decoder = target.compare(0, 7, "decoder") == 0;
+
+            if (target == "pin") {
+                c.kind = Cond::PIN;
+                bool found = false;
+                for (const Pin &p : PINS)
+                    if (item == p.name) {
+                        c.port = p.port;
+                        c.bit = p.bit;
+                        found = true;
+                    }
+                if (!found) {
+                    err = "unknown pin '" + item + "'";
+                    return false;
+                }
+            } else if (target == "watchdog" && item == "resets") {
+                c.kind = Cond::WATCHDOG_RESETS;
+            } else if (target == "led" && item == "timer") {
+                c.kind = Cond::LED_TIMER;
+            } else if (target == "var") {
+                c.kind = Cond::STATE_VAR;
+                if (!number(item, v) || v > 0xff) {
+                    err = "state variable expected, got '" + item + "'";
+                    return false;
+                }
+                c.reg = v;
+            } else if ((is_decoder || target == "encoder") &&
+                    (item == "resets" || item == "nacks")) {
+                c.kind = is_decoder ?
+                    (item == "resets" ? Cond::DECODER_RESETS :
+                        Cond::DECODER_NACKS) :
+                    (item == "resets" ? Cond::ENCODER_RESETS :
+                        Cond::ENCODER_NACKS);
+            } else if (is_decoder || target == "encoder") {
+                c.kind = is_decoder ? Cond::DECODER_REG : Cond::ENCODER_REG;
+                if (is_decoder && target.size() > 7) {
+                    uint8_t m;
+                    if (target[7] != '.' ||
+                            !lookup(MAPS, target.substr(8), m)) {
+                        err = "unknown register map '" + target + "'";
+                        return false;
+                    }
+                    c.map = (DecMap)m;
+                }
+                if (!number(item, v) || v > 0xff) {
+                    err = "register expected, got '" + item + "'";
+                    return false;
+                }
+                c.reg = v;
+                if (i + 1 < w.size() && w[i] == "&") {
+                    if (!number(w[i + 1], v) || v > 0xff) {
+                        err = "mask expected, got '" + w[i + 1] + "'";
+                        return false;
+                    }
+                    c.mask = v;
+                    i += 2;
+                }
+            } else {
+                err = "unknown target '" + target + "'";
+                return false;
+            }
+
+            static const char *const OPS[] = { "==", "!=", ">=", "<=" };
+            if (i + 2 != w.size() || !number(w[i + 1], c.value)) {
+                err = "expected 'OP VALUE'";
+                return false;
+            }
+            for (uint8_t op = 0; op < 4; ++op)
+                if (w[i] == OPS[op]) {
+                    c.op = (Cond::Op)op;
+                    return true;
+                }
+            err = "unknown operator '" + w[i] + "'";
+            return false;
+        }
+
+        bool Scenario::parse_action(const std::vector<std::string> &w,
+                uint64_t at_us, std::string &err)
+        {
+            const std::string &what = w[2];
+            uint32_t v;
+
+            if (what == "signal") {
+                Signal s;
+                if (w.size() == 4 && w[3] == "none") {
+                    events.push_back({ at_us, [this, s] {
+                        decoder.set_signal(s);
+                    } });
+                    return true;
+                }
+                uint8_t in, std;
+                if (w.size() < 5 || !lookup(INPUTS, w[3], in) ||
+                        !lookup(STANDARDS, w[4], std)) {
+                    err = "expected 'signal none' or 'signal INPUT STD'";
+                    return false;
+                }
+                s.present = true;
+                s.input = (SimInput)in;
+                s.vstd = std;
+                for (size_t i = 5; i < w.size(); ++i) {
+                    if (w[i] == "progressive") {
+                        s.interlaced = false;
+                    } else if (w[i] == "nocolor") {
+                        s.color = false;
+                    } else if (w[i] == "fsc_nonstd") {
+                        s.fsc_nonstandard = true;
+                    } else if (w[i] == "ll_nonstd") {
+                        s.ll_nonstandard = true;
+                    } else if (w[i].compare(0, 3, "mv=") == 0 &&
+                            number(w[i].substr(3), v) && v <= 0x0f) {
+                        s.macrovision = v;
+                    } else {
+                        err = "unknown signal flag '" + w[i] + "'";
+                        return false;
+                    }
+                }
+                events.push_back({ at_us, [this, s] {
+                    decoder.set_signal(s);
+                } });
+            } else if (what == "press") {
+                const bool input = w.size() == 5 && w[3] == "input";
+                if (w.size() != 5 || (!input && w[3] != "option") ||
+                        !number(w[4], v)) {
+                    err = "expected 'press input|option MS'";
+                    return false;
+                }
+                const char port = input ? 'D' : 'B';
+                const uint8_t bit = input ? 5 : 7;
+                events.push_back({ at_us, [port, bit] {
+                    host::set_input(port, bit, false);
+                } });
+                events.push_back({ at_us + v * 1000ull, [port, bit] {
+                    host::set_input(port, bit, true);
+                } });
+            } else if (what == "nack") {
+                const bool writes = w.size() == 6 && w[5] == "writes";
+                if ((w.size() != 5 && !writes) || (w[3] != "decoder" &&
+                        w[3] != "encoder") || !number(w[4], v)) {
+                    err = "expected 'nack decoder|encoder N [writes]'";
+                    return false;
+                }
+                if (w[3] == "decoder")
+                    events.push_back({ at_us, [this, v, writes] {
+                        decoder.inject_nacks(v, writes);
+                    } });
+                else
+                    events.push_back({ at_us, [this, v, writes] {
+                        encoder.inject_nacks(v, writes);
+                    } });
+            } else if (what == "glitch") {
+                if (w.size() != 4 || (w[3] != "decoder" &&
+                        w[3] != "encoder")) {
+                    err = "expected 'glitch decoder|encoder'";
+                    return false;
+                }
+                if (w[3] == "decoder")
+                    events.push_back({ at_us, [this] { decoder.glitch(); } });
+                else
+                    events.push_back({ at_us, [this] { encoder.glitch(); } });
+            } else {
+                err = "unknown action '" + what + "'";
+                return false;
+            }
+            return true;
+        }
+
+        bool Scenario::load(const char *path)
+        {
+            std::ifstream in(path);
+            if (!in) {
+                fprintf(stderr, "%s: cannot open\n", path);
+                return false;
+            }
+
+            bool ok = true;
+            std::string text;
+            for (unsigned line = 1; std::getline(in, text); ++line) {
+                const size_t hash = text.find('#');
+                if (hash != std::string::npos)
+                    text.erase(hash);
+                std::istringstream ss(text);
+                std::vector<std::string> w;
+                for (std::string s; ss >> s; )
+                    w.push_back(s);
+                if (w.empty())
+                    continue;
+
+                std::string err;
+                uint32_t a = 0, b = 0;
+                if (w[0] == "lock" && w.size() == 2 && number(w[1], a)) {
+                    decoder.lock_us = a * 1000;
+                } else if (w[0] == "end" && w.size() == 2 &&
+                        number(w[1], a)) {
+                    end_ms = a;
+                } else if (w[0] == "at" && w.size() >= 3 &&
+                        number(w[1], a)) {
+                    if (w[2] == "expect") {
+                        Assertion as = { line, "", {}, a * 1000ull,
+                            a * 1000ull, false, false, "", false, 0 };
+                        if (parse_cond(w, 3, as.cond, err))
+                            assertions.push_back(as);
+                    } else {
+                        parse_action(w, a * 1000ull, err);
+                    }
+                } else if (w[0] == "measure" && w.size() == 4 &&
+                        number(w[2], a) && number(w[3], b)) {
+                    size_t idx;
+                    if (find_measure(w[1], idx))
+                        err = "measurement '" + w[1] + "' exists";
+                    else
+                        measures.push_back({ w[1], a * 1000ull,
+                            (a + b) * 1000ull, {}, {}, false });
+                } else if (w[0] == "budget" && w.size() == 4 &&
+                        number(w[3], a)) {
+                    Budget bu = { line, 0, NUM_KEYS, a };
+                    for (uint8_t k = 0; k < NUM_KEYS; ++k)
+                        if (w[2] == KEYS[k])
+                            bu.key = k;
+                    if (!find_measure(w[1], bu.measure))
+                        err = "unknown measurement '" + w[1] + "'";
+                    else if (bu.key == NUM_KEYS)
+                        err = "unknown counter '" + w[2] + "'";
+                    else
+                        budgets.push_back(bu);
+                } else if (w[0] == "within" && w.size() >= 4 &&
+                        number(w[1], a) && number(w[2], b)) {
+                    Assertion as = { line, "", {}, a * 1000ull,
+                        (a + b) * 1000ull, false, false, "", false, 0 };
+                    if (parse_cond(w, 3, as.cond, err))
+                        assertions.push_back(as);
+                } else {
+                    err = "syntax error";
+                }
+
+                if (!err.empty()) {
+                    fprintf(stderr, "%s:%u: %s\n", path, line, err.c_str());
+                    ok = false;
+                } else if (!assertions.empty() &&
+                        assertions.back().line == line) {
+                    // Normalized text for the report.
+                    std::string t;
+                    for (const std::string &s : w)
+                        t += (t.empty() ? "" : " ") + s;
+                    assertions.back().text = t;
+                }
+            }
+            return ok;
+        }
+
+        void Scenario::start()
+        {
+            for (const Event &e : events)
+                host::schedule(e.at_us, e.run);
+            for (size_t i = 0; i < assertions.size(); ++i)
+                host::schedule(assertions[i].from_us, [this, i] { poll(i); });
+            active = this;
+            monitor.attach();
+            for (size_t i = 0; i < measures.size(); ++i) {
+                host::schedule(measures[i].from_us, [this, i] {
+                    measures[i].start = monitor.counters();
+                });
+                host::schedule(measures[i].until_us, [this, i] {
+                    measures[i].result = monitor.counters() -
+                        measures[i].start;
+                    measures[i].done = true;
+                });
+            }
+        }
+
+        bool Scenario::over_budget(const Budget &b) const
+        {
+            const Measure &m = measures[b.measure];
+            return !m.done || counter(m.result, b.key) > b.max;
+        }
+
+        uint32_t Scenario::value_of(const Cond &c) const
+        {
+            switch (c.kind) {
+            case Cond::DECODER_REG:
+                return decoder.peek(c.map, c.reg) & c.mask;
+            case Cond::ENCODER_REG:
+                return encoder.regs[c.reg] & c.mask;
+            case Cond::DECODER_RESETS:
+                return decoder.resets();
+            case Cond::DECODER_NACKS:
+                return decoder.nacks();
+            case Cond::ENCODER_RESETS:
+                return encoder.resets();
+            case Cond::ENCODER_NACKS:
+                return encoder.nacks();
+            case Cond::PIN:
+                return pin_level(c.port, c.bit);
+            case Cond::WATCHDOG_RESETS:
+                return host::stats.watchdog_resets;
+            case Cond::LED_TIMER:
+                return host::led_timer_running();
+            case Cond::STATE_VAR:
+                return var_value[c.reg];
+            }
+            return 0;
+        }
+
+        void Scenario::uart_tx(uint8_t c)
+        {
+            if (active)
+                active->receive(c);
+        }
+
+        void Scenario::request_var(uint8_t var)
+        {
+            uint8_t f[10] = { 'K', PROTO_REQUEST, CMD_GET_VAR, 1, 0, var };
+            const uint32_t crc = crc32(f + 2, 4);
+            for (uint8_t i = 0; i < 4; ++i)
+                f[6 + i] = crc >> (8 * i);
+            host::uart_inject(f, sizeof(f));
+        }
+
+        // Picks the GET_VAR responses out of the serial output, which
+        // also carries the log: 'K' 'R' command length(u16) status var
+        // value(u16) crc32.
+        void Scenario::receive(uint8_t c)
+        {
+            if (rx_len == sizeof(rx))
+                memmove(rx, rx + 1, --rx_len);
+            rx[rx_len++] = c;
+            if (rx_len != sizeof(rx) || rx[0] != 'K' ||
+                    rx[1] != PROTO_RESPONSE || rx[2] != CMD_GET_VAR ||
+                    rx[3] != 4 || rx[4] != 0 || rx[5] != PS_OK)
+                return;
+            const uint32_t crc = rx[9] | rx[10] << 8 | rx[11] << 16 |
+                (uint32_t)rx[12] << 24;
+            if (crc != crc32(rx + 2, 7))
+                return;
+            var_value[rx[6]] = rx[7] | rx[8] << 8;
+            ++var_replies[rx[6]];
+            rx_len = 0;
+        }
+
+        bool Scenario::holds(const Cond &c, uint32_t v)
+        {
+            switch (c.op) {
+            case Cond::EQ:
+                return v == c.value;
+            case Cond::NE:
+                return v != c.value;
+            case Cond::GE:
+                return v >= c.value;
+            case Cond::LE:
+                return v <= c.value;
+            }
+            return false;
+        }
+
+        void Scenario::poll(size_t idx)
+        {
+            Assertion &a = assertions[idx];
+            const uint64_t now = host::now_us();
+            if (a.cond.kind == Cond::STATE_VAR) {
+                // Ask, then check the reply; ask again while the window
+                // lasts.
+                const uint32_t replies = var_replies[a.cond.reg];
+                if (!a.asked) {
+                    a.asked = true;
+                    a.replies = replies;
+                    request_var(a.cond.reg);
+                    host::schedule(now + POLL_US, [this, idx] { poll(idx); });
+                    return;
+                }
+                if (replies == a.replies) {
+                    if (now >= a.until_us + REPLY_US) {
+                        a.decided = true;
+                        a.detail = "no reply at " +
+                            std::to_string(now / 1000) + " ms";
+                    } else {
+                        host::schedule(now + POLL_US,
+                            [this, idx] { poll(idx); });
+                    }
+                    return;
+                }
+                a.asked = false;
+            }
+            const uint32_t v = value_of(a.cond);
+            if (holds(a.cond, v)) {
+                a.decided = true;
+                a.passed = true;
+                if (a.until_us != a.from_us)
+                    a.detail = "after " +
+                        std::to_string((now - a.from_us) / 1000) + " ms";
+            } else if (now >= a.until_us) {
+                a.decided = true;
+                a.detail = "is " + hex(v) + " at " +
+                    std::to_string(now / 1000) + " ms";
+            } else {
+                host::schedule(now + POLL_US, [this, idx] { poll(idx); });
+            }
+        }
+
+        uint32_t Scenario::report(FILE *f) const
+        {
+            uint32_t failed = 0;
+            for (const Assertion &a : assertions) {
+                const char *result = !a.decided ? "UNDECIDED" :
+                    a.passed ? "ok" : "FAIL";
+                if (!a.passed)
+                    ++failed;
+                fprintf(f, "line %u: %s: %s%s%s\n", a.line, result,
+                    a.text.c_str(), a.detail.empty() ? "" : ", ",
+                    a.detail.c_str());
+            }
+            fprintf(f, "%zu assertions, %u failed\n", assertions.size(),
+                failed);
+
+            for (const Measure &m : measures) {
+                const BusCounters &c = m.result;
+                if (!m.done) {
+                    fprintf(f, "measure %s: not finished\n", m.name.c_str());
+                    continue;
+                }
+                fprintf(f, "measure %s: %u transactions, %u writes, "
+                    "%u reads, %u bytes, %u switches, %u redundant, "
+                    "%u NACKs, %llu us bus time\n", m.name.c_str(),
+                    c.transactions, c.writes, c.reads, c.bytes, c.switches,
+                    c.redundant, c.nacks, (unsigned long long)c.bus_us);
+            }
+            uint32_t over = 0;
+            for (const Budget &b : budgets) {
+                const Measure &m = measures[b.measure];
+                const bool bad = over_budget(b);
+                if (bad)
+                    ++over;
+                fprintf(f, "line %u: %s: budget %s %s %llu, is %llu\n",
+                    b.line, bad ? "FAIL" : "ok", m.name.c_str(), KEYS[b.key],
+                    (unsigned long long)b.max,
+                    (unsigned long long)counter(m.result, b.key));
+            }
+            if (!budgets.empty())
+                fprintf(f, "%zu budgets, %u exceeded\n", budgets.size(),
+                    over);
+            return failed + over;
+        }
+
+        void Scenario::write_json(FILE *f, const char *name,
+                uint32_t scl_hz) const
+        {
+            uint32_t failed = 0;
+            for (const Assertion &a : assertions)
+                if (!a.passed)
+                    ++failed;
+
+            fprintf(f, "{\n  \"scenario\": \"%s\",\n"
+                "  \"scl_hz\": %u,\n  \"measures\": {", name,
+                (unsigned)scl_hz);
+            for (size_t i = 0; i < measures.size(); ++i) {
+                const Measure &m = measures[i];
+                fprintf(f, "%s\n    \"%s\": {\n      \"from_ms\": %llu,\n"
+                    "      \"to_ms\": %llu,\n      \"done\": %s",
+                    i ? "," : "", m.name.c_str(),
+                    (unsigned long long)m.from_us / 1000,
+                    (unsigned long long)m.until_us / 1000,
+                    m.done ? "true" : "false");
+                for (uint8_t k = 0; k < NUM_KEYS; ++k)
+                    fprintf(f, ",\n      \"%s\": %llu", KEYS[k],
+                        (unsigned long long)counter(m.result, k));
+                fprintf(f, ",\n      \"budgets\": {");
+                bool first = true;
+                bool ok = true;
+                for (const Budget &b : budgets) {
+                    if (b.measure != i)
+                        continue;
+                    fprintf(f, "%s\"%s\": %llu", first ? "" : ", ",
+                        KEYS[b.key], (unsigned long long)b.max);
+                    first = false;
+                    if (over_budget(b))
+                        ok = false;
+                }
+                fprintf(f, "},\n      \"ok\": %s\n    }",
+                    ok ? "true" : "false");
+            }
+            fprintf(f, "%s},\n  \"assertions_failed\": %u\n}\n",
+                measures.empty() ? "" : "\n  ", failed);
+        }
+    }
+}
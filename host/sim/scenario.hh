@@ -0,0 +1,171 @@
+#ifndef KORYUU_SIM_SCENARIO_HH
+#define KORYUU_SIM_SCENARIO_HH
+#include "sim/adv7280_sim.hh"
+#include "sim/adv7391_sim.hh"
+#include "sim/bus_monitor.hh"
+
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Scripted scenarios for the host build: a timeline of signal changes,
+// button presses and injected bus errors, assertions on the chip
+// registers and pins at given times or within time windows, and I2C
+// traffic measured over time windows with budgets.
+//
+// One statement per line, times in milliseconds of virtual time, '#'
+// starts a comment:
+//
+//   lock MS                       decoder lock time (default 50)
+//   end MS                        length of the run (default 3000)
+//   at MS signal none
+//   at MS signal INPUT STD [FLAG...]
+//                                 INPUT: cvbs, svideo, component
+//                                 STD: ntsc, ntsc443, palm, pal60, pal,
+//                                      secam, paln, secam525
+//                                 FLAG: progressive, nocolor, fsc_nonstd,
+//                                       ll_nonstd, mv=N
+//   at MS press input|option MS   hold a button down
+//   at MS nack decoder|encoder N [writes]
+//                                 NACK the next N transfers (register
+//                                 writes)
+//   at MS glitch decoder|encoder  power-on values to all registers, as a
+//                                 brownout would; not a software reset
+//   at MS expect COND             COND must hold at MS
+//   within MS MS COND             COND must become true in the window
+//                                 of the second length from the first
+//   measure NAME MS MS            count the I2C traffic in the window,
+//                                 see BusCounters
+//   budget NAME KEY MAX           the count KEY of the measurement NAME
+//                                 must not exceed MAX. KEY: transactions,
+//                                 writes, reads, bytes, switches,
+//                                 redundant, nacks, bus_us
+//
+//   COND: TARGET OP VALUE, OP is ==, !=, >= or <=
+//   TARGET: decoder[.MAP] REG [& MASK]   MAP: user (default), user2,
+//                                         intr, map80, vpp
+//           encoder REG [& MASK]
+//           decoder resets|nacks, encoder resets|nacks
+//           watchdog resets  times the watchdog expired
+//           var ID        the koryuu::StateVar ID, read with a control
+//                         protocol request; the reply may come up to
+//                         100 ms after the time or window
+//           led timer     1 while the LED timer runs
+//           pin NAME      intrq, led_cvbs, led_yc, led_opt, dec_reset,
+//                         dec_pwrdwn, enc_reset; 1 is high
+//
+// Example, NTSC on CVBS that drops out for 80 ms and comes back as PAL:
+//
+//   at 300 signal cvbs ntsc
+//   within 300 500 decoder 0x10 & 0x01 == 0x01
+//   at 900 signal none
+//   at 980 signal cvbs pal
+//   within 980 1000 encoder 0x80 == 0x71
+namespace koryuu {
+    namespace sim {
+        class Scenario {
+        public:
+            Scenario(Adv7280Sim &dec, Adv7391Sim &enc);
+
+            // Prints parse errors to stderr, returns false on any.
+            bool load(const char *path);
+            // Schedules the timeline on the host clock.
+            void start();
+            uint64_t end_us() const { return end_ms * 1000ull; }
+            // Prints every assertion, measurement and budget, returns the
+            // number of assertions that failed or were not decided before
+            // the end plus the budgets exceeded.
+            uint32_t report(FILE *f) const;
+            // The measurements and budgets as a JSON object.
+            void write_json(FILE *f, const char *name, uint32_t scl_hz) const;
+            // Feed of the bytes the firmware sends on the serial port.
+            static void uart_tx(uint8_t c);
+
+        private:
+            struct Cond {
+                enum Kind : uint8_t {
+                    DECODER_REG,
+                    ENCODER_REG,
+                    DECODER_RESETS,
+                    DECODER_NACKS,
+                    ENCODER_RESETS,
+                    ENCODER_NACKS,
+                    PIN,
+                    WATCHDOG_RESETS,
+                    LED_TIMER,
+                    STATE_VAR,
+                } kind;
+                DecMap map;
+                uint8_t reg;
+                uint8_t mask;
+                enum Op : uint8_t { EQ, NE, GE, LE } op;
+                uint32_t value;
+                char port;
+                uint8_t bit;
+            };
+
+            struct Assertion {
+                unsigned line;
+                std::string text;
+                Cond cond;
+                uint64_t from_us;
+                uint64_t until_us;
+                bool decided;
+                bool passed;
+                std::string detail;
+                bool asked;       // STATE_VAR: request sent
+                uint32_t replies; // STATE_VAR: replies to ID before it
+            };
+
+            struct Event {
+                uint64_t at_us;
+                std::function<void()> run;
+            };
+
+            struct Measure {
+                std::string name;
+                uint64_t from_us;
+                uint64_t until_us;
+                BusCounters start;
+                BusCounters result;
+                bool done;
+            };
+
+            struct Budget {
+                unsigned line;
+                size_t measure;
+                uint8_t key;
+                uint64_t max;
+            };
+
+            Adv7280Sim &decoder;
+            Adv7391Sim &encoder;
+            uint32_t end_ms;
+            std::vector<Event> events;
+            std::vector<Assertion> assertions;
+            BusMonitor monitor;
+            std::vector<Measure> measures;
+            std::vector<Budget> budgets;
+            // GET_VAR responses seen on the serial port.
+            uint8_t rx[13];
+            uint8_t rx_len;
+            uint16_t var_value[256];
+            uint32_t var_replies[256];
+            static Scenario *active;
+
+            bool parse_cond(const std::vector<std::string> &w, size_t i,
+                Cond &c, std::string &err) const;
+            bool parse_action(const std::vector<std::string> &w,
+                uint64_t at_us, std::string &err);
+            uint32_t value_of(const Cond &c) const;
+            static bool holds(const Cond &c, uint32_t v);
+            void poll(size_t idx);
+            void request_var(uint8_t var);
+            void receive(uint8_t c);
+            bool find_measure(const std::string &name, size_t &idx) const;
+            bool over_budget(const Budget &b) const;
+        };
+    }
+}
+#endif // KORYUU_SIM_SCENARIO_HH
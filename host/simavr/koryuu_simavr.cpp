@@ -0,0 +1,401 @@
+// Cycle benchmark of the firmware under simavr: runs the atmega328p image
+// built with PROFILE=1 (see profile.hh) against a scripted I2C peer that
+// stands in for the decoder and the encoder, and reports the cycle count
+// of every marked section. Built and run by 'make simavr_bench'.
+//
+// No baseline is committed: without --baseline the run only reports the
+// numbers. Record host/simavr/baseline with 'make simavr_baseline' on a
+// machine with simavr to turn it into a regression check.
+//
+// The peer answers at both chip addresses with register files. The
+// decoder reports a locked interlaced NTSC signal and raises INTRQ once
+// per field; writing its interrupt clear registers releases the line, so
+// every field runs the status poll.
+extern "C" {
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include <sim_irq.h>
+#include <sim_cycle_timers.h>
+#include <avr_ioport.h>
+#include <avr_twi.h>
+#include <avr_uart.h>
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+    // Data space address of GPIOR0 on the atmega328p.
+    constexpr avr_io_addr_t GPIOR0_ADDR = 0x3e;
+    constexpr uint8_t PROFILE_END = 0x80;
+
+    // Ids of profile.hh.
+    const char *const SECTIONS[] = {
+        nullptr,
+        "tick_isr",
+        "udre_isr",
+        "rx_isr",
+        "loop",
+        "status_poll",
+        "setup_encoder",
+        "setup_video",
+        "interrupt",
+    };
+    constexpr uint8_t NUM_SECTIONS = sizeof(SECTIONS) / sizeof(*SECTIONS);
+
+    struct Section {
+        avr_cycle_count_t entered;
+        bool inside;
+        uint32_t count;
+        uint64_t total;
+        uint32_t min;
+        uint32_t max;
+    };
+
+    Section sections[NUM_SECTIONS];
+
+    // 7-bit addresses, see main.cpp.
+    constexpr uint8_t DECODER_ADDR = 0x20;
+    constexpr uint8_t VPP_ADDR = 0x42;
+    constexpr uint8_t ENCODER_ADDR = 0x2a;
+    constexpr uint32_t FIELD_US = 16683;
+
+    struct Peer {
+        avr_t *avr;
+        avr_irq_t *irq;
+        avr_irq_t *intrq;
+        uint8_t selected; // 7-bit address, 0 if none
+        bool have_ptr;
+        uint8_t ptr;
+        uint8_t decoder[4][256]; // USER, INTR_VDP, USER2, 0x80 maps
+        uint8_t vpp[256];
+        uint8_t encoder[256];
+    };
+
+    Peer peer;
+
+    uint8_t &peer_reg(uint8_t reg)
+    {
+        if (peer.selected == ENCODER_ADDR)
+            return peer.encoder[reg];
+        if (peer.selected == VPP_ADDR)
+            return peer.vpp[reg];
+        // 0x0e is in every map.
+        const uint8_t sel = reg == 0x0e ? 0x00 : peer.decoder[0][0x0e];
+        const uint8_t map = sel == 0x20 ? 1 : sel == 0x40 ? 2 :
+            sel == 0x80 ? 3 : 0;
+        return peer.decoder[map][reg];
+    }
+
+    void peer_write(uint8_t v)
+    {
+        if (!peer.have_ptr) {
+            peer.ptr = v;
+            peer.have_ptr = true;
+            return;
+        }
+        const bool intr_map = peer.selected == DECODER_ADDR &&
+            peer.decoder[0][0x0e] == 0x20;
+        peer_reg(peer.ptr) = v;
+        // Interrupt clear registers release INTRQ.
+        if (intr_map && (peer.ptr == 0x43 || peer.ptr == 0x47 ||
+                peer.ptr == 0x4b) && v)
+            avr_raise_irq(peer.intrq, 1);
+        ++peer.ptr;
+    }
+
+    void peer_hook(avr_irq_t *, uint32_t value, void *)
+    {
+        avr_twi_msg_irq_t m;
+        m.u.v = value;
+        const uint8_t addr = m.u.twi.addr >> 1;
+
+        if (m.u.twi.msg & TWI_COND_STOP)
+            peer.selected = 0;
+        if (m.u.twi.msg & TWI_COND_START) {
+            peer.selected = 0;
+            if (addr == DECODER_ADDR || addr == ENCODER_ADDR ||
+                    (addr == VPP_ADDR && peer.decoder[0][0xfd] == 0x84)) {
+                peer.selected = addr;
+                // A repeated start for a read keeps the pointer.
+                if (!(m.u.twi.addr & 1))
+                    peer.have_ptr = false;
+                avr_raise_irq(peer.irq + TWI_IRQ_INPUT,
+                    avr_twi_irq_msg(TWI_COND_ACK, m.u.twi.addr, 1));
+            }
+        }
+        if (!peer.selected)
+            return;
+        if (m.u.twi.msg & TWI_COND_WRITE) {
+            avr_raise_irq(peer.irq + TWI_IRQ_INPUT,
+                avr_twi_irq_msg(TWI_COND_ACK, m.u.twi.addr, 1));
+            peer_write(m.u.twi.data);
+        }
+        if (m.u.twi.msg & TWI_COND_READ) {
+            const uint8_t v = peer_reg(peer.ptr++);
+            avr_raise_irq(peer.irq + TWI_IRQ_INPUT,
+                avr_twi_irq_msg(TWI_COND_READ, m.u.twi.addr, v));
+        }
+    }
+
+    const char *PEER_IRQ_NAMES[2] = { "32<peer.in", "8>peer.out" };
+
+    void peer_attach(avr_t *avr)
+    {
+        peer.avr = avr;
+        peer.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, PEER_IRQ_NAMES);
+        avr_irq_register_notify(peer.irq + TWI_IRQ_OUTPUT, peer_hook,
+            nullptr);
+        avr_connect_irq(peer.irq + TWI_IRQ_INPUT,
+            avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+        avr_connect_irq(
+            avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+            peer.irq + TWI_IRQ_OUTPUT);
+
+        // Locked interlaced NTSC, fSC lock; ADV7280A ident.
+        peer.decoder[0][0x10] = 0x05;
+        peer.decoder[0][0x11] = 0x41;
+        peer.decoder[0][0x13] = 0x61;
+        peer.intrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+        avr_raise_irq(peer.intrq, 1);
+    }
+
+    avr_cycle_count_t field(avr_t *avr, avr_cycle_count_t when, void *)
+    {
+        // Field change interrupt, status 2 bit 4.
+        peer.decoder[1][0x46] |= 0x10;
+        avr_raise_irq(peer.intrq, 0);
+        return when + avr_usec_to_cycles(avr, FIELD_US);
+    }
+
+    struct Press {
+        bool input;       // Else option
+        uint32_t at_ms;
+        uint32_t ms;
+        avr_irq_t *pin;
+    };
+
+    avr_cycle_count_t release(avr_t *, avr_cycle_count_t, void *param)
+    {
+        avr_raise_irq(static_cast<Press *>(param)->pin, 1);
+        return 0;
+    }
+
+    avr_cycle_count_t press(avr_t *avr, avr_cycle_count_t, void *param)
+    {
+        Press *p = static_cast<Press *>(param);
+        avr_raise_irq(p->pin, 0);
+        avr_cycle_timer_register_usec(avr, p->ms * 1000ul, release, p);
+        return 0;
+    }
+
+    void marker(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *)
+    {
+        avr->data[addr] = v;
+        const uint8_t id = v & ~PROFILE_END;
+        if (!id || id >= NUM_SECTIONS)
+            return;
+        Section &s = sections[id];
+        if (!(v & PROFILE_END)) {
+            s.entered = avr->cycle;
+            s.inside = true;
+            return;
+        }
+        if (!s.inside)
+            return;
+        s.inside = false;
+        const uint32_t c = avr->cycle - s.entered;
+        if (!s.count || c < s.min)
+            s.min = c;
+        if (c > s.max)
+            s.max = c;
+        s.total += c;
+        ++s.count;
+    }
+
+    // Baseline lines: section max_cycles. Returns the number of
+    // sections whose max exceeds the baseline by more than tolerance
+    // percent, or -1 if the file cannot be read.
+    int check_baseline(const char *path, unsigned tolerance)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+            return -1;
+        int over = 0;
+        char name[32];
+        unsigned long max;
+        while (fscanf(f, "%31s %lu", name, &max) == 2) {
+            for (uint8_t i = 1; i < NUM_SECTIONS; ++i) {
+                if (strcmp(name, SECTIONS[i]))
+                    continue;
+                const Section &s = sections[i];
+                const bool bad = s.max * 100ull > max * (100ull + tolerance);
+                if (bad)
+                    ++over;
+                printf("%s: %s max %u cycles, baseline %lu\n",
+                    bad ? "FAIL" : "ok", name, (unsigned)s.max, max);
+            }
+        }
+        fclose(f);
+        return over;
+    }
+
+    void usage(const char *argv0)
+    {
+        fprintf(stderr,
+            "usage: %s [--ms N] [--press input|option AT_MS LEN_MS] "
+            "[--report FILE] [--baseline FILE [--tolerance PCT]] "
+            "[--save-baseline FILE] FIRMWARE.elf\n", argv0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ms = 3000;
+    const char *elf = nullptr;
+    const char *report = nullptr;
+    const char *baseline = nullptr;
+    const char *save_baseline = nullptr;
+    unsigned tolerance = 2;
+    static Press presses[8];
+    unsigned n_presses = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_arg = i + 1 < argc;
+        if (!strcmp(argv[i], "--ms") && has_arg) {
+            ms = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--press") && i + 3 < argc &&
+                n_presses < 8) {
+            Press &p = presses[n_presses++];
+            const char *which = argv[++i];
+            p.input = !strcmp(which, "input");
+            p.at_ms = strtoul(argv[++i], nullptr, 0);
+            p.ms = strtoul(argv[++i], nullptr, 0);
+            if (!p.input && strcmp(which, "option")) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (!strcmp(argv[i], "--report") && has_arg) {
+            report = argv[++i];
+        } else if (!strcmp(argv[i], "--baseline") && has_arg) {
+            baseline = argv[++i];
+        } else if (!strcmp(argv[i], "--tolerance") && has_arg) {
+            tolerance = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--save-baseline") && has_arg) {
+            save_baseline = argv[++i];
+        } else if (argv[i][0] != '-' && !elf) {
+            elf = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!elf) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    elf_firmware_t fw;
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(elf, &fw)) {
+        fprintf(stderr, "%s: cannot load\n", elf);
+        return 1;
+    }
+    avr_t *avr = avr_make_mcu_by_name("atmega328p");
+    if (!avr) {
+        fprintf(stderr, "simavr has no atmega328p\n");
+        return 1;
+    }
+    avr_init(avr);
+    fw.frequency = 1000000;
+    avr_load_firmware(avr, &fw);
+
+    // The serial output is binary, keep it off the terminal.
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+    avr_register_io_write(avr, GPIOR0_ADDR, marker, nullptr);
+    peer_attach(avr);
+    avr_cycle_timer_register_usec(avr, FIELD_US, field, nullptr);
+
+    // Buttons up.
+    avr_irq_t *const input_pin =
+        avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 5);
+    avr_irq_t *const option_pin =
+        avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 7);
+    avr_raise_irq(input_pin, 1);
+    avr_raise_irq(option_pin, 1);
+    for (unsigned i = 0; i < n_presses; ++i) {
+        Press &p = presses[i];
+        p.pin = p.input ? input_pin : option_pin;
+        avr_cycle_timer_register_usec(avr, p.at_ms * 1000ul, press, &p);
+    }
+
+    const avr_cycle_count_t end = avr_usec_to_cycles(avr, ms * 1000ull);
+    int state = cpu_Running;
+    while (avr->cycle < end && state != cpu_Done && state != cpu_Crashed)
+        state = avr_run(avr);
+    if (state == cpu_Crashed) {
+        fprintf(stderr, "the firmware crashed at cycle %llu\n",
+            (unsigned long long)avr->cycle);
+        return 1;
+    }
+
+    printf("%llu cycles\n", (unsigned long long)avr->cycle);
+    for (uint8_t i = 1; i < NUM_SECTIONS; ++i) {
+        const Section &s = sections[i];
+        printf("%-14s %6u runs, cycles min %7u mean %7llu max %7u\n",
+            SECTIONS[i], (unsigned)s.count, (unsigned)s.min,
+            (unsigned long long)(s.count ? s.total / s.count : 0),
+            (unsigned)s.max);
+    }
+
+    if (report) {
+        FILE *f = fopen(report, "w");
+        if (!f) {
+            perror(report);
+            return 1;
+        }
+        fprintf(f, "{\n  \"f_cpu\": 1000000,\n  \"cycles\": %llu,\n"
+            "  \"sections\": {", (unsigned long long)avr->cycle);
+        for (uint8_t i = 1; i < NUM_SECTIONS; ++i) {
+            const Section &s = sections[i];
+            fprintf(f, "%s\n    \"%s\": { \"count\": %u, \"min\": %u, "
+                "\"mean\": %llu, \"max\": %u }", i > 1 ? "," : "",
+                SECTIONS[i], (unsigned)s.count, (unsigned)s.min,
+                (unsigned long long)(s.count ? s.total / s.count : 0),
+                (unsigned)s.max);
+        }
+        fprintf(f, "\n  }\n}\n");
+        fclose(f);
+    }
+
+    if (save_baseline) {
+        FILE *f = fopen(save_baseline, "w");
+        if (!f) {
+            perror(save_baseline);
+            return 1;
+        }
+        for (uint8_t i = 1; i < NUM_SECTIONS; ++i)
+            if (sections[i].count)
+                fprintf(f, "%s %u\n", SECTIONS[i],
+                    (unsigned)sections[i].max);
+        fclose(f);
+    }
+
+    if (!baseline) {
+        if (!save_baseline)
+            printf("no baseline, cycle counts reported only\n");
+        return 0;
+    }
+    const int over = check_baseline(baseline, tolerance);
+    if (over < 0) {
+        perror(baseline);
+        return 1;
+    }
+    return over ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+# Cycle benchmark of the AVR image under simavr, see koryuu_simavr.cpp.
+# Included from the Makefile, needs yaamake, the AVR toolchain and simavr
+# with its headers:
+#   make simavr_bench       run, compare with host/simavr/baseline if it
+#                           exists (none is committed), else only report
+#   make simavr_baseline    run, record the baseline
+SIMAVR_CFLAGS ?= $(shell pkg-config --cflags simavr 2>/dev/null || \
+	echo -I/usr/include/simavr)
+SIMAVR_LIBS ?= $(shell pkg-config --libs simavr 2>/dev/null || \
+	echo -lsimavr) -lelf
+SIMAVR_BIN := host/build/koryuu-simavr
+SIMAVR_ELF ?= $(TARGET).elf
+SIMAVR_BASELINE := host/simavr/baseline
+# Allowed growth of a section's maximum over the baseline, in percent.
+SIMAVR_TOLERANCE ?= 2
+# Boot, then a short press on option for setup_encoder().
+SIMAVR_ARGS ?= --ms 3000 --press option 1500 150
+
+$(SIMAVR_BIN): host/simavr/koryuu_simavr.cpp
+	mkdir -p $(dir $@)
+	$(HOST_CXX) -std=gnu++14 -O2 -Wall $(SIMAVR_CFLAGS) $< \
+		$(SIMAVR_LIBS) -o $@
+
+simavr_bench: DEFS += -DPROFILE=1
+simavr_bench: clean build $(SIMAVR_BIN)
+	$(SIMAVR_BIN) $(SIMAVR_ARGS) --report host/build/simavr.json \
+		$(if $(wildcard $(SIMAVR_BASELINE)),--baseline $(SIMAVR_BASELINE) \
+		--tolerance $(SIMAVR_TOLERANCE)) $(SIMAVR_ELF)
+
+simavr_baseline: DEFS += -DPROFILE=1
+simavr_baseline: clean build $(SIMAVR_BIN)
+	$(SIMAVR_BIN) $(SIMAVR_ARGS) --save-baseline $(SIMAVR_BASELINE) \
+		$(SIMAVR_ELF)
+
+.PHONY: simavr_bench simavr_baseline
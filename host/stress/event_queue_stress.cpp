@@ -0,0 +1,115 @@
+// Stress test of the event queue (event_queue.hh): a producer thread
+// posts numbered events while the consumer thread takes them, on real
+// cores and without any locking, as the interrupt handlers and the main
+// loop do on the AVR. Checks that every event arrives once, in order and
+// not torn, with the producer waiting on a full queue, and that a
+// producer that drops events on a full queue loses exactly what it was
+// told it lost.
+#include "event_queue.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+namespace {
+    using koryuu::Event;
+    using Queue = koryuu::EventQueue<8>;
+
+    // Ties the three fields together, so that a torn slot shows.
+    uint8_t payload_of(uint32_t seq)
+    {
+        return (uint8_t)(seq * 151u + 7u);
+    }
+
+    uint8_t type_of(uint32_t seq)
+    {
+        return (uint8_t)(seq >> 16);
+    }
+
+    struct Result {
+        uint32_t taken;
+        uint32_t errors;
+    };
+
+    // The producer waits while the queue is full if lossless, otherwise
+    // counts the events the queue refused.
+    Result run(uint32_t n, bool lossless, uint32_t &refused)
+    {
+        Queue q;
+        std::atomic<bool> done(false);
+        refused = 0;
+
+        std::thread producer([&] {
+            for (uint32_t seq = 0; seq < n; ++seq) {
+                while (!q.post(type_of(seq), payload_of(seq),
+                        (uint16_t)seq)) {
+                    if (!lossless) {
+                        ++refused;
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+                // Posting in bursts, so that the lossy queue also
+                // drains on a single core.
+                if (!lossless && seq % 16 == 15)
+                    std::this_thread::yield();
+            }
+            done = true;
+        });
+
+        Result r = { 0, 0 };
+        uint32_t expect = 0;
+        Event e;
+        for (;;) {
+            const bool finished = done;
+            if (!q.take(e)) {
+                // Everything posted before done was set is taken.
+                if (finished)
+                    break;
+                std::this_thread::yield();
+                continue;
+            }
+            // The sequence number from the time and the type; events may
+            // only be skipped if lost.
+            uint32_t seq = expect;
+            while (seq < n &&
+                ((uint16_t)seq != e.time || type_of(seq) != e.type))
+                ++seq;
+            if (seq == n || (lossless && seq != expect) ||
+                e.payload != payload_of(seq))
+            {
+                if (r.errors < 10)
+                    fprintf(stderr, "event %u: got type %u payload %u "
+                        "time %u, expected seq %u\n", r.taken, e.type,
+                        e.payload, e.time, expect);
+                ++r.errors;
+            }
+            expect = seq + 1;
+            ++r.taken;
+        }
+        producer.join();
+        return r;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t n = argc > 1 ? strtoul(argv[1], nullptr, 0) : 2000000;
+    int ret = 0;
+
+    uint32_t refused;
+    Result r = run(n, true, refused);
+    printf("lossless: %u posted, %u taken, %u errors\n", n, r.taken,
+        r.errors);
+    if (r.errors || r.taken != n)
+        ret = 1;
+
+    r = run(n, false, refused);
+    printf("lossy: %u posted, %u refused, %u taken, %u errors\n", n,
+        refused, r.taken, r.errors);
+    if (r.errors || r.taken + refused != n)
+        ret = 1;
+
+    return ret;
+}
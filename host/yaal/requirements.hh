@@ -0,0 +1,44 @@
+#ifndef KORYUU_HOST_YAAL_REQUIREMENTS_HH
+#define KORYUU_HOST_YAAL_REQUIREMENTS_HH
+
+// Stand-in for yaal's requirements.hh in the host build: the firmware
+// sources only take the definitions below from yaal, everything else
+// comes from the HAL.
+#include <stdint.h>
+#include <stddef.h>
+
+#define __YAAL__ 1
+#define YAAL_INLINE(name) inline __attribute__((always_inline))
+
+// Strings tagged into the image, see FW_VERSION in main.cpp.
+#define _T_DECL(name, s) static const char name##_T[] = s
+#define _T_REF(name) name##_T
+
+namespace yaal {
+    namespace internal {
+        template<bool B, typename T = void>
+        struct enable_if {};
+
+        template<typename T>
+        struct enable_if<true, T> {
+            using type = T;
+        };
+
+        template<bool B, typename T = void>
+        using enable_if_t = typename enable_if<B, T>::type;
+
+        template<typename T>
+        struct typeof_ {
+            using type = T;
+        };
+
+        template<typename T>
+        struct typeof_<T &> {
+            using type = T;
+        };
+
+        template<typename T>
+        using typeof_t = typename typeof_<T>::type;
+    }
+}
+#endif // KORYUU_HOST_YAAL_REQUIREMENTS_HH
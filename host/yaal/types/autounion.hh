@@ -0,0 +1,29 @@
+#ifndef KORYUU_HOST_YAAL_AUTOUNION_HH
+#define KORYUU_HOST_YAAL_AUTOUNION_HH
+#include <yaal/requirements.hh>
+
+namespace yaal {
+    // A value and its bytes, least significant first. The host build
+    // only runs on little endian machines, where the byte order
+    // parameter needs no swapping.
+    template<typename T, bool little_endian, size_t SIZE = sizeof(T)>
+    class autounion {
+        static_assert(SIZE >= sizeof(T), "autounion is too small");
+        union {
+            T v;
+            uint8_t bytes[SIZE];
+        } u;
+
+    public:
+        autounion() {}
+        autounion(const T &v) { u.v = v; }
+
+        T &value() { return u.v; }
+        const T &value() const { return u.v; }
+        operator T() const { return u.v; }
+
+        uint8_t &operator[](size_t i) { return u.bytes[i]; }
+        const uint8_t &operator[](size_t i) const { return u.bytes[i]; }
+    };
+}
+#endif // KORYUU_HOST_YAAL_AUTOUNION_HH
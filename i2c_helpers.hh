@@ -4,7 +4,7 @@
 #include <yaal/requirements.hh>
 
 #ifdef __YAAL__
-#include <yaal/communication/i2c_hw.hh>
+#include "hal.hh"
 
 #ifndef __cpp_if_constexpr
     #if __cplusplus >= 201703L
@@ -22,39 +22,72 @@
 
 namespace i2c_helpers {
     using i2c_err_f_t = void (*)(uint8_t addr, uint8_t arg_count);
+    using i2c_write_hook_t = void (*)(uint8_t addr, uint8_t reg, uint8_t v);
 
     template<typename ...Ts>
     inline void I2C_INIT(Ts... args)
     {
-        using yaal::I2c_HW;
-        I2c_HW.setup(args...);
+        koryuu::hal::i2c_setup(args...);
     }
 
     namespace internal {
         i2c_err_f_t err_func = nullptr;
+        i2c_write_hook_t write_hook = nullptr;
     }
 
+    // The last transfer started: address and argument count as err_func
+    // gets them, 0 for a read. Kept over a watchdog reset for the fault
+    // log, see supervisor.hh.
+    HAL_NOINIT uint8_t last_addr;
+    HAL_NOINIT uint8_t last_args;
+
     inline void I2C_set_err_func(i2c_err_f_t f)
     {
         using internal::err_func;
         err_func = f;
     }
 
+    // Called for every register a write is meant for, ACKed or not,
+    // before the transfer; bursts auto-increment the register.
+    inline void I2C_set_write_hook(i2c_write_hook_t f)
+    {
+        using internal::write_hook;
+        write_hook = f;
+    }
+
     template<bool fail_fatal = true, typename ...Ts>
     void I2C_WRITE(uint8_t addr, Ts... args)
     {
-        using yaal::I2c_HW;
         using internal::err_func;
-        bool err = I2c_HW.write(addr, args...);
+        using internal::write_hook;
+        last_addr = addr;
+        last_args = sizeof...(args);
+        IF_CONSTEXPR (sizeof...(args) > 1) {
+            if (write_hook) {
+                const uint8_t data[] = { (uint8_t)args... };
+                for (uint8_t i = 1; i < sizeof...(args); ++i)
+                    write_hook(addr, data[0] + i - 1, data[i]);
+            }
+        }
+        bool err = koryuu::hal::i2c_write(addr, args...);
         IF_CONSTEXPR (fail_fatal && err && err_func)
             err_func(addr, sizeof...(args));
     }
 
     inline uint8_t I2C_READ_ONE(uint8_t addr, uint8_t reg)
     {
-        using yaal::I2c_HW;
-        I2c_HW.write<true, false>(addr, reg);
-        return I2c_HW.read(addr);
+        last_addr = addr;
+        last_args = 0;
+        return koryuu::hal::i2c_read_one(addr, reg);
+    }
+
+    // Reads n consecutive registers from reg on. Returns true on failure,
+    // the caller decides what the missing bytes mean.
+    inline bool I2C_READ(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t n)
+    {
+        last_addr = addr;
+        last_args = 0;
+        return koryuu::hal::i2c_read(addr, reg, buf, n);
     }
 }
 
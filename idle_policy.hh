@@ -0,0 +1,93 @@
+#ifndef KORYUU_IDLE_POLICY_HH
+#define KORYUU_IDLE_POLICY_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+
+namespace koryuu {
+    enum IdleState : uint8_t {
+        IDLE_AWAKE = 0,  // Decoder and encoder running
+        IDLE_ASLEEP = 1, // Decoder powered down, encoder asleep
+    };
+
+    // Times in timer ticks, except the timeout.
+    struct IdleTimings {
+        uint16_t timeout_s;    // Time without lock before sleeping, 0: never
+        uint16_t second;       // Ticks per second
+        uint16_t probe_period; // Time between wake probes while asleep
+    };
+
+    // Idle policy: AWAKE -> ASLEEP after timeout_s seconds without lock,
+    // back to AWAKE on wake(). The timeout is counted in whole seconds,
+    // so it may be longer than the 16-bit tick counts can span.
+    class IdlePolicy {
+        const IdleTimings &timings;
+        IdleState st;
+        uint16_t mark;       // Start of the current second, or last probe
+        uint16_t unlocked_s; // Seconds without lock, while awake
+        uint16_t asleep_s;   // Seconds asleep, while asleep
+        uint16_t sub;        // Ticks into the current second, while asleep
+
+    public:
+        IdlePolicy(const IdleTimings &t)
+            : timings(t), st(IDLE_AWAKE), mark(0), unlocked_s(0),
+              asleep_s(0), sub(0)
+        {}
+
+        YAAL_INLINE("IdlePolicy::asleep()")
+        bool asleep() const {
+            return st == IDLE_ASLEEP;
+        }
+
+        // Seconds spent asleep, as of the last probe_due().
+        YAAL_INLINE("IdlePolicy::asleep_time()")
+        uint16_t asleep_time() const {
+            return asleep_s;
+        }
+
+        // Feeds in the lock status while awake. Returns true when it is
+        // time to go to sleep.
+        bool update(bool locked, uint16_t now) {
+            if (locked || !timings.timeout_s) {
+                unlocked_s = 0;
+                mark = now;
+                return false;
+            }
+            while ((uint16_t)(now - mark) >= timings.second) {
+                mark += timings.second;
+                ++unlocked_s;
+            }
+            return unlocked_s >= timings.timeout_s;
+        }
+
+        void sleep(uint16_t now) {
+            st = IDLE_ASLEEP;
+            mark = now;
+            asleep_s = 0;
+            sub = 0;
+        }
+
+        // While asleep: returns true once per probe period.
+        bool probe_due(uint16_t now) {
+            const uint16_t elapsed = now - mark;
+            if (elapsed < timings.probe_period)
+                return false;
+            mark = now;
+            sub += elapsed;
+            while (sub >= timings.second) {
+                sub -= timings.second;
+                if (asleep_s != 0xffff)
+                    ++asleep_s;
+            }
+            return true;
+        }
+
+        void wake(uint16_t now) {
+            st = IDLE_AWAKE;
+            unlocked_s = 0;
+            mark = now;
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_IDLE_POLICY_HH
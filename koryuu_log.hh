@@ -0,0 +1,172 @@
+#ifndef KORYUU_LOG_HH
+#define KORYUU_LOG_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "uart.hh"
+
+// Tokenized logging: a log record carries the message id and the raw
+// arguments, the text lives in log_messages.def and is expanded on the
+// host by tools/koryuu_log.py.
+//
+// Record: 'K' 'L' id length arguments, integers little endian.
+namespace koryuu {
+    enum LogId : uint8_t {
+#define LOG_MSG(id, format) id,
+#include "log_messages.def"
+#undef LOG_MSG
+        NUM_LOG_IDS,
+    };
+
+    // Only used at compile time, to check the arguments of log().
+    constexpr const char *LOG_FORMATS[NUM_LOG_IDS] = {
+#define LOG_MSG(id, format) format,
+#include "log_messages.def"
+#undef LOG_MSG
+    };
+
+    // Size of the placeholder type starting at p, 0 for the variable
+    // length types.
+    constexpr uint8_t log_placeholder_size(const char *p)
+    {
+        return
+            (p[0] == 'u' || p[0] == 'x') && p[1] == '8' ? 1 :
+            (p[0] == 'u' || p[0] == 'x') && p[1] == '1' && p[2] == '6' ? 2 :
+            (p[0] == 'u' || p[0] == 'x') && p[1] == '3' && p[2] == '2' ? 4 :
+            p[0] == 'b' && p[1] == 'o' ? 1 :
+            0;
+    }
+
+    constexpr uint8_t log_format_fixed_size(const char *fmt)
+    {
+        uint8_t n = 0;
+        for (; *fmt; ++fmt)
+            if (*fmt == '{')
+                n += log_placeholder_size(fmt + 1);
+        return n;
+    }
+
+    constexpr bool log_format_is_variable(const char *fmt)
+    {
+        for (; *fmt; ++fmt)
+            if (*fmt == '{' && log_placeholder_size(fmt + 1) == 0)
+                return true;
+        return false;
+    }
+
+    // Variable length argument, for {str} and {bytes}.
+    struct LogBytes {
+        const void *p;
+        uint8_t n;
+    };
+
+    // Integers and enums, sent with their size.
+    template<typename T>
+    struct LogArg {
+        static constexpr uint8_t fixed = sizeof(T);
+        static constexpr bool variable = false;
+
+        static uint8_t size(const T &) {
+            return sizeof(T);
+        }
+
+        template<typename Sink>
+        static void put(Sink &sink, const T &v) {
+            for (uint8_t i = 0; i < sizeof(T); ++i)
+                sink.put((uint8_t)((uint32_t)v >> (8 * i)));
+        }
+    };
+
+    template<>
+    struct LogArg<LogBytes> {
+        static constexpr uint8_t fixed = 0;
+        static constexpr bool variable = true;
+
+        static uint8_t size(const LogBytes &b) {
+            return b.n;
+        }
+
+        template<typename Sink>
+        static void put(Sink &sink, const LogBytes &b) {
+            const uint8_t *p = static_cast<const uint8_t *>(b.p);
+            for (uint8_t i = 0; i < b.n; ++i)
+                sink.put(p[i]);
+        }
+    };
+
+    template<>
+    struct LogArg<FlashString> {
+        static constexpr uint8_t fixed = 0;
+        static constexpr bool variable = true;
+
+        static uint8_t size(const FlashString &s) {
+            return hal::flash_strlen(s.p);
+        }
+
+        template<typename Sink>
+        static void put(Sink &sink, const FlashString &s) {
+            char c;
+            const char *p = s.p;
+            while ((c = hal::flash_read_byte(p++)))
+                sink.put(c);
+        }
+    };
+
+    template<typename... Args>
+    struct LogArgs;
+
+    template<>
+    struct LogArgs<> {
+        static constexpr uint8_t fixed = 0;
+        static constexpr bool variable = false;
+
+        static uint8_t size() {
+            return 0;
+        }
+
+        template<typename Sink>
+        static void put(Sink &) {}
+    };
+
+    template<typename T, typename... Rest>
+    struct LogArgs<T, Rest...> {
+        static constexpr uint8_t fixed =
+            LogArg<T>::fixed + LogArgs<Rest...>::fixed;
+        static constexpr bool variable =
+            LogArg<T>::variable || LogArgs<Rest...>::variable;
+
+        static uint8_t size(const T &v, const Rest &...rest) {
+            return LogArg<T>::size(v) + LogArgs<Rest...>::size(rest...);
+        }
+
+        template<typename Sink>
+        static void put(Sink &sink, const T &v, const Rest &...rest) {
+            LogArg<T>::put(sink, v);
+            LogArgs<Rest...>::put(sink, rest...);
+        }
+    };
+
+    // Sends one record, or drops it whole if the sink has no room. The
+    // sink needs reserve(n) and put(c), see Uart.
+    template<LogId ID, typename Sink, typename... Args>
+    void log(Sink &sink, const Args &...args)
+    {
+        static_assert(ID < NUM_LOG_IDS, "Unknown log message");
+        static_assert(LogArgs<Args...>::fixed
+                == log_format_fixed_size(LOG_FORMATS[ID])
+            && LogArgs<Args...>::variable
+                == log_format_is_variable(LOG_FORMATS[ID]),
+            "Log arguments do not match the format");
+
+        const uint8_t len = LogArgs<Args...>::size(args...);
+        if (!sink.reserve(4 + len))
+            return;
+        sink.put('K');
+        sink.put('L');
+        sink.put(ID);
+        sink.put(len);
+        LogArgs<Args...>::put(sink, args...);
+    }
+}
+#endif // __YAAL__
+#endif // KORYUU_LOG_HH
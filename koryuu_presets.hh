@@ -0,0 +1,219 @@
+#ifndef KORYUU_PRESETS_HH
+#define KORYUU_PRESETS_HH
+
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+#include "i2c_helpers.hh"
+
+namespace koryuu_presets {
+    using namespace i2c_helpers;
+
+    constexpr uint8_t NUM_PRESETS = 4;
+    constexpr uint8_t MAX_DELTAS = 8;
+    constexpr uint8_t NAME_LEN = 8;
+    constexpr uint8_t PRESET_MAGIC = 0xa5u;
+    constexpr uint8_t NO_PRESET = 0xffu;
+
+    enum Target : uint8_t {
+        TARGET_DECODER = 0,
+        TARGET_ENCODER = 1,
+    };
+
+    // Registers a preset may override, with the value the base init
+    // writes. Everything else a preset touches is runtime state
+    // (IRE mode, DNR, output format, color space), not registers.
+    // Some bases are replaced at runtime, see Presets::set_base().
+    struct Tunable {
+        Target target;
+        uint8_t reg;
+        uint8_t base;
+    };
+
+    enum TunableIdx : uint8_t {
+        TUN_ANALOG_CLAMP = 0,
+        TUN_DIGITAL_CLAMP,
+        TUN_SHAPING_FILTER,
+        TUN_COMB_FILTER,
+        TUN_NTSC_COMB,
+        TUN_PAL_COMB,
+        TUN_COLOR_KILL,
+        TUN_ENC_OUTPUT_LEVEL,
+        NUM_TUNABLES,
+    };
+
+    constexpr koryuu::hal::FlashTable<Tunable, NUM_TUNABLES> TUNABLES
+            HAL_PROGMEM = {{
+        // Analog clamp control: 100% color bars
+        [TUN_ANALOG_CLAMP]     = { TARGET_DECODER, 0x14, 0x11 },
+        // Digital clamp control: on, time constant adaptive
+        [TUN_DIGITAL_CLAMP]    = { TARGET_DECODER, 0x15, 0x60 },
+        // Shaping filter control
+        [TUN_SHAPING_FILTER]   = { TARGET_DECODER, 0x17, 0x59 },
+        // Comb filter control: narrow
+        [TUN_COMB_FILTER]      = { TARGET_DECODER, 0x19, 0xf0 },
+        // NTSC comb control: 5-line adaptive
+        [TUN_NTSC_COMB]        = { TARGET_DECODER, 0x38, 0xc0 },
+        // PAL comb control: 5-line adaptive
+        [TUN_PAL_COMB]         = { TARGET_DECODER, 0x39, 0xc0 },
+        // Color kill threshold 4%
+        [TUN_COLOR_KILL]       = { TARGET_DECODER, 0x3d, 0x32 },
+        // Closed captioning + output voltage level
+        [TUN_ENC_OUTPUT_LEVEL] = { TARGET_ENCODER, 0x83, 0x76 },
+    }};
+
+    constexpr uint8_t PRESET_FLAG_COMPONENT_OUT = 0x01;
+    constexpr uint8_t PRESET_FLAG_RGB_COLOR     = 0x02;
+
+    struct RegDelta {
+        uint8_t idx;   // TunableIdx
+        uint8_t value;
+    } __attribute__((packed));
+
+    struct Preset {
+        uint8_t magic;
+        char name[NAME_LEN];
+        uint8_t mode_ire;
+        uint8_t noise_reduction;
+        uint8_t flags;
+        uint8_t n_deltas;
+        RegDelta deltas[MAX_DELTAS];
+    } __attribute__((packed));
+    static_assert(sizeof(Preset) == 29, "Preset size is wrong!");
+
+    class Presets {
+        /* EEMEM */ Preset *const eeprom_presets;
+        uint8_t bases[NUM_TUNABLES];
+        uint8_t values[NUM_TUNABLES];
+        uint8_t overrides; // Bit per tunable set by the active preset
+        uint8_t active;
+
+        static bool valid(const Preset &p) {
+            if (p.magic != PRESET_MAGIC || p.n_deltas > MAX_DELTAS)
+                return false;
+            for (uint8_t i = 0; i < p.n_deltas; ++i)
+                if (p.deltas[i].idx >= NUM_TUNABLES)
+                    return false;
+            return true;
+        }
+
+        static bool overrides_idx(const Preset *p, uint8_t idx,
+                uint8_t &v) {
+            bool ret = false;
+            if (p)
+                for (uint8_t i = 0; i < p->n_deltas; ++i)
+                    if (p->deltas[i].idx == idx) {
+                        v = p->deltas[i].value;
+                        ret = true;
+                    }
+            return ret;
+        }
+
+        static uint8_t address_of(Target t, uint8_t dec_addr,
+                uint8_t enc_addr) {
+            return t == TARGET_DECODER ? dec_addr : enc_addr;
+        }
+
+    public:
+        Presets(/* EEMEM */ Preset *const eep_p)
+                : eeprom_presets(eep_p), overrides(0x00), active(NO_PRESET)
+        {
+            static_assert(NUM_TUNABLES <= 8, "overrides mask is too small");
+            for (uint8_t i = 0; i < NUM_TUNABLES; ++i)
+                bases[i] = values[i] = TUNABLES[i].base;
+        }
+
+        YAAL_INLINE("Presets::active_slot()")
+        uint8_t active_slot() const {
+            return active;
+        }
+
+        YAAL_INLINE("Presets::value()")
+        uint8_t value(TunableIdx idx) const {
+            return values[idx];
+        }
+
+        // Returns false if the slot does not hold a valid preset.
+        bool load(uint8_t slot, Preset &p) const {
+            if (slot >= NUM_PRESETS)
+                return false;
+            koryuu::hal::eeprom_read(&p, &eeprom_presets[slot], sizeof(p));
+            return valid(p);
+        }
+
+        void store(uint8_t slot, Preset &p) {
+            if (slot >= NUM_PRESETS)
+                return;
+            p.magic = PRESET_MAGIC;
+            koryuu::hal::eeprom_update(&p, &eeprom_presets[slot], sizeof(p));
+        }
+
+        // Writes every tunable of the given chip, e.g. after it has
+        // been reset.
+        void write_all(Target t, uint8_t addr) const {
+            for (uint8_t i = 0; i < NUM_TUNABLES; ++i)
+                if (TUNABLES[i].target == t)
+                    I2C_WRITE(addr, TUNABLES[i].reg, values[i]);
+        }
+
+        // Moves from the currently applied registers to those of the
+        // given preset (nullptr for the base init), writing only the
+        // registers whose value changes.
+        void apply(const Preset *p, uint8_t slot,
+                uint8_t dec_addr, uint8_t enc_addr) {
+            overrides = 0x00;
+            for (uint8_t i = 0; i < NUM_TUNABLES; ++i) {
+                uint8_t v = bases[i];
+                if (overrides_idx(p, i, v))
+                    overrides |= 1u << i;
+                if (v == values[i])
+                    continue;
+                I2C_WRITE(address_of(TUNABLES[i].target, dec_addr, enc_addr),
+                    TUNABLES[i].reg, v);
+                values[i] = v;
+            }
+            active = p ? slot : NO_PRESET;
+        }
+
+        // Replaces the base value of a tunable, e.g. with a per-standard
+        // default. Written only if the active preset does not override
+        // it and the value changes.
+        void set_base(TunableIdx idx, uint8_t v,
+                uint8_t dec_addr, uint8_t enc_addr) {
+            bases[idx] = v;
+            if ((overrides & (1u << idx)) || values[idx] == v)
+                return;
+            I2C_WRITE(address_of(TUNABLES[idx].target, dec_addr, enc_addr),
+                TUNABLES[idx].reg, v);
+            values[idx] = v;
+        }
+
+        // Records a register written behind the presets' back, e.g. over
+        // the control protocol, so that capture() includes it.
+        void note_write(Target t, uint8_t reg, uint8_t v) {
+            for (uint8_t i = 0; i < NUM_TUNABLES; ++i)
+                if (TUNABLES[i].target == t && TUNABLES[i].reg == reg) {
+                    values[i] = v;
+                    overrides |= 1u << i;
+                }
+        }
+
+        // Fills in the register part of a preset from the currently
+        // applied values.
+        void capture(Preset &p) const {
+            p.n_deltas = 0;
+            for (uint8_t i = 0; i < NUM_TUNABLES; ++i) {
+                if (!(overrides & (1u << i)) && values[i] == bases[i])
+                    continue;
+                if (p.n_deltas == MAX_DELTAS)
+                    break;
+                p.deltas[p.n_deltas].idx = i;
+                p.deltas[p.n_deltas].value = values[i];
+                ++p.n_deltas;
+            }
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_PRESETS_HH
@@ -0,0 +1,222 @@
+#ifndef KORYUU_PROTO_HH
+#define KORYUU_PROTO_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "crc32.hh"
+
+// Framed binary control protocol on the serial port, see
+// tools/koryuu_ctl.py.
+//
+// Frame: 'K' type command length(u16) payload crc32, little endian. The
+// CRC covers command, length and payload. Requests have type 'C',
+// responses type 'R' and the status as the first payload byte.
+namespace koryuu {
+    constexpr uint8_t PROTO_VERSION = 1;
+    constexpr uint8_t PROTO_REQUEST = 'C';
+    constexpr uint8_t PROTO_RESPONSE = 'R';
+    // Longest request payload, i.e. 20 writes in a batch.
+    constexpr uint8_t PROTO_MAX_PAYLOAD = 60;
+    // A request is dropped if it stalls this long, in timer ticks.
+    constexpr uint8_t PROTO_BYTE_TIMEOUT = 10;
+
+    enum ProtoCommand : uint8_t {
+        CMD_PING = 0x00,        // -> version, #maps, #vars, fw version
+        CMD_DUMP_MAP = 0x01,    // map -> map, 256 registers
+        CMD_WRITE_BATCH = 0x02, // (map, reg, value)... -> count
+        CMD_GET_VAR = 0x03,     // var -> var, value (i16)
+        CMD_SET_VAR = 0x04,     // var, value (i16) -> var, value (i16)
+        CMD_SAVE = 0x05,        // preset slot -> preset slot
+        CMD_FAULTS = 0x06,      // flags -> count, (seq, MCUSR, stage,
+                                // I2C addr, I2C args)..., newest first
+    };
+
+    // CMD_FAULTS flags.
+    constexpr uint8_t FAULTS_CLEAR = 0x01; // Clear the log after reading
+
+    enum ProtoStatus : uint8_t {
+        PS_OK = 0,
+        PS_BAD_CRC = 1,
+        PS_UNKNOWN_COMMAND = 2,
+        PS_BAD_ARGUMENT = 3,
+        PS_TOO_LONG = 4,
+    };
+
+    enum RegMap : uint8_t {
+        MAP_USER = 0,      // ADV7280A user map
+        MAP_USER2 = 1,     // ADV7280A user sub map 2
+        MAP_INTR_VDP = 2,  // ADV7280A interrupt/VDP sub map
+        MAP_0x80 = 3,      // ADV7280A sub map 0x80
+        MAP_VPP = 4,       // ADV7280A VPP map
+        MAP_ENCODER = 5,   // ADV7391
+        NUM_MAPS,
+    };
+
+    enum StateVar : uint8_t {
+        VAR_INPUT = 0,            // koryuu_settings::Input
+        VAR_MODE_IRE = 1,         // 0-5
+        VAR_NOISE_REDUCTION = 2,  // Bit 0: input, bit 1: output
+        VAR_I2P_MODE = 3,         // koryuu_settings::I2PMode
+        VAR_COMPONENT_OUTPUT = 4, // 0 or 1
+        VAR_RGB_COLOR = 5,        // 0 or 1
+        VAR_FSC_TRIM = 6,         // Encoder FSC register LSBs
+        VAR_STACK_UNUSED = 7,     // Read only: bytes the stack never used
+        VAR_STATIC_RAM = 8,       // Read only: .data + .bss bytes
+        VAR_DECODER_REPAIRS = 9,  // Read only: decoder configuration losses
+        VAR_ENCODER_REPAIRS = 10, // Read only: encoder configuration losses
+        // Read only: seconds spent in each koryuu::LockState since reset,
+        // saturating at 32767.
+        VAR_SCANNING_S = 11,
+        VAR_ACQUIRING_S = 12,
+        VAR_LOCKED_S = 13,
+        VAR_HOLDOVER_S = 14,
+        VAR_LOST_S = 15,
+        VAR_I2P_LATENCY_US = 16,  // Read only: nominal delay of the I2P mode
+        NUM_STATE_VARS,
+    };
+
+    // Collects a request frame from the received bytes.
+    class ProtoParser {
+        enum State : uint8_t {
+            WAIT_MAGIC,
+            WAIT_TYPE,
+            WAIT_COMMAND,
+            WAIT_LEN_LO,
+            WAIT_LEN_HI,
+            WAIT_PAYLOAD,
+            WAIT_CRC,
+        } st;
+        uint8_t cmd;
+        uint16_t len;
+        uint16_t pos;
+        uint32_t crc;
+        uint32_t rx_crc;
+        uint16_t last_byte;
+
+        void add_crc(uint8_t c) {
+            crc = crc::crc32(&c, 1, &crc);
+        }
+
+    public:
+        enum Result : uint8_t {
+            PARSE_NONE,  // Byte consumed, no complete frame yet
+            PARSE_BYTE,  // Byte outside a frame, e.g. a one-byte command
+            PARSE_FRAME, // Frame complete, see status()
+        };
+
+        uint8_t payload[PROTO_MAX_PAYLOAD];
+
+        ProtoParser() : st(WAIT_MAGIC), last_byte(0) {}
+
+        YAAL_INLINE("ProtoParser::command()")
+        uint8_t command() const {
+            return cmd;
+        }
+
+        YAAL_INLINE("ProtoParser::length()")
+        uint8_t length() const {
+            return len;
+        }
+
+        // Status of a complete frame: PS_OK, PS_BAD_CRC or PS_TOO_LONG.
+        ProtoStatus status() const {
+            if (len > PROTO_MAX_PAYLOAD)
+                return PS_TOO_LONG;
+            return crc == rx_crc ? PS_OK : PS_BAD_CRC;
+        }
+
+        Result feed(uint8_t c, uint16_t now) {
+            if (st != WAIT_MAGIC &&
+                    (uint16_t)(now - last_byte) > PROTO_BYTE_TIMEOUT)
+                st = WAIT_MAGIC;
+            last_byte = now;
+
+            switch (st) {
+            case WAIT_MAGIC:
+                if (c != 'K')
+                    return PARSE_BYTE;
+                st = WAIT_TYPE;
+                break;
+            case WAIT_TYPE:
+                st = c == PROTO_REQUEST ? WAIT_COMMAND : WAIT_MAGIC;
+                break;
+            case WAIT_COMMAND:
+                cmd = c;
+                crc = 0;
+                add_crc(c);
+                st = WAIT_LEN_LO;
+                break;
+            case WAIT_LEN_LO:
+                len = c;
+                add_crc(c);
+                st = WAIT_LEN_HI;
+                break;
+            case WAIT_LEN_HI:
+                len |= (uint16_t)c << 8;
+                add_crc(c);
+                pos = 0;
+                st = len ? WAIT_PAYLOAD : WAIT_CRC;
+                break;
+            case WAIT_PAYLOAD:
+                // Overlong payloads are skipped, see status().
+                if (pos < PROTO_MAX_PAYLOAD)
+                    payload[pos] = c;
+                add_crc(c);
+                if (++pos == len) {
+                    pos = 0;
+                    st = WAIT_CRC;
+                }
+                break;
+            case WAIT_CRC:
+                if (pos == 0)
+                    rx_crc = 0;
+                rx_crc |= (uint32_t)c << (8 * pos);
+                if (++pos == 4) {
+                    st = WAIT_MAGIC;
+                    return PARSE_FRAME;
+                }
+                break;
+            }
+            return PARSE_NONE;
+        }
+    };
+
+    // Writes a response frame to a sink with put(c). The payload length
+    // must be known up front; the sink must not drop bytes.
+    template<typename Sink>
+    class ProtoResponse {
+        Sink &sink;
+        uint32_t crc;
+
+    public:
+        ProtoResponse(Sink &s, uint8_t cmd, ProtoStatus status,
+                uint16_t data_len)
+            : sink(s), crc(0)
+        {
+            const uint16_t len = data_len + 1;
+            sink.put('K');
+            sink.put(PROTO_RESPONSE);
+            put_crc(cmd);
+            put_crc(len);
+            put_crc(len >> 8);
+            put_crc(status);
+        }
+
+        void put_crc(uint8_t c) {
+            crc = crc::crc32(&c, 1, &crc);
+            sink.put(c);
+        }
+
+        void put16(uint16_t v) {
+            put_crc(v);
+            put_crc(v >> 8);
+        }
+
+        void end() {
+            for (uint8_t i = 0; i < 4; ++i)
+                sink.put((uint8_t)(crc >> (8 * i)));
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_PROTO_HH
@@ -5,7 +5,7 @@
 #include <yaal/types/autounion.hh>
 
 #ifdef __YAAL__
-#include <avr/eeprom.h>
+#include "hal.hh"
 #include <string.h>
 #include "crc32.hh"
 
@@ -17,7 +17,7 @@ namespace koryuu_settings {
 
     constexpr char SETTINGS_MAGIC[8] =
         { 'K', 'R', 'Y', 'U', 'C', 'O', 'N', 'S' };
-    constexpr uint16_t CURR_VERSION = 0x0002u;
+    constexpr uint16_t CURR_VERSION = 0x0004u;
     constexpr uint16_t MIN_READ_VERSION = 0x0001u;
 
     enum Input : uint8_t {
@@ -28,26 +28,47 @@ namespace koryuu_settings {
         COMPONENT = 4,
     };
 
+    enum I2PMode : uint8_t {
+        I2P_OFF = 0,
+        I2P_LINEDOUBLE = 1,
+        I2P_DEINTERLACE = 2,
+    };
+
+    // Boot with the base init instead of a preset.
+    constexpr uint8_t NO_BOOT_PRESET = 0xffu;
+
     enum PhysInput : uint8_t {
         INPUT_CVBS = 0,
         INPUT_SVIDEO = 1,
         INPUT_COMPONENT = 2,
     };
 
-    PhysInput input_to_phys[] = {
+    using koryuu::hal::FlashTable;
+
+    constexpr FlashTable<PhysInput, COMPONENT + 1> input_to_phys
+            HAL_PROGMEM = {{
         [CVBS] = INPUT_CVBS,
         [CVBS_PEDESTAL] = INPUT_CVBS,
         [SVIDEO] = INPUT_SVIDEO,
         [SVIDEO_PEDESTAL] = INPUT_SVIDEO,
         [COMPONENT] = INPUT_COMPONENT,
-    };
+    }};
 
-    bool input_to_pedestal[] = {
+    constexpr FlashTable<Input, INPUT_COMPONENT + 1> phys_to_input
+            HAL_PROGMEM = {{
+        [INPUT_CVBS] = CVBS,
+        [INPUT_SVIDEO] = SVIDEO,
+        [INPUT_COMPONENT] = COMPONENT,
+    }};
+
+    constexpr FlashTable<bool, COMPONENT + 1> input_to_pedestal
+            HAL_PROGMEM = {{
         [CVBS] = false,
         [CVBS_PEDESTAL] = true,
         [SVIDEO] = false,
         [SVIDEO_PEDESTAL] = true,
-    };
+        [COMPONENT] = false,
+    }};
 
     // The layout of this struct must not change!
     struct SettingsHeader {
@@ -65,10 +86,11 @@ namespace koryuu_settings {
         Input default_input;
         uint8_t smoothing;
         uint8_t disable_free_run;
-        uint8_t padding;
+        I2PMode i2p_mode; // Padding before version 3
+        uint8_t boot_preset; // Since version 4
         uint32_t checksum;
     } __attribute__((packed));
-    static_assert(sizeof(ConvSettings) == 28, "ConvSettings size is wrong!");
+    static_assert(sizeof(ConvSettings) == 29, "ConvSettings size is wrong!");
 
     class KoryuuSettings {
     public:
@@ -82,12 +104,13 @@ namespace koryuu_settings {
         KoryuuSettings(/* EEMEM */ ConvSettings *const eep_s)
                 : eeprom_settings(eep_s), dirty(false), downgrade(false)
         {
-            static autounion<ConvSettings, true, 2 * sizeof(ConvSettings)> s_u;
+            // On the stack: only needed while the constructor runs.
+            autounion<ConvSettings, true, 2 * sizeof(ConvSettings)> s_u;
             SettingsHeader &tmp_hdr = settings.hdr;
             static constexpr size_t def_checksum_ofs =
                 offsetof(typeof_(settings), checksum);
             bool valid = true;
-            eeprom_read_block(&tmp_hdr, eep_s, sizeof(tmp_hdr));
+            koryuu::hal::eeprom_read(&tmp_hdr, eep_s, sizeof(tmp_hdr));
             for (uint8_t i = 0; i < sizeof(SETTINGS_MAGIC); ++i)
                 if (tmp_hdr.magic[i] != SETTINGS_MAGIC[i]) {
                     valid = false;
@@ -124,7 +147,7 @@ namespace koryuu_settings {
                 if (tmp_hdr.length > 2 * sizeof(ConvSettings))
                     valid = false;
                 else
-                    eeprom_read_block(&s_u[0], eep_s, tmp_hdr.length);
+                    koryuu::hal::eeprom_read(&s_u[0], eep_s, tmp_hdr.length);
 
                 if (valid && tmp_hdr.length == sizeof(ConvSettings)) {
                     settings = s_u.value();
@@ -168,10 +191,16 @@ namespace koryuu_settings {
                 settings.default_input = CVBS;
                 settings.smoothing = 0x00u;
                 settings.disable_free_run = 0x00u;
-                settings.padding = 0x00u;
+                settings.i2p_mode = I2P_OFF;
+                settings.boot_preset = NO_BOOT_PRESET;
                 dirty = true;
             }
             else {
+                // Sliced from an older layout, the checksum is there.
+                if (settings.hdr.version < 0x0004u) {
+                    settings.boot_preset = NO_BOOT_PRESET;
+                    dirty = true;
+                }
                 // Validate known fields.
                 if (settings.default_input > SVIDEO_PEDESTAL) {
                     settings.default_input = CVBS;
@@ -185,8 +214,8 @@ namespace koryuu_settings {
                     settings.disable_free_run = 0x00u;
                     dirty = true;
                 }
-                if (settings.padding != 0x00u) {
-                    settings.padding = 0x00u;
+                if (settings.i2p_mode > I2P_DEINTERLACE) {
+                    settings.i2p_mode = I2P_OFF;
                     dirty = true;
                 }
             }
@@ -218,7 +247,7 @@ namespace koryuu_settings {
                 settings.checksum =
                     crc::crc32(&settings,
                         offsetof(typeof_(settings), checksum));
-                eeprom_update_block(&settings,
+                koryuu::hal::eeprom_update(&settings,
                     eeprom_settings, sizeof(settings));
                 dirty = false;
                 downgrade = false;
@@ -0,0 +1,162 @@
+#ifndef KORYUU_LED_ENGINE_HH
+#define KORYUU_LED_ENGINE_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+
+// LED patterns played from the LED timer interrupt (hal::LED_TICK_US):
+// blink groups and soft PWM brightness, whatever the main loop does.
+// The main loop only says which pattern each LED shows. While every LED
+// is steady fully on or off, the pins are set directly and the timer is
+// stopped.
+namespace koryuu {
+    // Soft PWM steps; a PWM period is this many interrupts.
+    constexpr uint8_t LED_LEVELS = 4;
+    // Pattern times are in steps of this many PWM periods.
+    constexpr uint8_t LED_PERIODS_PER_STEP = 2;
+    constexpr uint16_t LED_STEP_US =
+        hal::LED_TICK_US * LED_LEVELS * LED_PERIODS_PER_STEP;
+
+    // A group of blinks followed by a pause, repeated.
+    struct LedPattern {
+        uint8_t count; // Blinks per group, 0: steady at level
+        uint8_t on;    // Steps lit per blink
+        uint8_t off;   // Steps dark between the blinks
+        uint8_t pause; // Steps dark after the group
+        uint8_t level; // Brightness lit, 0 to LED_LEVELS
+        uint8_t base;  // Brightness dark
+    };
+
+    constexpr uint8_t led_steps(uint16_t ms)
+    {
+        return ((uint32_t)ms * 1000u + LED_STEP_US / 2) / LED_STEP_US;
+    }
+
+    constexpr LedPattern led_steady(uint8_t level)
+    {
+        return { 0, 0, 0, 0, level, level };
+    }
+
+    constexpr LedPattern led_blink(uint8_t count, uint16_t on_ms,
+            uint16_t off_ms, uint16_t pause_ms, uint8_t level = LED_LEVELS,
+            uint8_t base = 0)
+    {
+        return { count, led_steps(on_ms), led_steps(off_ms),
+            led_steps(pause_ms), level, base };
+    }
+
+    constexpr bool operator==(const LedPattern &a, const LedPattern &b)
+    {
+        return a.count == b.count && a.on == b.on && a.off == b.off &&
+            a.pause == b.pause && a.level == b.level && a.base == b.base;
+    }
+
+    template<typename Pin0, typename Pin1, typename Pin2>
+    class LedEngine {
+        static constexpr uint8_t NUM_LEDS = 3;
+
+        struct Channel {
+            LedPattern pattern;
+            uint8_t level; // Current brightness
+            uint8_t left;  // Steps left in the current phase
+            uint8_t blink; // Blinks done in the group
+            bool lit;
+
+            void start() {
+                blink = 0;
+                lit = pattern.count != 0;
+                left = pattern.on;
+                level = lit ? pattern.level : pattern.base;
+            }
+
+            void step() {
+                if (!pattern.count || --left)
+                    return;
+                if (lit) {
+                    lit = false;
+                    left = ++blink < pattern.count ?
+                        pattern.off : pattern.pause;
+                }
+                else {
+                    if (blink == pattern.count)
+                        blink = 0;
+                    lit = true;
+                    left = pattern.on;
+                }
+                // A zero length phase lasts a step.
+                if (!left)
+                    left = 1;
+                level = lit ? pattern.level : pattern.base;
+            }
+
+            bool steady() const {
+                return !pattern.count &&
+                    (pattern.level == 0 || pattern.level == LED_LEVELS);
+            }
+        };
+
+        Pin0 pin0;
+        Pin1 pin1;
+        Pin2 pin2;
+        Channel ch[NUM_LEDS];
+        uint8_t slot;   // Interrupt within the PWM period
+        uint8_t period; // PWM period within the step
+        bool running;
+
+        void output(uint8_t s) {
+            pin0 = s < ch[0].level;
+            pin1 = s < ch[1].level;
+            pin2 = s < ch[2].level;
+        }
+
+    public:
+        LedEngine() : ch{}, slot(0), period(0), running(false) {}
+
+        void setup() {
+            pin0.mode = hal::OUTPUT;
+            pin1.mode = hal::OUTPUT;
+            pin2.mode = hal::OUTPUT;
+            output(0);
+        }
+
+        // Shows a pattern from its start, unless the LED already shows
+        // it. Patterns set together start in step.
+        void set(uint8_t led, const LedPattern &p) {
+            if (ch[led].pattern == p)
+                return;
+            hal::irq_disable();
+            ch[led].pattern = p;
+            ch[led].start();
+            bool animate = false;
+            for (uint8_t i = 0; i < NUM_LEDS; ++i)
+                animate |= !ch[i].steady();
+            if (animate && !running) {
+                slot = period = 0;
+                hal::led_timer_start();
+            }
+            else if (!animate && running) {
+                hal::led_timer_stop();
+            }
+            running = animate;
+            if (!running)
+                output(0);
+            hal::irq_enable();
+        }
+
+        // From the LED timer interrupt.
+        void tick() {
+            if (++slot == LED_LEVELS) {
+                slot = 0;
+                if (++period == LED_PERIODS_PER_STEP) {
+                    period = 0;
+                    for (uint8_t i = 0; i < NUM_LEDS; ++i)
+                        ch[i].step();
+                }
+            }
+            output(slot);
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_LED_ENGINE_HH
@@ -0,0 +1,124 @@
+#ifndef KORYUU_LOCK_FSM_HH
+#define KORYUU_LOCK_FSM_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+
+namespace koryuu {
+    enum LockState : uint8_t {
+        LOCK_SCANNING = 0,  // Looking for an input with a signal
+        LOCK_ACQUIRING = 1, // Input selected, waiting for a stable lock
+        LOCK_LOCKED = 2,    // Stable lock
+        LOCK_HOLDOVER = 3,  // Lock lost briefly, coasting on the config
+        LOCK_LOST = 4,      // Lock lost for longer than the hold-off
+        NUM_LOCK_STATES,
+    };
+
+    // All times are in timer ticks.
+    struct LockTimings {
+        uint16_t acquire;  // Lock needed in ACQUIRING to go LOCKED
+        uint16_t holdover; // Coasting time in HOLDOVER before LOST
+        uint16_t scan;     // No lock in ACQUIRING or LOST before SCANNING
+    };
+
+    // Signal lock state machine:
+    // SCANNING -> ACQUIRING -> LOCKED <-> HOLDOVER -> LOST -> SCANNING.
+    // Time stamps are wrapping 16-bit tick counts, so no single interval
+    // may exceed 65535 ticks. The totals per state are kept up to date
+    // by account(), called more often than that.
+    class LockFsm {
+        const LockTimings &timings;
+        LockState st;
+        uint16_t entered;
+        uint16_t counted; // Up to here the stay is in total[st]
+        uint16_t locked_since;
+        bool was_locked;
+        uint32_t total[NUM_LOCK_STATES];
+
+        void enter(LockState s, uint16_t now) {
+            account(now);
+            st = s;
+            entered = now;
+        }
+
+    public:
+        LockFsm(const LockTimings &t)
+            : timings(t), st(LOCK_ACQUIRING), entered(0), counted(0),
+              locked_since(0), was_locked(false), total()
+        {}
+
+        YAAL_INLINE("LockFsm::state()")
+        LockState state() const {
+            return st;
+        }
+
+        YAAL_INLINE("LockFsm::time_in_state()")
+        uint16_t time_in_state(uint16_t now) const {
+            return now - entered;
+        }
+
+        // Adds the current stay so far to the total of the state, which
+        // keeps stays longer than 65535 ticks counted.
+        void account(uint16_t now) {
+            total[st] += (uint16_t)(now - counted);
+            counted = now;
+        }
+
+        // Total ticks spent in a state since reset, the current stay
+        // included.
+        uint32_t total_time(LockState s, uint16_t now) const {
+            return total[s] + (s == st ? (uint16_t)(now - counted) : 0);
+        }
+
+        // A new input has been selected.
+        void restart(uint16_t now) {
+            enter(LOCK_ACQUIRING, now);
+            was_locked = false;
+        }
+
+        // Feeds in the lock status. Returns true if the state changed.
+        bool update(bool locked, uint16_t now) {
+            const LockState prev = st;
+            if (locked && !was_locked)
+                locked_since = now;
+            was_locked = locked;
+
+            switch (st) {
+            case LOCK_SCANNING:
+                if (locked)
+                    enter(LOCK_ACQUIRING, now);
+                break;
+            case LOCK_ACQUIRING:
+                if (locked) {
+                    if ((uint16_t)(now - locked_since) >= timings.acquire)
+                        enter(LOCK_LOCKED, now);
+                }
+                else if (time_in_state(now) >= timings.scan) {
+                    enter(LOCK_SCANNING, now);
+                }
+                break;
+            case LOCK_LOCKED:
+                if (!locked)
+                    enter(LOCK_HOLDOVER, now);
+                break;
+            case LOCK_HOLDOVER:
+                if (locked)
+                    enter(LOCK_LOCKED, now);
+                else if (time_in_state(now) >= timings.holdover)
+                    enter(LOCK_LOST, now);
+                break;
+            case LOCK_LOST:
+                if (locked)
+                    enter(LOCK_ACQUIRING, now);
+                else if (time_in_state(now) >= timings.scan)
+                    enter(LOCK_SCANNING, now);
+                break;
+            default:
+                break;
+            }
+            return st != prev;
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_LOCK_FSM_HH
@@ -1,21 +1,23 @@
 #include <yaal/requirements.hh>
 
 #ifdef __YAAL__
-#include <yaal/io/ports.hh>
-#include <yaal/io/serial.hh>
-#include <yaal/communication/i2c_hw.hh>
-
-#include <avr/eeprom.h>
-#include <util/delay.h>
-
+#include "hal.hh"
 #include "adv7280.hh"
 #include "adv7391.hh"
 #include "i2c_helpers.hh"
 #include "crc32.hh"
 #include "debounce.hh"
+#include "event_queue.hh"
+#include "gesture.hh"
+#include "led_engine.hh"
 #include "koryuu_settings.hh"
+#include "koryuu_presets.hh"
+#include "lock_fsm.hh"
+#include "idle_policy.hh"
+#include "video_standards.hh"
 
-_T_DECL(FW_VERSION, "1.1");
+#define FW_VERSION_STR "1.1"
+_T_DECL(FW_VERSION, FW_VERSION_STR);
 __attribute__((used))
 static const auto& FW_VERSION = _T_REF(FW_VERSION);
 
@@ -25,6 +27,9 @@ static const auto& FW_VERSION = _T_REF(FW_VERSION);
 #ifndef CALIBRATE
     #define CALIBRATE 0
 #endif
+#if CALIBRATE && defined(KORYUU_HOST)
+    #error "Calibration tunes the RC oscillator, there is none on the host"
+#endif
 #ifndef ENC_TEST_PATTERN
     #define ENC_TEST_PATTERN 0
 #endif
@@ -37,6 +42,69 @@ static const auto& FW_VERSION = _T_REF(FW_VERSION);
 #ifndef DEC_TEST_PATTERN
     #define DEC_TEST_PATTERN 1
 #endif
+#ifndef TELEMETRY
+    #define TELEMETRY 1
+#endif
+#ifndef CONTROL
+    // Binary control protocol on the serial port, see koryuu_proto.hh.
+    #define CONTROL 1
+#endif
+#ifndef LOGGING
+    // Tokenized log records on the serial port, see log_messages.def.
+    #define LOGGING 1
+#endif
+#ifndef LOCK_ACQUIRE_MS
+    // Lock needed before a newly selected input counts as locked.
+    #define LOCK_ACQUIRE_MS 100
+#endif
+#ifndef LOCK_HOLDOVER_MS
+    // Dropouts shorter than this coast on the current configuration.
+    #define LOCK_HOLDOVER_MS 1000
+#endif
+#ifndef LOCK_SCAN_MS
+    // Time without lock after the hold-off before scanning the inputs.
+    #define LOCK_SCAN_MS 1000
+#endif
+#ifndef IDLE_TIMEOUT_S
+    // Time without lock before the decoder is powered down and the
+    // encoder put to sleep, at most 65535. 0: never.
+    #define IDLE_TIMEOUT_S 300
+#endif
+#ifndef IDLE_PROBE_MS
+    // Period of the signal probes while asleep; bounds the time from
+    // a returning signal to picture, with the lock time.
+    #define IDLE_PROBE_MS 1000
+#endif
+#ifndef UART_TX_BUF
+    // Serial transmit ring size, a power of two.
+    #define UART_TX_BUF 64
+#endif
+#ifndef UART_TX_BLOCK
+    // 0: drop serial output that does not fit into the transmit ring,
+    // 1: wait for room. Telemetry frames always wait.
+    #define UART_TX_BLOCK CALIBRATE
+#endif
+#ifndef WATCHDOG
+    // Watchdog supervision from reset on, with checkpoints and a fault
+    // log in the EEPROM, see supervisor.hh. The calibration output takes
+    // longer than the timeout.
+    #define WATCHDOG !CALIBRATE
+#endif
+#ifndef SCRUB_PERIOD_MS
+    // Period of the critical register read back, one register at a
+    // time, see scrubber.hh. 0: no scrubbing.
+    #define SCRUB_PERIOD_MS 100
+#endif
+#ifndef PROFILE
+    // Section markers in GPIOR0 for the simavr cycle benchmark, see
+    // profile.hh.
+    #define PROFILE 0
+#endif
+#ifndef FSC_TRIM
+    // Subcarrier fine trim, in units of the encoder FSC register LSB
+    // (about 6.3 mHz).
+    #define FSC_TRIM 0
+#endif
 
 // There is no sense in enabling autoreset if panic is disabled
 #if ERROR_PANIC == 0
@@ -44,14 +112,53 @@ static const auto& FW_VERSION = _T_REF(FW_VERSION);
     #define AUTORESET 0
 #endif
 
-#if AUTORESET
-#include <avr/wdt.h>
+// Debug builds log more, including the messages that cost extra I2C
+// reads.
+#if DEBUG
+    #undef LOGGING
+    #define LOGGING 1
 #endif
 
-using namespace yaal;
+#define HAVE_SERIAL (CALIBRATE || TELEMETRY || LOGGING || CONTROL)
+#if HAVE_SERIAL
+#include "uart.hh"
+#endif
+#if LOGGING
+#include "koryuu_log.hh"
+#endif
+#if CONTROL
+#include "koryuu_proto.hh"
+#endif
+#if TELEMETRY
+#include "telemetry.hh"
+#endif
+#if PROFILE
+#include "profile.hh"
+#define PROFILE_SCOPE(s) koryuu::ProfileScope profile_scope(koryuu::s)
+#define PROFILE_BEGIN(s) koryuu::profile_begin(koryuu::s)
+#define PROFILE_END(s) koryuu::profile_end(koryuu::s)
+#else
+#define PROFILE_SCOPE(s) do {} while (0)
+#define PROFILE_BEGIN(s) do {} while (0)
+#define PROFILE_END(s) do {} while (0)
+#endif
+#if SCRUB_PERIOD_MS
+#include "scrubber.hh"
+#endif
+#if WATCHDOG
+#include "supervisor.hh"
+#define CHECKPOINT(s) koryuu::checkpoint_set(koryuu::s)
+#define CHECKPOINT_SCOPE(s) koryuu::CheckpointScope checkpoint_scope(koryuu::s)
+#else
+#define CHECKPOINT(s) do {} while (0)
+#define CHECKPOINT_SCOPE(s) do {} while (0)
+#endif
+
+using namespace koryuu::hal;
 using namespace ad_decoder;
 using namespace ad_encoder;
 using namespace i2c_helpers;
+using namespace video_standards;
 
 ADV7280A<PortD2, PortD6, PortC2> decoder(0x20);
 ADV7391<PortD7> encoder(0x2a);
@@ -59,12 +166,43 @@ ADV7391<PortD7> encoder(0x2a);
 PortC4 sda;
 PortC5 scl;
 
-PortB1 led_CVBS;
-PortB2 led_YC;
-PortB6 led_OPT;
+enum : uint8_t {
+    LED_CVBS = 0,
+    LED_YC = 1,
+    LED_OPT = 2,
+};
+static koryuu::LedEngine<PortB1, PortB2, PortB6> leds;
+using koryuu::LED_LEVELS;
+using koryuu::led_steady;
+using koryuu::led_blink;
+
+// Plays the LED patterns (every 2 ms while one is animated)
+HAL_ISR(TIMER2_COMPA_vect)
+{
+    leds.tick();
+}
 
-#if DEBUG
-Serial0 serial;
+#if HAVE_SERIAL
+using koryuu::dec;
+using koryuu::hex;
+static koryuu::Uart<UART_TX_BUF,
+    UART_TX_BLOCK ? koryuu::TX_BLOCK : koryuu::TX_DROP> serial;
+
+HAL_ISR(USART_UDRE_vect)
+{
+    PROFILE_SCOPE(PROF_UDRE_ISR);
+    serial.udre_isr();
+}
+
+HAL_ISR(USART_RX_vect)
+{
+    PROFILE_SCOPE(PROF_RX_ISR);
+    serial.rx_isr();
+}
+#endif
+
+#if LOGGING
+#define LOG(id, ...) koryuu::log<koryuu::id>(serial, ##__VA_ARGS__)
 #endif
 
 enum : uint8_t {
@@ -83,7 +221,61 @@ Input curr_input;
 
 using koryuu_settings::ConvSettings;
 using koryuu_settings::KoryuuSettings;
-static EEMEM ConvSettings eeprom_settings;
+static HAL_EEMEM ConvSettings eeprom_settings;
+
+using koryuu_presets::Preset;
+using koryuu_presets::Presets;
+using koryuu_presets::NUM_PRESETS;
+using koryuu_presets::PRESET_MAGIC;
+using koryuu_presets::PRESET_FLAG_COMPONENT_OUT;
+using koryuu_presets::PRESET_FLAG_RGB_COLOR;
+using koryuu_presets::TARGET_DECODER;
+using koryuu_presets::TUN_ENC_OUTPUT_LEVEL;
+using koryuu_presets::TUN_NTSC_COMB;
+using koryuu_presets::TUN_PAL_COMB;
+using koryuu_presets::TUN_COMB_FILTER;
+using koryuu_presets::TUNABLES;
+
+// Precompiled presets, shipped in the .eep image.
+static HAL_EEMEM Preset eeprom_presets[NUM_PRESETS] = {
+    { PRESET_MAGIC, { 'L', 'D', ' ', ' ', ' ', ' ', ' ', ' ' },
+        0, 1, PRESET_FLAG_COMPONENT_OUT | PRESET_FLAG_RGB_COLOR, 0, {} },
+    { PRESET_MAGIC, { 'V', 'C', 'R', ' ', ' ', ' ', ' ', ' ' },
+        0, 3, PRESET_FLAG_COMPONENT_OUT | PRESET_FLAG_RGB_COLOR, 2,
+        { { TUN_NTSC_COMB, COMB_NOTCH }, { TUN_PAL_COMB, COMB_NOTCH } } },
+    { PRESET_MAGIC, { 'C', 'O', 'N', 'S', 'O', 'L', 'E', ' ' },
+        0, 0, PRESET_FLAG_COMPONENT_OUT | PRESET_FLAG_RGB_COLOR, 3,
+        { { TUN_NTSC_COMB, COMB_NOTCH }, { TUN_PAL_COMB, COMB_NOTCH },
+          { TUN_COMB_FILTER, 0xf5 } } },
+    { PRESET_MAGIC, { 'B', 'A', 'S', 'E', ' ', ' ', ' ', ' ' },
+        0, 0, PRESET_FLAG_COMPONENT_OUT | PRESET_FLAG_RGB_COLOR, 0, {} },
+};
+static Presets presets(eeprom_presets);
+
+#if WATCHDOG
+static HAL_EEMEM koryuu::FaultRecord eeprom_faults[koryuu::FAULT_RING_LEN];
+static koryuu::FaultLog fault_log(eeprom_faults);
+
+// Records a reset by the watchdog or a brown-out; power-on and the
+// reset pin are not faults.
+static void record_fault(const koryuu::FaultRecord &r)
+{
+    using namespace koryuu;
+    if (!(r.mcusr & (RESET_WATCHDOG | RESET_BROWN_OUT)))
+        return;
+#if LOGGING
+    LOG(LOG_FAULT_RECORDED, r.mcusr, r.stage, r.i2c_addr, r.i2c_args);
+#endif
+    fault_log.record(r);
+}
+#endif
+
+// Used for empty slots: the state the firmware boots with.
+static constexpr Preset base_preset = {
+    PRESET_MAGIC, { 'B', 'A', 'S', 'E', ' ', ' ', ' ', ' ' },
+    0, 0, PRESET_FLAG_COMPONENT_OUT | PRESET_FLAG_RGB_COLOR, 0, {}
+};
+
 static bool apply_output_settings(bool disable_outputs_on_freerun,
         bool apply_decoder, bool apply_encoder);
 
@@ -91,41 +283,48 @@ static bool apply_output_settings(bool disable_outputs_on_freerun,
 __attribute__((noreturn))
 static void i2c_err_func(uint8_t addr, uint8_t arg_count)
 {
-#if DEBUG
-        serial << _T("I2C write of size ") << asdec(arg_count)
-               << _T(" to addr 0x") << ashex(addr) << _T(" FAILED!\r\n");
+#if LOGGING
+        LOG(LOG_I2C_WRITE_FAILED, arg_count, addr);
 #else
         (void)addr;
         (void)arg_count;
 #endif
 
+#if WATCHDOG
+        // The stage the failed write happened in.
+        koryuu::checkpoint_set(
+            koryuu::checkpoint_stage() | koryuu::STAGE_PANIC);
+#endif
 #if AUTORESET
-        wdt_enable(WDTO_4S);
+        watchdog_enable_4s();
+#elif WATCHDOG
+        watchdog_off();
 #endif
 
-        led_CVBS = true;
-        led_YC = true;
-        led_OPT = true;
+        // The input LEDs blink together, the option LED blinks once for
+        // the decoder, twice for the encoder.
+        leds.set(LED_CVBS, led_blink(1, 500, 0, 500));
+        leds.set(LED_YC, led_blink(1, 500, 0, 500));
+        leds.set(LED_OPT, led_blink(addr == decoder.address ? 1 : 2,
+            250, 250, 1000));
         decoder.reset = false;
         decoder.pwrdwn = false;
         encoder.reset = false;
-        while (true) {
-            _delay_ms(500);
-            led_CVBS = !led_CVBS;
-            led_YC = !led_YC;
-            led_OPT = !led_OPT;
-        }
+        while (true)
+            cpu_sleep();
 }
 #endif
 
-bool pedestal_enabled = false;
 bool component_output = true;
 bool component_input = true;
 bool rgb_color = true;
 bool chroma_enabled = true;
+using koryuu_settings::I2PMode;
+using koryuu_settings::I2PMode::I2P_OFF;
+using koryuu_settings::I2PMode::I2P_LINEDOUBLE;
+using koryuu_settings::I2PMode::I2P_DEINTERLACE;
+I2PMode i2p_mode = I2P_OFF;
 int mode_ire = 0;
-int led_timer1 = 0;
-int input_timer = 0;
 int noise_reduction = 0;
 
 enum : uint8_t {
@@ -140,33 +339,207 @@ bool disable_freerun = false;
 constexpr bool disable_freerun = true;
 #endif
 
-koryuu::DebouncedButton<PortD5> input_change;
-koryuu::DebouncedButton<PortB7> option;
+constexpr uint8_t LANE_INPUT = koryuu::LANE_D + 5;
+constexpr uint8_t LANE_OPTION = koryuu::LANE_B + 7;
+using Buttons = koryuu::ButtonBank<1u << LANE_INPUT | 1u << LANE_OPTION>;
+static Buttons buttons;
+static koryuu::DebouncedButton<Buttons, PortD5, LANE_INPUT>
+    input_change(buttons);
+static koryuu::DebouncedButton<Buttons, PortB7, LANE_OPTION>
+    option(buttons);
+
+// Timer 0 ticks, the time base of the main loop.
+static volatile uint16_t ticks = 0;
+
+// From the interrupts to the main loop.
+static koryuu::EventQueue<8> events;
+// Tick the decoder interrupts were last cleared.
+static uint16_t intrq_cleared = 0;
+
+constexpr uint16_t ms_to_ticks(uint16_t ms)
+{
+    return (uint32_t)ms * 1000u / TICK_US;
+}
+
+// Without masking the interrupts: the tick interrupt may change the
+// counter between the two byte loads, so read until two reads agree.
+static uint16_t now_ticks()
+{
+    uint16_t t;
+    do {
+        t = ticks;
+    } while (t != ticks);
+    return t;
+}
+
+using koryuu::GESTURE_NONE;
+using koryuu::GESTURE_INPUT;
+using koryuu::GESTURE_OPTION;
+using koryuu::GESTURE_PRESS;
+using koryuu::GESTURE_DOUBLE_PRESS;
+using koryuu::GESTURE_LONG_PRESS;
+using koryuu::GESTURE_CHORD;
+static const koryuu::GestureTimings gesture_timings = {
+    ms_to_ticks(200),  // Chord: both pressed within
+    ms_to_ticks(300),  // Double press: pressed again within
+    ms_to_ticks(1500), // Long press: held for
+};
+static koryuu::GestureRecognizer<decltype(events)>
+    gestures(gesture_timings, events);
+
+// ISR to run debouncing and gesture recognition every tick (5.12 ms)
+HAL_ISR(TIMER0_COMPA_vect)
+{
+    PROFILE_SCOPE(PROF_TICK_ISR);
+    ++ticks;
+    uint16_t changed = buttons.debounce(ticks);
+    for (uint8_t lane = 0; changed; ++lane, changed >>= 1) {
+        if (changed & 1)
+            events.post(koryuu::EVENT_BUTTON, lane |
+                ((buttons.held() >> lane) & 1 ? koryuu::BUTTON_DOWN : 0),
+                ticks);
+    }
+    gestures.update(input_change, option, ticks);
+}
+
+// The decoder requests an interrupt
+HAL_ISR(INT0_vect)
+{
+    events.post(koryuu::EVENT_INTRQ, 0, ticks);
+}
+
+#if TELEMETRY
+static koryuu::Telemetry telemetry(TICK_US);
+#endif
+// Sampling period of status 2 (and 3) for the telemetry and the comb
+// mode hysteresis.
+constexpr uint16_t STATUS_SAMPLE_TICKS = ms_to_ticks(100);
+
+int16_t fsc_trim = FSC_TRIM;
 
-// ISR to run debouncing every 10 ms
-ISR(TIMER0_COMPA_vect)
+// The standard the encoder and comb filters are currently tuned for.
+// Reset to VSTD_UNKNOWN when the chips are reset.
+static uint8_t tuned_vstd = VSTD_UNKNOWN;
+
+static void write_output_format()
 {
-    input_change.debounce();
-    option.debounce();
+    if (component_output)
+        I2C_WRITE(encoder.address, 0x82, 0xC0);
+    else
+        I2C_WRITE(encoder.address, 0x82, 0xC2);//0xCB for pedestal(+7.5)  sinon 0xC3
 }
 
-static void setup_timer0()
+// Comb filtering follows the signal: nonstandard line length or fSC
+// (consoles, laserdisc) switches to notch filtering, which avoids dot
+// crawl and slow lock there. Both directions have a hold time.
+enum CombMode : uint8_t {
+    COMB_MODE_ADAPTIVE = 0,
+    COMB_MODE_NOTCH = 1,
+};
+static CombMode comb_mode = COMB_MODE_ADAPTIVE;
+static bool comb_pending = false;
+static uint16_t comb_pending_since = 0;
+// How often each mode was entered.
+static uint16_t comb_mode_entries[2] = { 0, 0 };
+constexpr uint16_t COMB_NOTCH_TICKS = ms_to_ticks(300);
+constexpr uint16_t COMB_ADAPTIVE_TICKS = ms_to_ticks(2000);
+
+// Sets the comb filter bases for the comb mode and tuned standard.
+// A preset overriding them still wins.
+static void apply_comb_bases()
 {
-    // CTC mode, prescaler 1024, target frequency 100 Hz
-    TCCR0A = _BV(WGM01);
-    TCCR0B = _BV(CS00) | _BV(CS02);
-    OCR0A = 4;
+    uint8_t ntsc = TUNABLES[TUN_NTSC_COMB].base;
+    uint8_t pal = TUNABLES[TUN_PAL_COMB].base;
+    if (comb_mode == COMB_MODE_NOTCH) {
+        ntsc = pal = COMB_NOTCH;
+    }
+    else if (tuned_vstd < NUM_VSTD && STANDARD_TUNING[tuned_vstd].has_comb) {
+        const StandardTuning &t = STANDARD_TUNING[tuned_vstd];
+        (t.comb_is_pal ? pal : ntsc) = t.comb;
+    }
+    presets.set_base(TUN_NTSC_COMB, ntsc, decoder.address, encoder.address);
+    presets.set_base(TUN_PAL_COMB, pal, decoder.address, encoder.address);
+}
 
-    // Generate an interrupt on compare match
-    TIMSK0 = _BV(OCIE0A);
+// Feeds in status 2 while locked, every STATUS_SAMPLE_TICKS.
+static void update_comb_mode(uint8_t status2, uint16_t now)
+{
+    // Line length nonstandard or fSC nonstandard
+    const CombMode want = (status2 & 0x30) ?
+        COMB_MODE_NOTCH : COMB_MODE_ADAPTIVE;
+    if (want == comb_mode) {
+        comb_pending = false;
+        return;
+    }
+    if (!comb_pending) {
+        comb_pending = true;
+        comb_pending_since = now;
+        return;
+    }
+    if ((uint16_t)(now - comb_pending_since) <
+        (want == COMB_MODE_NOTCH ? COMB_NOTCH_TICKS : COMB_ADAPTIVE_TICKS))
+    {
+        return;
+    }
+
+    comb_mode = want;
+    comb_pending = false;
+    ++comb_mode_entries[want];
+    apply_comb_bases();
+#if LOGGING
+    LOG(LOG_COMB_MODE, want, comb_mode_entries[want]);
+#endif
+}
+
+// Tunes the encoder and comb filters for a video standard, writing only
+// what differs from the standard tuned for before.
+static void apply_standard_tuning(uint8_t vstd)
+{
+    if (vstd >= NUM_VSTD || vstd == tuned_vstd)
+        return;
+
+    const StandardTuning &n = STANDARD_TUNING[vstd];
+    const bool all = tuned_vstd >= NUM_VSTD;
+    const StandardTuning &o = STANDARD_TUNING[all ? vstd : tuned_vstd];
+    tuned_vstd = vstd;
+
+    if (all || n.enc_mode != o.enc_mode)
+        I2C_WRITE(encoder.address, 0x80, n.enc_mode);
+    if (all || n.fsc != o.fsc) {
+        // One burst, the encoder auto-increments the subaddress.
+        const uint32_t fsc = n.fsc + fsc_trim;
+        I2C_WRITE(encoder.address, 0x8c, (uint8_t)fsc, (uint8_t)(fsc >> 8),
+            (uint8_t)(fsc >> 16), (uint8_t)(fsc >> 24));
+    }
+    apply_comb_bases();
+}
+
+static void write_color_space()
+{
+    if (rgb_color)
+        I2C_WRITE(encoder.address, 0x02, 0x54);
+    else
+        I2C_WRITE(encoder.address, 0x02, 0x74);
+}
+
+// Bit 0: decoder input DNR, bit 1: encoder output DNR.
+static void write_noise_reduction(bool apply_decoder, bool apply_encoder)
+{
+    if (apply_decoder)
+        I2C_WRITE(decoder.address, 0x4d, (noise_reduction & 1) ? 0xEF : 0xCF);
+    if (apply_encoder)
+        // SD progressive mode off + double buffering 8bit input + dnr
+        I2C_WRITE(encoder.address, 0x88, (noise_reduction & 2) ? 0x24 : 0x04);
 }
 
 static void setup_encoder(bool reset = false)
 {
+    PROFILE_SCOPE(PROF_SETUP_ENCODER);
+    CHECKPOINT_SCOPE(STAGE_RECONFIG);
     if (reset) {
         // Software reset. Ignore the I2C transaction failure.
         I2C_WRITE<false>(encoder.address, 0x17, 0x07);
-        _delay_ms(1);
+        delay_ms(1);
     }
 
     if (apply_output_settings(!DEC_TEST_PATTERN || disable_freerun,
@@ -205,9 +578,9 @@ static void setup_encoder(bool reset = false)
     //I2C_WRITE(encoder.address, 0x87, 0x20);
 
    // if (interlace_status == INTERLACE_STATUS_INTERLACED) {
-        // Disable SD progressive mode + double buffering 8bit input + dnr off
-        I2C_WRITE(encoder.address, 0x88, 0x04);
-        noise_reduction = 0;
+        // Disable SD progressive mode + double buffering 8bit input,
+        // keep the selected output DNR
+        write_noise_reduction(false, true);
    // }
    // else {
        // Enable SD progressive mode + double buffering
@@ -227,47 +600,29 @@ static void setup_encoder(bool reset = false)
     //I2C_WRITE(encoder.address, 0x02, 0x30);
 	//I2C_WRITE(encoder.address, 0x82, 0x02);
 	//I2C_WRITE(encoder.address, 0x84, 0x80);
-    const uint8_t input_status = I2C_READ_ONE(decoder.address, 0x13);
-    
 	I2C_WRITE(encoder.address, 0x00, 0x1C);//enable dac 1,2,3
-	I2C_WRITE(encoder.address, 0x01, 0x00);//sd input
-    //I2C_WRITE(encoder.address, 0x02, 0x20);
-    //I2C_WRITE(encoder.address, 0x87, 0x1F);//disable autodetect standard (plus rien en sortie pour le moment)
-    
-    if(input_status & 0x04 ?true:false)
-    {
-        I2C_WRITE(encoder.address, 0x80, 0x71);//0x11 for pal + 2mhz filter
-    }
-    else
-    {
-        I2C_WRITE(encoder.address, 0x80, 0x72);//0x12 for pal M + 2mhz filter
-    }
-    if(component_output)
-    {
-        I2C_WRITE(encoder.address, 0x82, 0xC0);
-		
-    }
-    else
-    {
-        I2C_WRITE(encoder.address, 0x82, 0xC2);//0xCB for pedestal(+7.5)  sinon 0xC3
-        
-    }
-	
-	if(rgb_color)
-	{
-		I2C_WRITE(encoder.address, 0x02, 0x54);
+	if (i2p_mode == I2P_OFF) {
+		I2C_WRITE(encoder.address, 0x01, 0x00);//sd input
 	}
-	else
-	{
-		I2C_WRITE(encoder.address, 0x02, 0x74);
+	else {
+		// ED input, progressive from the decoder I2P core
+		I2C_WRITE(encoder.address, 0x01, 0x10);
+		// ED standard: ITU-R BT.1358 625p or SMPTE 293M 525p
+		I2C_WRITE(encoder.address, 0x30,
+			(I2C_READ_ONE(decoder.address, 0x13) & 0x04) ? 0x10 : 0x00);
 	}
-	
-    I2C_WRITE(encoder.address, 0x83, 0x76);//closedcaptioning + output voltage level
-    
-	I2C_WRITE(encoder.address, 0x8C, 0xCB);
-	I2C_WRITE(encoder.address, 0x8D, 0x8A);
-	I2C_WRITE(encoder.address, 0x8E, 0x09);
-	I2C_WRITE(encoder.address, 0x8F, 0x2A);
+    //I2C_WRITE(encoder.address, 0x02, 0x20);
+    //I2C_WRITE(encoder.address, 0x87, 0x1F);//disable autodetect standard (plus rien en sortie pour le moment)
+
+    write_output_format();
+    write_color_space();
+
+    //closedcaptioning + output voltage level
+    I2C_WRITE(encoder.address, 0x83, presets.value(TUN_ENC_OUTPUT_LEVEL));
+
+    // Standard mode and subcarrier, if not yet set since the last reset.
+    apply_standard_tuning(
+        (I2C_READ_ONE(decoder.address, 0x10) >> 4u) & 0x07u);
 }
 
 static inline void setup_ad_black_magic()
@@ -289,49 +644,123 @@ static inline void setup_ad_black_magic()
     I2C_WRITE(decoder.address, 0x82, 0x68);
 }
 
-static void set_video_range(int ire_input_mode = 0,bool component_out = false,bool component_in = false)
+// The standard last locked on each physical input, and the standard
+// autodetection is currently restricted to (VSTD_UNKNOWN: full search).
+static uint8_t learned_vstd[] = { VSTD_UNKNOWN, VSTD_UNKNOWN, VSTD_UNKNOWN };
+static uint8_t narrowed_vstd = VSTD_UNKNOWN;
+
+// Time without lock before narrowed autodetection is widened back to
+// the full search. Must be below LOCK_SCAN_MS.
+constexpr uint16_t RELOCK_WIDEN_TICKS = ms_to_ticks(400);
+
+using koryuu::LockState;
+using koryuu::LockState::LOCK_SCANNING;
+using koryuu::LockState::LOCK_ACQUIRING;
+using koryuu::LockState::LOCK_LOCKED;
+using koryuu::LockState::LOCK_HOLDOVER;
+using koryuu::LockState::LOCK_LOST;
+static const koryuu::LockTimings lock_timings = {
+    ms_to_ticks(LOCK_ACQUIRE_MS),
+    ms_to_ticks(LOCK_HOLDOVER_MS),
+    ms_to_ticks(LOCK_SCAN_MS),
+};
+static koryuu::LockFsm lock_fsm(lock_timings);
+
+#if IDLE_TIMEOUT_S
+static const koryuu::IdleTimings idle_timings = {
+    IDLE_TIMEOUT_S,
+    ms_to_ticks(1000),
+    ms_to_ticks(IDLE_PROBE_MS),
+};
+static koryuu::IdlePolicy idle(idle_timings);
+#endif
+
+// Shows the state on the LEDs; called when it changes. The LED of the
+// input is lit, dimmed with the component output. The option LED is lit
+// while the color is killed, otherwise it blinks the IRE mode over a
+// dim glow while noise reduction is on. All dark while asleep.
+static void show_status()
+{
+#if IDLE_TIMEOUT_S
+    if (idle.asleep()) {
+        leds.set(LED_CVBS, led_steady(0));
+        leds.set(LED_YC, led_steady(0));
+        leds.set(LED_OPT, led_steady(0));
+        return;
+    }
+#endif
+    const uint8_t lit = component_output ? LED_LEVELS / 2 : LED_LEVELS;
+    leds.set(LED_CVBS, led_steady(curr_input != SVIDEO ? lit : 0));
+    leds.set(LED_YC, led_steady(curr_input == SVIDEO ? lit : 0));
+    const uint8_t glow = noise_reduction ? 1 : 0;
+    if (!chroma_enabled)
+        leds.set(LED_OPT, led_steady(LED_LEVELS));
+    else if (mode_ire > 0)
+        leds.set(LED_OPT,
+            led_blink(mode_ire, 150, 250, 1500, LED_LEVELS, glow));
+    else
+        leds.set(LED_OPT, led_steady(glow));
+}
+
+static void narrow_autodetection(uint8_t vstd)
+{
+    if (vstd == narrowed_vstd)
+        return;
+    narrowed_vstd = vstd;
+    // IRE modes 3 and up decode with pedestal, see set_video_range().
+    decoder.select_autodetection(autodetection_for(vstd, mode_ire >= 2));
+}
+
+static void set_video_range(int ire_input_mode = 0)
 {
 			
 		switch (ire_input_mode) {
 			case 0://mode 1    
                 I2C_WRITE(encoder.address, 0x87, 0x00);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x04);//no pedestal
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, false));//no pedestal
 				I2C_WRITE(encoder.address, 0xA1, 0x00);//brightness  control IRE 0
 				I2C_WRITE(encoder.address, 0x0B, 0x00);//Output gain 0%
 				break;
 			case 1://mode 2
                 I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x04);//no pedestal
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, false));//no pedestal
 				I2C_WRITE(encoder.address, 0xA1, 0xF9);//brightness  control IRE-3.5
 				I2C_WRITE(encoder.address, 0x0B, 0x20);//Output gain 0%
 				break;
 			case 2://mode 3
 				I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, true));//pedestal input -7.5
 				I2C_WRITE(encoder.address, 0xA1, 0x00);//brightness  control IRE 0
 				I2C_WRITE(encoder.address, 0x0B, 0x00);//Output gain 0%
 				break;
 			case 3://mode 4
                 I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, true));//pedestal input -7.5
 				I2C_WRITE(encoder.address, 0xA1, 0xF9);//brightness  control IRE-3.5
 				I2C_WRITE(encoder.address, 0x0B, 0x20);//Output gain 0%
 				break;
 			case 4://mode 5
                 I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, true));//pedestal input -7.5
 				I2C_WRITE(encoder.address, 0xA1, 0x71);//brightness  control IRE-7.5
 				I2C_WRITE(encoder.address, 0x0B, 0x40);//Output gain 7.5%
 				break;
 			case 5://mode 6
                 I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, true));//pedestal input -7.5
 				I2C_WRITE(encoder.address, 0xA1, 0xEA);//brightness  control IRE-11  (-7.5 - 3.5)
 				I2C_WRITE(encoder.address, 0x0B, 0x40);//Output gain 7.5%
 				break;
 			case 6://mode 7
                 I2C_WRITE(encoder.address, 0x87, 0x08);//sd brightness controll
-				I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
+				decoder.select_autodetection(
+					autodetection_for(narrowed_vstd, true));//pedestal input -7.5
 				I2C_WRITE(encoder.address, 0xA1, 0x62);//brightness  control IRE-15  (-7.5 * 2)
 				I2C_WRITE(encoder.address, 0x0B, 0x40);//Output gain 7.5%
 				//I2C_WRITE(decoder.address, 0x02, 0x34);//pedestal input -7.5
@@ -374,23 +803,73 @@ using koryuu_settings::PhysInput::INPUT_CVBS;
 using koryuu_settings::PhysInput::INPUT_SVIDEO;
 using koryuu_settings::PhysInput::INPUT_COMPONENT;
 using koryuu_settings::input_to_phys;
+using koryuu_settings::phys_to_input;
 using koryuu_settings::input_to_pedestal;
 
 
 
-static void setup_video(PhysInput input, bool pedestal, bool smoothing)
+static I2P_Algorithm i2p_algorithm()
 {
-    // Software reset decoder and encoder.
-    // Ignore the I2C transaction failure.
-    decoder.set_power_management(false, true);
-    I2C_WRITE<false>(encoder.address, 0x17, 0x07);
+    return i2p_mode == I2P_LINEDOUBLE ?
+        I2P_ALG_LINEDOUBLE : I2P_ALG_DEINTERLACE;
+}
 
-    // Decoder setup
+// Nominal delay the current I2P mode adds, in microseconds, 0 while off.
+static uint16_t i2p_latency()
+{
+    if (i2p_mode == I2P_OFF)
+        return 0;
+    const bool is_50hz = !!(I2C_READ_ONE(decoder.address, 0x13) & 0x04);
+    return i2p_latency_us(i2p_algorithm(), is_50hz);
+}
 
-    // Exit powerdown
-    decoder.set_power_management(false, false);
-    _delay_ms(10);
+static void apply_i2p_mode()
+{
+    decoder.deinterlace_control(i2p_mode != I2P_OFF, i2p_algorithm());
+
+#if LOGGING
+    if (i2p_mode != I2P_OFF)
+        LOG(LOG_I2P_LATENCY, i2p_latency());
+#endif
+}
+
+// Switches the I2P mode at runtime, without re-running setup_video().
+static void set_i2p_mode(I2PMode mode)
+{
+    if (mode == i2p_mode || mode > I2P_DEINTERLACE)
+        return;
+    i2p_mode = mode;
+    apply_i2p_mode();
+    decoder.deinterlace_reset();
+    setup_encoder();
+}
+
+// Next or previous IRE mode. The color space toggles when the modes
+// wrap around.
+static void step_ire_mode(bool forward)
+{
+    if (forward ? mode_ire < 5 : mode_ire > 0) {
+        mode_ire += forward ? 1 : -1;
+    }
+    else {
+        mode_ire = forward ? 0 : 5;
+        rgb_color = !rgb_color;
+        write_color_space();
+    }
+    set_video_range(mode_ire);
+    setup_encoder();
+}
+
+static InputSelection phys_to_insel(PhysInput input)
+{
+    return input == INPUT_CVBS ? INSEL_CVBS_Ain1 :
+        input == INPUT_SVIDEO ? INSEL_YC_Ain3_4 : INSEL_YPbPr_Ain1_2_3;
+}
 
+// Configures the decoder out of reset for an input.
+static void setup_decoder(PhysInput input)
+{
+    CHECKPOINT_SCOPE(STAGE_RECONFIG);
     // AFE IBIAS (undocumented register, used in recommended scripts)
     if (input == INPUT_CVBS) {
         I2C_WRITE(decoder.address, 0x52, 0xcd);
@@ -399,20 +878,13 @@ static void setup_video(PhysInput input, bool pedestal, bool smoothing)
         I2C_WRITE(decoder.address, 0x53, 0xce);
     }
 	
-	// iRE 0 input
-	decoder.select_autodetection(AD_PALBGHID_NTSCJ_SECAM);
+	// Search the standard last locked on this input first.
+	narrowed_vstd = learned_vstd[input];
+	decoder.select_autodetection(
+		autodetection_for(narrowed_vstd, mode_ire >= 2));
 	
     // Select input
-    if (input == INPUT_CVBS) {
-        decoder.select_input(INSEL_CVBS_Ain1);
-    }
-    else if (input == INPUT_SVIDEO){
-        decoder.select_input(INSEL_YC_Ain3_4);
-    }
-    else
-    {
-    	decoder.select_input(INSEL_YPbPr_Ain1_2_3);
-    }
+    decoder.select_input(phys_to_insel(input));
 
     //setup_ad_black_magic();
 
@@ -428,6 +900,7 @@ static void setup_video(PhysInput input, bool pedestal, bool smoothing)
     decoder.set_interrupt_config(
         IDL_ACTIVE_LOW, false, 0x10, ID_MUST_CLEAR, false);
     decoder.select_submap(DEC_SUBMAP_USER);
+    intrq_cleared = now_ticks();
 	
 	set_video_range(mode_ire);
 
@@ -466,13 +939,9 @@ static void setup_video(PhysInput input, bool pedestal, bool smoothing)
         I2C_WRITE(decoder.address, 0x13, 0x00);
     }
 
-    // Analog clamp control
-    // 100% color bars
-    I2C_WRITE(decoder.address, 0x14, 0x11);
-
-    // Digital clamp control
-    // Digital clamp on, time constant adaptive
-    I2C_WRITE(decoder.address, 0x15, 0x60);
+    // Clamp, shaping, comb filter and color kill control, as set by
+    // the active preset (see koryuu_presets::TUNABLES).
+    presets.write_all(TARGET_DECODER, decoder.address);
 
 
 #if 0
@@ -493,6 +962,9 @@ static void setup_video(PhysInput input, bool pedestal, bool smoothing)
     // Disable CTI and CTI alpha blender, enable DNR
     decoder.set_cti_dnr_control(false, false, AB_SMOOTHEST, true);
 
+    // Interlaced to progressive conversion
+    apply_i2p_mode();
+
     // Output sync select 2
     // Output SFL on the VS/FIELD/SFL pin
     I2C_WRITE(decoder.address, 0x6b, 0x14);
@@ -506,58 +978,648 @@ static void setup_video(PhysInput input, bool pedestal, bool smoothing)
     // Low drive strength for all
     I2C_WRITE(decoder.address, 0xf4, 0x00);
 #endif
-    //filtering ntsc adaptive
-    I2C_WRITE(decoder.address, 0x38, 0xc0);//5line adaptive comb ntsc
-    //filtering pal adaptive
-    I2C_WRITE(decoder.address, 0x39, 0xc0);//5line adaptive comb ntsc
-    I2C_WRITE(decoder.address, 0x4d, 0xCF);//disable NR input
+    write_noise_reduction(true, false);
     //I2C_WRITE(decoder.address, 0x04, 0xB6);//full range digital output (decoder)??? g du faire nimporte quoi
+}
+
+static void setup_video(PhysInput input)
+{
+    PROFILE_SCOPE(PROF_SETUP_VIDEO);
+    CHECKPOINT_SCOPE(STAGE_RECONFIG);
+    // Software reset decoder and encoder.
+    // Ignore the I2C transaction failure.
+    decoder.set_power_management(false, true);
+    I2C_WRITE<false>(encoder.address, 0x17, 0x07);
+    tuned_vstd = VSTD_UNKNOWN;
+
+    // Decoder setup
+
+    // Exit powerdown
+    decoder.set_power_management(false, false);
+    delay_ms(10);
+
+    setup_decoder(input);
 
     // Encoder setup
     setup_encoder();
 }
 
+// Applies a preset as a delta against the current state, without
+// re-running setup_video(). Empty slots recall the base init.
+static void recall_preset(uint8_t slot)
+{
+    Preset p;
+    if (!presets.load(slot, p))
+        p = base_preset;
+    presets.apply(&p, slot, decoder.address, encoder.address);
+
+    const bool new_component_output = !!(p.flags & PRESET_FLAG_COMPONENT_OUT);
+    const bool new_rgb_color = !!(p.flags & PRESET_FLAG_RGB_COLOR);
+    if (p.mode_ire != mode_ire && p.mode_ire <= 5) {
+        mode_ire = p.mode_ire;
+        set_video_range(mode_ire);
+    }
+    if (p.noise_reduction != noise_reduction && p.noise_reduction <= 3) {
+        noise_reduction = p.noise_reduction;
+        write_noise_reduction(true, true);
+    }
+    if (new_component_output != component_output) {
+        component_output = new_component_output;
+        write_output_format();
+    }
+    if (new_rgb_color != rgb_color) {
+        rgb_color = new_rgb_color;
+        write_color_space();
+    }
+
+#if LOGGING
+    LOG(LOG_PRESET_RECALLED, slot,
+        koryuu::LogBytes{ p.name, sizeof(p.name) });
+#endif
+    show_status();
+}
+
+static void switch_input(Input in)
+{
+    interlace_status = INTERLACE_STATUS_UNKNOWN;
+    freerun_status = FREERUN_STATUS_UNKNOWN;
+    setup_video(input_to_phys[in]);
+    curr_input = in;
+    show_status();
+}
+
+// Time given to the CHX min/max detector when probing an input.
+constexpr uint8_t PROBE_MS = 5;
+
+// Checks an input for activity without waiting for lock: selects it and
+// looks whether the AFE channel levels trigger the CHX min/max
+// interrupt within PROBE_MS. Leaves the probed input selected.
+static bool probe_input(PhysInput input)
+{
+    decoder.select_input(phys_to_insel(input));
+    decoder.select_submap(DEC_SUBMAP_INTR_VDP);
+    decoder.set_interrupt_mask2(false, true, true, false, false);
+    decoder.interrupt_clear2(false, false, true, false, false);
+    delay_ms(PROBE_MS);
+    const bool active = !!(decoder.interrupt_status2(false) & 0x20);
+    decoder.set_interrupt_mask2(false, true, false, false, false);
+    decoder.interrupt_clear2(false, false, true, false, false);
+    decoder.select_submap(DEC_SUBMAP_USER);
+    return active;
+}
+
+// Probes the current input, then the others in scan order, for the
+// first one with a signal. If none has one, selects the current input
+// again and returns false.
+static bool find_signal(PhysInput &found)
+{
+    const PhysInput cur = input_to_phys[curr_input];
+    for (uint8_t i = 0; i < 3; ++i) {
+        const PhysInput cand = (PhysInput)((cur + i) % 3);
+        if (probe_input(cand)) {
+    #if LOGGING
+            LOG(LOG_SIGNAL_ON_INPUT, cand);
+    #endif
+            found = cand;
+            return true;
+        }
+    }
+    decoder.select_input(phys_to_insel(cur));
+    return false;
+}
+
+// Stays on the current input if it has a signal that is just slow to
+// lock, otherwise switches to the first input with a signal.
+static void scan_inputs()
+{
+    PhysInput found;
+    if (find_signal(found) && found != input_to_phys[curr_input])
+        switch_input(phys_to_input[found]);
+}
+
+#if IDLE_TIMEOUT_S
+enum WakeCause : uint8_t {
+    WAKE_PROBE = 0,
+    WAKE_BUTTON = 1,
+    WAKE_CONTROL = 2,
+};
+
+// Tick of the last wake-up, while waiting for the first lock after it.
+static uint16_t resume_from = 0;
+static bool resuming = false;
+
+// Powers the decoder down and puts the encoder to sleep. The LEDs go
+// dark.
+static void go_idle(uint16_t now)
+{
+#if LOGGING
+    LOG(LOG_IDLE_SLEEP, (uint16_t)IDLE_TIMEOUT_S);
+#endif
+    decoder.set_power_management(true, false);
+    I2C_WRITE(encoder.address, 0x00, 0x01);
+    resuming = false;
+    idle.sleep(now);
+    show_status();
+}
+
+// Resets both chips into the input, which also ends the decoder power
+// down and the encoder sleep.
+static void wake_up(Input in, WakeCause cause)
+{
+#if LOGGING
+    LOG(LOG_IDLE_WAKE, idle.asleep_time(), (uint8_t)cause);
+#else
+    (void)cause;
+#endif
+    resume_from = now_ticks();
+    resuming = true;
+    idle.wake(resume_from);
+    switch_input(in);
+    lock_fsm.restart(now_ticks());
+}
+
+// Powers the decoder up for a look at the inputs. Wakes up if one has
+// a signal, powers down again otherwise.
+static void idle_probe()
+{
+    decoder.set_power_management(false, false);
+    delay_ms(10);
+    PhysInput found;
+    if (find_signal(found)) {
+        wake_up(found == input_to_phys[curr_input] ?
+            curr_input : phys_to_input[found], WAKE_PROBE);
+        return;
+    }
+    decoder.set_power_management(true, false);
+}
+#endif
+
+#if SCRUB_PERIOD_MS
+static koryuu::Scrubber scrubber(decoder.address, encoder.address);
+constexpr uint16_t SCRUB_TICKS = ms_to_ticks(SCRUB_PERIOD_MS);
+
+static void scrub_note_write(uint8_t addr, uint8_t reg, uint8_t v)
+{
+    scrubber.note_write(addr, reg, v);
+}
+
+// Reads back the next critical register. A chip that has lost its
+// configuration gets it back, without resetting either chip: the
+// scrubbed registers as last written, then the rest of its setup.
+// Returns true if the decoder was repaired.
+static bool scrub_step()
+{
+    uint8_t reg, want, got;
+    const koryuu::ScrubChip chip = scrubber.step(reg, want, got);
+    if (chip == koryuu::SCRUB_NONE)
+        return false;
+#if LOGGING
+    LOG(LOG_SCRUB_REPAIR, chip, reg, got, want, scrubber.repair_count(chip));
+#endif
+    scrubber.restore(chip);
+    if (chip == koryuu::SCRUB_DECODER) {
+        setup_decoder(input_to_phys[curr_input]);
+        return true;
+    }
+    I2C_WRITE(encoder.address, 0x84, chroma_enabled ? 0x00 : 0x10);
+    tuned_vstd = VSTD_UNKNOWN;
+    setup_encoder();
+    return false;
+}
+#endif
+
 #if DEBUG > 1
 static void i2c_trace(uint8_t addr,
         const uint8_t *begin, const uint8_t *end, bool start, bool stop)
 {
-    serial << _T("I2C write (start == ") << asdec(start) << _T(", stop == ")
-           << asdec(stop) << _T(") to addr 0x") << ashex(addr) << _T(": { ");
-    while (begin < end) {
-        serial << _T("0x") << ashex(*begin) << _T(", ");
-        ++begin;
+    LOG(LOG_I2C_TRACE, start, stop, addr,
+        koryuu::LogBytes{ begin, (uint8_t)(end - begin) });
+}
+#endif
+
+#if CONTROL
+static koryuu::ProtoParser proto;
+
+// Response frames must not lose bytes.
+struct BlockingSerial {
+    void put(uint8_t c) {
+        serial.put(c, koryuu::TX_BLOCK);
+    }
+};
+static BlockingSerial blocking_serial;
+using Response = koryuu::ProtoResponse<BlockingSerial>;
+
+// Selects a register map for access. Returns its I2C address.
+static uint8_t select_map(uint8_t map)
+{
+    using namespace koryuu;
+    switch (map) {
+    case MAP_USER2:
+        decoder.select_submap(DEC_SUBMAP_USER2);
+        return decoder.address;
+    case MAP_INTR_VDP:
+        decoder.select_submap(DEC_SUBMAP_INTR_VDP);
+        return decoder.address;
+    case MAP_0x80:
+        decoder.select_submap(DEC_SUBMAP_0x80);
+        return decoder.address;
+    case MAP_VPP:
+        decoder.enable_vpp_map();
+        return decoder.vpp.address;
+    case MAP_ENCODER:
+        return encoder.address;
+    default:
+        return decoder.address;
+    }
+}
+
+static void dump_map(uint8_t map)
+{
+    const uint8_t addr = select_map(map);
+#if DEBUG > 1
+    // The register reads would be traced into the response.
+    i2c_set_trace(nullptr);
+#endif
+    Response r(blocking_serial, koryuu::CMD_DUMP_MAP, koryuu::PS_OK, 257);
+    r.put_crc(map);
+    uint8_t reg = 0;
+    do {
+        r.put_crc(I2C_READ_ONE(addr, reg));
+    } while (++reg);
+    r.end();
+#if DEBUG > 1
+    i2c_set_trace(i2c_trace);
+#endif
+    decoder.select_submap(DEC_SUBMAP_USER);
+}
+
+// All or nothing: the whole batch is checked before the first write.
+static koryuu::ProtoStatus write_batch(const uint8_t *p, uint8_t len)
+{
+    if (len % 3)
+        return koryuu::PS_BAD_ARGUMENT;
+    for (uint8_t i = 0; i < len; i += 3)
+        if (p[i] >= koryuu::NUM_MAPS)
+            return koryuu::PS_BAD_ARGUMENT;
+
+    uint8_t map = koryuu::NUM_MAPS;
+    uint8_t addr = decoder.address;
+    for (uint8_t i = 0; i < len; i += 3) {
+        if (p[i] != map) {
+            map = p[i];
+            addr = select_map(map);
+        }
+        I2C_WRITE(addr, p[i + 1], p[i + 2]);
+        if (map == koryuu::MAP_USER)
+            presets.note_write(TARGET_DECODER, p[i + 1], p[i + 2]);
+        else if (map == koryuu::MAP_ENCODER)
+            presets.note_write(koryuu_presets::TARGET_ENCODER,
+                p[i + 1], p[i + 2]);
+    }
+    decoder.select_submap(DEC_SUBMAP_USER);
+    return koryuu::PS_OK;
+}
+
+// Seconds spent in a lock state, saturating for a state variable.
+static int16_t lock_state_seconds(LockState state)
+{
+    // In 64 bits: 32767 s in microseconds overflows an AVR long.
+    constexpr uint32_t MAX_TICKS = (uint32_t)(32767ull * 1000000ull / TICK_US);
+    static_assert((uint64_t)MAX_TICKS * TICK_US <= 32767000000ull &&
+        (uint64_t)(MAX_TICKS + 1) * TICK_US > 32767000000ull,
+        "MAX_TICKS is not 32767 s");
+    const uint32_t t = lock_fsm.total_time(state, now_ticks());
+    if (t >= MAX_TICKS)
+        return 32767;
+    // Exact, and within 32 bits up to MAX_TICKS.
+    static_assert(TICK_US % 64u == 0, "TICK_US is not a multiple of 64");
+    return (int16_t)(t * (TICK_US / 64u) / (1000000u / 64u));
+}
+
+static int16_t get_var(uint8_t var)
+{
+    using namespace koryuu;
+    switch (var) {
+    case VAR_INPUT:
+        return curr_input;
+    case VAR_MODE_IRE:
+        return mode_ire;
+    case VAR_NOISE_REDUCTION:
+        return noise_reduction;
+    case VAR_I2P_MODE:
+        return i2p_mode;
+    case VAR_COMPONENT_OUTPUT:
+        return component_output;
+    case VAR_RGB_COLOR:
+        return rgb_color;
+    case VAR_FSC_TRIM:
+        return fsc_trim;
+    case VAR_STACK_UNUSED:
+        return stack_unused();
+    case VAR_STATIC_RAM:
+        return static_ram();
+    case VAR_I2P_LATENCY_US:
+        return i2p_latency();
+    case VAR_SCANNING_S:
+    case VAR_ACQUIRING_S:
+    case VAR_LOCKED_S:
+    case VAR_HOLDOVER_S:
+    case VAR_LOST_S:
+        return lock_state_seconds((LockState)(var - VAR_SCANNING_S));
+#if SCRUB_PERIOD_MS
+    case VAR_DECODER_REPAIRS:
+        return scrubber.repair_count(SCRUB_DECODER);
+    case VAR_ENCODER_REPAIRS:
+        return scrubber.repair_count(SCRUB_ENCODER);
+#endif
+    default:
+        return 0;
+    }
+}
+
+// Applies a state variable the way the buttons would.
+static koryuu::ProtoStatus set_var(uint8_t var, int16_t v)
+{
+    using namespace koryuu;
+    switch (var) {
+    case VAR_INPUT:
+        if (v < CVBS || v > COMPONENT)
+            return PS_BAD_ARGUMENT;
+        switch_input((Input)v);
+        break;
+    case VAR_MODE_IRE:
+        if (v < 0 || v > 5)
+            return PS_BAD_ARGUMENT;
+        mode_ire = v;
+        set_video_range(mode_ire);
+        setup_encoder();
+        break;
+    case VAR_NOISE_REDUCTION:
+        if (v < 0 || v > 3)
+            return PS_BAD_ARGUMENT;
+        noise_reduction = v;
+        write_noise_reduction(true, true);
+        break;
+    case VAR_I2P_MODE:
+        if (v < I2P_OFF || v > I2P_DEINTERLACE)
+            return PS_BAD_ARGUMENT;
+        set_i2p_mode((I2PMode)v);
+        break;
+    case VAR_COMPONENT_OUTPUT:
+        if (v < 0 || v > 1)
+            return PS_BAD_ARGUMENT;
+        component_output = v;
+        setup_encoder();
+        break;
+    case VAR_RGB_COLOR:
+        if (v < 0 || v > 1)
+            return PS_BAD_ARGUMENT;
+        rgb_color = v;
+        write_color_space();
+        break;
+    case VAR_FSC_TRIM: {
+        fsc_trim = v;
+        const uint8_t vstd = tuned_vstd;
+        tuned_vstd = VSTD_UNKNOWN;
+        apply_standard_tuning(vstd);
+        break;
+    }
+    default:
+        return PS_BAD_ARGUMENT;
+    }
+    show_status();
+    return PS_OK;
+}
+
+// Saves the current state into a preset slot and boots with it.
+static void save_state(uint8_t slot, KoryuuSettings &settings)
+{
+    Preset p = { PRESET_MAGIC, { 'S', 'A', 'V', 'E', 'D', ' ', ' ',
+        (char)('0' + slot) }, (uint8_t)mode_ire, (uint8_t)noise_reduction,
+        0, 0, {} };
+    if (component_output)
+        p.flags |= PRESET_FLAG_COMPONENT_OUT;
+    if (rgb_color)
+        p.flags |= PRESET_FLAG_RGB_COLOR;
+    presets.capture(p);
+    presets.store(slot, p);
+
+    settings.settings.i2p_mode = i2p_mode;
+    settings.settings.boot_preset = slot;
+    settings.set_dirty();
+    settings.write();
+}
+
+static void handle_request(KoryuuSettings &settings)
+{
+    using namespace koryuu;
+    const uint8_t cmd = proto.command();
+    const uint8_t len = proto.length();
+    const uint8_t *const p = proto.payload;
+    ProtoStatus st = proto.status();
+
+    if (st == PS_OK) {
+#if IDLE_TIMEOUT_S
+        // Register access and changes need the chips awake.
+        if (idle.asleep() && cmd != CMD_PING && cmd != CMD_GET_VAR)
+            wake_up(curr_input, WAKE_CONTROL);
+#endif
+        switch (cmd) {
+        case CMD_PING: {
+            const uint8_t n = sizeof(FW_VERSION_STR) - 1;
+            Response r(blocking_serial, cmd, PS_OK, 3 + n);
+            r.put_crc(PROTO_VERSION);
+            r.put_crc(NUM_MAPS);
+            r.put_crc(NUM_STATE_VARS);
+            for (uint8_t i = 0; i < n; ++i)
+                r.put_crc(FW_VERSION_STR[i]);
+            r.end();
+            return;
+        }
+        case CMD_DUMP_MAP:
+            if (len != 1 || p[0] >= NUM_MAPS) {
+                st = PS_BAD_ARGUMENT;
+                break;
+            }
+            dump_map(p[0]);
+            return;
+        case CMD_WRITE_BATCH: {
+            st = write_batch(p, len);
+            if (st != PS_OK)
+                break;
+            Response r(blocking_serial, cmd, PS_OK, 1);
+            r.put_crc(len / 3);
+            r.end();
+            return;
+        }
+        case CMD_GET_VAR:
+        case CMD_SET_VAR: {
+            if (len != (cmd == CMD_GET_VAR ? 1 : 3) ||
+                    p[0] >= NUM_STATE_VARS) {
+                st = PS_BAD_ARGUMENT;
+                break;
+            }
+            if (cmd == CMD_SET_VAR)
+                st = set_var(p[0], (int16_t)(p[1] | (p[2] << 8)));
+            if (st != PS_OK)
+                break;
+            Response r(blocking_serial, cmd, PS_OK, 3);
+            r.put_crc(p[0]);
+            r.put16(get_var(p[0]));
+            r.end();
+            return;
+        }
+#if WATCHDOG
+        case CMD_FAULTS: {
+            if (len != 1) {
+                st = PS_BAD_ARGUMENT;
+                break;
+            }
+            FaultRecord f = {};
+            uint8_t n = 0;
+            while (fault_log.get(n, f))
+                ++n;
+            Response r(blocking_serial, cmd, PS_OK, 1 + 5 * n);
+            r.put_crc(n);
+            for (uint8_t i = 0; i < n; ++i) {
+                fault_log.get(i, f);
+                r.put_crc(f.seq);
+                r.put_crc(f.mcusr);
+                r.put_crc(f.stage);
+                r.put_crc(f.i2c_addr);
+                r.put_crc(f.i2c_args);
+            }
+            r.end();
+            if (p[0] & FAULTS_CLEAR)
+                fault_log.clear();
+            return;
+        }
+#endif
+        case CMD_SAVE: {
+            if (len != 1 || p[0] >= NUM_PRESETS) {
+                st = PS_BAD_ARGUMENT;
+                break;
+            }
+            save_state(p[0], settings);
+            Response r(blocking_serial, cmd, PS_OK, 1);
+            r.put_crc(p[0]);
+            r.end();
+            return;
+        }
+        default:
+            st = PS_UNKNOWN_COMMAND;
+            break;
+        }
+    }
+    Response(blocking_serial, cmd, st, 0).end();
+}
+#endif
+
+#if TELEMETRY || CONTROL
+// Serial commands: control protocol frames (see koryuu_proto.hh), and
+// the one-byte commands
+// 'T': dump the telemetry, 'Z': dump and reset it.
+static void poll_serial_commands(KoryuuSettings &settings)
+{
+    uint8_t c;
+    while (serial.get(c)) {
+#if CONTROL
+        switch (proto.feed(c, now_ticks())) {
+        case koryuu::ProtoParser::PARSE_FRAME:
+            handle_request(settings);
+            continue;
+        case koryuu::ProtoParser::PARSE_NONE:
+            continue;
+        default:
+            break;
+        }
+#else
+        (void)settings;
+#endif
+#if TELEMETRY
+        if (c == 'T' || c == 'Z') {
+            telemetry.dump(now_ticks(),
+                [](uint8_t b) { serial.put(b, koryuu::TX_BLOCK); });
+            if (c == 'Z')
+                telemetry.reset();
+        }
+#endif
     }
-    serial << _T(" }\r\n");
 }
 #endif
 
+static void on_gesture(uint8_t gesture, KoryuuSettings &settings)
+{
+#if LOGGING
+    LOG(LOG_GESTURE, gesture);
+#endif
+    switch (gesture) {
+    case GESTURE_PRESS | GESTURE_INPUT:
+        // off -> input -> output -> input + output -> off
+        noise_reduction = (noise_reduction + 1) & 0x03;
+        write_noise_reduction(true, true);
+        break;
+    case GESTURE_DOUBLE_PRESS | GESTURE_INPUT:
+        noise_reduction = (noise_reduction + 3) & 0x03;
+        write_noise_reduction(true, true);
+        break;
+    case GESTURE_LONG_PRESS | GESTURE_INPUT:
+        set_i2p_mode(i2p_mode < I2P_DEINTERLACE ?
+            (I2PMode)(i2p_mode + 1) : I2P_OFF);
+        settings.settings.i2p_mode = i2p_mode;
+        settings.set_dirty();
+        settings.write();
+        break;
+    case GESTURE_PRESS | GESTURE_OPTION:
+        step_ire_mode(true);
+        break;
+    case GESTURE_DOUBLE_PRESS | GESTURE_OPTION:
+        step_ire_mode(false);
+        break;
+    case GESTURE_LONG_PRESS | GESTURE_OPTION: {
+        const uint8_t slot = presets.active_slot();
+        recall_preset(slot < NUM_PRESETS - 1 ? slot + 1 : 0);
+        break;
+    }
+    case GESTURE_CHORD:
+        // Component <-> CVBS output
+        component_output = !component_output;
+        setup_encoder();
+        break;
+    default:
+        break;
+    }
+    show_status();
+}
+
 int main(void)
 {
-	#if AUTORESET
+	#if WATCHDOG
+		// What was going on before the reset, before anything else
+		// overwrites it. The watchdog keeps running after it has reset
+		// the MCU, with the shortest timeout: rearm it right away.
+		const koryuu::FaultRecord fault = { 0, take_reset_flags(),
+			koryuu::checkpoint_stage(), i2c_helpers::last_addr,
+			i2c_helpers::last_args, 0 };
+		watchdog_enable_2s();
+		CHECKPOINT(STAGE_BOOT);
+	#elif AUTORESET
 		// Must disable the watchdog timer ASAP.
-		cli();
-		wdt_reset();
-		MCUSR &= ~_BV(WDRF);
-		WDTCSR |= _BV(WDE) | _BV(WDCE);
-		WDTCSR = 0x00;
-		sei();
+		watchdog_off();
 	#endif
 
-		_delay_ms(100);
-		cli();
+		delay_ms(100);
+		irq_disable();
 
 		// Setup reading the "input change" and "option" switches
 		input_change.set_mode(INPUT_PULLUP);
 		option.set_mode(INPUT_PULLUP);
-		setup_timer0();
+		setup_tick_timer();
+		// Decoder interrupt requests
+		int0_setup();
 
 		// Setup LEDs
-		led_CVBS.mode = OUTPUT;
-		led_CVBS = false;
-		led_YC.mode = OUTPUT;
-		led_YC = false;
-		led_OPT.mode = OUTPUT;
-		led_OPT = false;
+		leds.setup();
 
 		// Using external 2kohm pullups for the I2C bus
 		sda.mode = INPUT;
@@ -568,15 +1630,18 @@ int main(void)
 	#if ERROR_PANIC
 		I2C_set_err_func(i2c_err_func);
 	#endif
+	#if SCRUB_PERIOD_MS
+		I2C_set_write_hook(scrub_note_write);
+	#endif
 
 	#if DEBUG > 1
-		I2c_HW.set_trace(i2c_trace);
+		i2c_set_trace(i2c_trace);
 	#endif
 
-	#if DEBUG || CALIBRATE
-		serial.setup(9600, DATA_EIGHT, STOP_ONE, PARITY_DISABLED);
+	#if HAVE_SERIAL
+		serial.setup(9600);
 	#endif
-		sei();
+		irq_enable();
 
 		/*
 		 * ADV7280A simplified power-up sequence:
@@ -598,10 +1663,10 @@ int main(void)
 		 */
 		decoder.pwrdwn = true;
 		encoder.reset = true;
-		_delay_ms(10);
+		delay_ms(10);
 		decoder.reset = true;
 		encoder.reset = false;
-		_delay_ms(10);
+		delay_ms(10);
 		encoder.reset = true;
 
 	#if CALIBRATE
@@ -610,62 +1675,60 @@ int main(void)
 		const auto osccal_max = (old_osccal > 0xff - 20) ? 0xff : (old_osccal + 20);
 		for (auto i = osccal_min; i != osccal_max; ++i) {
 			OSCCAL = i;
-			_delay_ms(10);
-			serial << _T("OSCCAL = 0x") << ashex(i) << _T(" (old: 0x")
-				<< ashex(old_osccal)
-				<< _T(") The quick brown fox jumps over the lazy dog. åäö,"
+			delay_ms(10);
+			serial << _F("OSCCAL = 0x") << hex((uint8_t)i) << _F(" (old: 0x")
+				<< hex(old_osccal)
+				<< _F(") The quick brown fox jumps over the lazy dog. åäö,"
 					" ÅÄÖ\r\n");
+			serial.flush();
 			OSCCAL = old_osccal;
 			for (size_t j = 0; j < 10; ++j)
-				serial << _T("\r\n");
+				serial << _F("\r\n");
 		}
+		serial.flush();
 		OSCCAL = old_osccal;
 
 		return 0;
 	#endif
 
+		CHECKPOINT(STAGE_INIT);
 		KoryuuSettings settings(&eeprom_settings);
-	#if DEBUG
-		serial << _T("Koryuu transcoder starting...\r\n");
-		serial << _T("Firmware version: ") << FW_VERSION << _T("\r\n");
-		uint32_t settings_hdr_crc32 = settings.settings.hdr.checksum;
-		uint32_t settings_crc32 = settings.settings.checksum;
-		serial << _T("Settings hdr crc32: 0x") << ashex(settings_hdr_crc32)
-			<< _T("\r\n");
-		serial << _T("Settings crc32: 0x") << ashex(settings_crc32) << _T("\r\n");
+	#if LOGGING
+		LOG(LOG_STARTING, _F(FW_VERSION_STR));
+		LOG(LOG_SETTINGS_CRC, (uint32_t)settings.settings.hdr.checksum,
+			(uint32_t)settings.settings.checksum);
+	#endif
+	#if WATCHDOG
+		record_fault(fault);
 	#endif
 
 		// If the settings were (re-)initialized, write them back to EEPROM.
 		// However, do not do this automatically if we loaded settings from
 		// a newer version.
 		if (settings.is_dirty() && !settings.is_downgrading()) {
-	#if DEBUG
-			serial << _T("EEPROM settings invalid, writing back defaults.\r\n");
+	#if LOGGING
+			LOG(LOG_SETTINGS_RESET);
 	#endif
 			settings.write();
 		}
 
 		curr_input = COMPONENT;//settings.settings.default_input;
+		i2p_mode = settings.settings.i2p_mode;
 	#if DEC_TEST_PATTERN
 		disable_freerun = !!settings.settings.disable_free_run;
 	#endif
-		setup_video(input_to_phys[curr_input],
-			input_to_pedestal[curr_input], !!settings.settings.smoothing);
-		led_CVBS = input_to_phys[curr_input] == INPUT_CVBS;
-		led_YC = input_to_phys[curr_input] == INPUT_SVIDEO;
-		led_OPT = !!settings.settings.smoothing;
-
-	#if DEBUG
-			serial << _T("Initial settings:\r\n");
-			serial << _T("\tPhysical input: ")
-				<< (input_to_phys[curr_input] == INPUT_CVBS ?
-					_T("CVBS") : _T("SVIDEO")) << _T("\r\n");
-			serial << _T("\tPedestal: ")
-				<< asdec(input_to_pedestal[curr_input]) << _T("\r\n");
-			serial << _T("\tSmoothing: ")
-				<< asdec(!!settings.settings.smoothing) << _T("\r\n");
-			serial << _T("\tFree run mode disabled: ")
-				<< asdec(!!settings.settings.disable_free_run) << _T("\r\n");
+		setup_video(input_to_phys[curr_input]);
+		if (settings.settings.boot_preset < NUM_PRESETS)
+			recall_preset(settings.settings.boot_preset);
+		show_status();
+
+	#if LOGGING
+		LOG(LOG_INITIAL_SETTINGS, input_to_phys[curr_input],
+			(uint8_t)input_to_pedestal[curr_input],
+			!!settings.settings.smoothing,
+			!!settings.settings.disable_free_run,
+			(uint8_t)settings.settings.i2p_mode);
+		LOG(LOG_RAM_USAGE, static_ram(), stack_unused());
 	#endif
 
 		// Main loop.
@@ -682,206 +1745,198 @@ int main(void)
 	#endif
 		uint8_t dec_status3 = 0x00;
 		bool got_interrupt = false;
+		// An INTRQ edge not yet followed by a status poll.
+		bool intrq_pending = false;
+	#if LOGGING
+		uint8_t events_dropped = 0;
+	#endif
 		bool check_once_more = true;
-	//set filter to narow at begining
-	I2C_WRITE(decoder.address, 0x19, 0xf0);
-	I2C_WRITE(decoder.address, 0x17, 0x59);
-	I2C_WRITE(decoder.address, 0x3d, 0x32);//color kill treshold 4%
+		uint16_t status_sampled = now_ticks();
+	#if SCRUB_PERIOD_MS
+		uint16_t scrubbed = now_ticks();
+	#endif
 		while (1) {
-			bool input_change_pressed = input_change.read();
-			bool option_pressed = option.read();
-			
-			if(I2C_READ_ONE(decoder.address, 0x10) & 0x01 ?true:false)
-			{
-				//led_OPT = true;
-				input_timer = 0;
-			}
-			else
-			{
-				//change ipunt after x second
-				//led_OPT = false;
-				if (input_timer > 20) 
-				{
-					switch (curr_input) {
-					case CVBS:
-						interlace_status = INTERLACE_STATUS_UNKNOWN;
-						freerun_status = FREERUN_STATUS_UNKNOWN;
-						setup_video(INPUT_SVIDEO, pedestal_enabled, false);
-						curr_input = SVIDEO;
-						led_CVBS = false;
-						led_YC = true;
-						break;
-					case SVIDEO:
-						interlace_status = INTERLACE_STATUS_UNKNOWN;
-						freerun_status = FREERUN_STATUS_UNKNOWN;
-						setup_video(INPUT_COMPONENT, pedestal_enabled, false);
-						curr_input = COMPONENT;
-						led_CVBS = true;
-						led_YC = true;
-						break;
-					
-					case COMPONENT:
-						interlace_status = INTERLACE_STATUS_UNKNOWN;
-						freerun_status = FREERUN_STATUS_UNKNOWN;
-						setup_video(INPUT_CVBS, pedestal_enabled, false);
-						curr_input = CVBS;
-						led_CVBS = true;
-						led_YC = false;
+			CHECKPOINT(STAGE_LOOP);
+			PROFILE_BEGIN(PROF_LOOP);
+			const uint16_t now = now_ticks();
+			// Asleep too: the lock state times count on, and so does
+			// the length of a dropout.
+			lock_fsm.account(now);
+	#if TELEMETRY
+			telemetry.age(now);
+	#endif
+
+			// The events of the interrupts, in the order they happened.
+	#if IDLE_TIMEOUT_S
+			bool button_pressed = false;
+	#endif
+			koryuu::Event event;
+			while (events.take(event)) {
+				switch (event.type) {
+	#if IDLE_TIMEOUT_S
+				case koryuu::EVENT_BUTTON:
+					if (event.payload & koryuu::BUTTON_DOWN)
+						button_pressed = true;
+					break;
+	#endif
+				case koryuu::EVENT_INTRQ:
+					// Requests up to the last clear were already seen
+					// on the level of INTRQ, which stays low until
+					// cleared.
+					if ((int16_t)(event.time - intrq_cleared) > 0)
+						intrq_pending = true;
+					break;
+				case koryuu::EVENT_GESTURE:
+	#if IDLE_TIMEOUT_S
+					if (idle.asleep())
 						break;
-					}
-					input_timer = 0;
+	#endif
+					on_gesture(event.payload, settings);
+					break;
+				default:
+					break;
 				}
-				else
-				{
-					input_timer ++;
+			}
+	#if LOGGING
+			if (events.dropped_count() != events_dropped) {
+				events_dropped = events.dropped_count();
+				LOG(LOG_EVENTS_DROPPED, events_dropped);
+			}
+	#endif
+
+	#if IDLE_TIMEOUT_S
+			if (idle.asleep()) {
+				// Any button wakes up. The press is not acted on,
+				// and neither is holding it down.
+				if (button_pressed) {
+					wake_up(curr_input, WAKE_BUTTON);
+					gestures.cancel();
 				}
+				else if (idle.probe_due(now)) {
+					idle_probe();
+				}
+		#if TELEMETRY || CONTROL
+				poll_serial_commands(settings);
+		#endif
+				PROFILE_END(PROF_LOOP);
+				// Until the next tick, or a byte on the serial port.
+				cpu_sleep();
+				continue;
 			}
-			
-			if((I2C_READ_ONE(decoder.address, 0x10) & 0x80 ?true:false) && chroma_enabled == true )
+	#endif
+			// Read once per iteration, for the state machine and the
+			// status poll below.
+			uint8_t status1 = I2C_READ_ONE(decoder.address, 0x10);
+			if (lock_fsm.update(!!(status1 & 0x01), now)) {
+	#if LOGGING
+				LOG(LOG_LOCK_STATE, lock_fsm.state(), serial.overflow_count());
+	#endif
+				switch (lock_fsm.state()) {
+				case LOCK_LOST:
+					// Sustained loss: re-lock within the learned
+					// standard and let the status checks below
+					// reconfigure for the lost signal.
+					narrow_autodetection(
+						learned_vstd[input_to_phys[curr_input]]);
+					check_once_more = true;
+					break;
+				case LOCK_SCANNING:
+					// Jump to an input that has a signal. A present
+					// but slow to lock source keeps its input.
+					scan_inputs();
+					lock_fsm.restart(now_ticks());
+					// The status of the input now selected.
+					status1 = I2C_READ_ONE(decoder.address, 0x10);
+					break;
+				case LOCK_LOCKED:
+					// Catch up on status changes held back while
+					// coasting.
+					check_once_more = true;
+	#if IDLE_TIMEOUT_S
+					if (resuming) {
+						resuming = false;
+		#if LOGGING
+						LOG(LOG_IDLE_RESUMED, (uint16_t)((uint32_t)
+							(uint16_t)(now - resume_from) * TICK_US / 1000));
+		#endif
+					}
+	#endif
+					break;
+				default:
+					break;
+				}
+			}
+
+	#if IDLE_TIMEOUT_S
+			// A present source keeps the unit awake, lock lost or not
+			// found does not.
+			if (idle.update(lock_fsm.state() == LOCK_LOCKED ||
+				lock_fsm.state() == LOCK_HOLDOVER, now))
+			{
+				go_idle(now);
+				PROFILE_END(PROF_LOOP);
+				continue;
+			}
+	#endif
+
+			bool status2_sampled = false;
+			uint8_t status2 = 0;
+			if ((uint16_t)(now - status_sampled) >= STATUS_SAMPLE_TICKS) {
+				status_sampled = now;
+				status2 = I2C_READ_ONE(decoder.address, 0x12);
+				status2_sampled = true;
+	#if TELEMETRY
+				telemetry.sample(status1, status2,
+					I2C_READ_ONE(decoder.address, 0x13), now);
+	#endif
+			}
+	#if TELEMETRY || CONTROL
+			poll_serial_commands(settings);
+	#endif
+	#if SCRUB_PERIOD_MS
+			if ((uint16_t)(now - scrubbed) >= SCRUB_TICKS) {
+				scrubbed = now;
+				// Catch up on the status of a repaired decoder.
+				if (scrub_step())
+					check_once_more = true;
+			}
+	#endif
+
+			// Dropouts shorter than the hold-off do no register writes.
+			const LockState lock_state = lock_fsm.state();
+			const bool coasting = lock_state == LOCK_HOLDOVER;
+
+			// Fall back to full autodetection if the learned standard
+			// does not lock in time.
+			if ((lock_state == LOCK_ACQUIRING || lock_state == LOCK_LOST) &&
+				lock_fsm.time_in_state(now) >= RELOCK_WIDEN_TICKS)
+			{
+				narrow_autodetection(VSTD_UNKNOWN);
+			}
+
+			if (lock_state != LOCK_LOCKED)
+				comb_pending = false;
+			else if (status2_sampled)
+				update_comb_mode(status2, now);
+
+			if(coasting)
+			{
+				// Keep the current chroma setting.
+			}
+			else if((status1 & 0x80 ?true:false) && chroma_enabled == true )
 			{
 				I2C_WRITE(encoder.address, 0x84, 0x10);//disable chroma out
 				chroma_enabled = false;
-				led_OPT = true;
+				show_status();
 			}
-			else if((I2C_READ_ONE(decoder.address, 0x10) & 0x80 ?false:true) && chroma_enabled == false )
+			else if((status1 & 0x80 ?false:true) && chroma_enabled == false )
 			{
 				I2C_WRITE(encoder.address, 0x84, 0x00);//enable chroma out
 				chroma_enabled = true;
-				led_OPT = false;
+				show_status();
 			}
 			
 			
-			if (input_change_pressed && !option_pressed) {
-				switch (noise_reduction)
-				{
-					case 0:
-						I2C_WRITE(decoder.address, 0x4d, 0xEF);//input dnr ON
-						I2C_WRITE(encoder.address, 0x88, 0x04);//output dnr OFF		
-						noise_reduction = 1;
-						break;
-					case 1:
-						I2C_WRITE(decoder.address, 0x4d, 0xCF);//input dnr OFF
-						I2C_WRITE(encoder.address, 0x88, 0x24);//output dnr ON
-						noise_reduction = 2;
-						break;
-					case 2:
-						I2C_WRITE(decoder.address, 0x4d, 0xEF);//input dnr ON
-						I2C_WRITE(encoder.address, 0x88, 0x24);//output dnr ON
-						noise_reduction = 3;
-						break;
-					case 3:
-						I2C_WRITE(decoder.address, 0x4d, 0xCF);//input dnr OFF
-						I2C_WRITE(encoder.address, 0x88, 0x04);//output dnr OFF	
-						noise_reduction = 0;
-						break;
-				}
-			}
-			
-			if (!input_change_pressed && option_pressed) {
-				if(mode_ire < 5 )//si inferieux a x incrementer sinon 0
-				{
-					mode_ire = mode_ire +1;
-				}
-				else
-				{
-					mode_ire = 0;
-					rgb_color = !rgb_color;
-					if(rgb_color)
-					{
-						I2C_WRITE(encoder.address, 0x02, 0x54);
-					}
-					else
-					{
-						I2C_WRITE(encoder.address, 0x02, 0x74);
-					}
-				}
-				set_video_range(mode_ire);
-                setup_encoder();
-			}
-            
-            if (input_change_pressed && option_pressed) {
-                if(component_output)
-                {
-                    //CVBS out
-                    component_output = false;
-                        
-                    if(curr_input == SVIDEO)
-                    {
-			led_YC = true;
-                        led_CVBS = false;
-                    }
-                    else
-                    {
-                        led_YC = false;
-                        led_CVBS = true;
-                    }
-                }
-                else
-                {
-                    //Component out
-                    component_output = true;
-                }
-                setup_encoder();
-			}
-            
-            if(component_output)
-            {
-                if(curr_input == SVIDEO)
-                {
-                    led_CVBS = false;
-					led_YC = !led_YC;
-                }
-                else
-                {
-                    led_CVBS = !led_CVBS;
-                    led_YC = false;
-                }
-            }
-			/*if(mode_ire > 0)
-			{
-				//using the main loop for blinking the IRE OPTION LED
-				switch(led_timer1){
-					case 1000:	
-						led_OPT = true;
-						_delay_ms(20);
-						led_OPT = false;
-						if(!(mode_ire == 1))
-						{
-							led_timer1 = 0;
-						}
-					break;
-					case 1500:	
-						led_OPT = true;
-						_delay_ms(20);
-						led_OPT = false;
-						if(!(mode_ire == 2))
-						{
-							led_timer1 = 0;
-						}
-					break;
-					case 2000:	
-						led_OPT = true;
-						_delay_ms(20);
-						led_OPT = false;
-						if(!(mode_ire == 3))
-						{
-							led_timer1 = 0;
-						}
-					break;
-					case 2500:
-						led_OPT = true;
-						_delay_ms(20);
-						led_OPT = false;
-						if(!(mode_ire == 4))
-						{
-							led_timer1 = 0;
-						}
-					break;
-				}
-				led_timer1 ++;
-				_delay_ms(10);
-			}*/
-			
 			/*switch(input_is_instable())
 			{
 				case true:
@@ -894,39 +1949,64 @@ int main(void)
 			}*/
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			got_interrupt = !decoder.intrq;
+			// The edge catches a request raised and gone between two
+			// iterations, the level one raised while the last was not
+			// yet cleared.
+			got_interrupt = intrq_pending || !decoder.intrq;
+
+			// Only the causes that can come with a status change make the
+			// status registers be read again.
+			bool status_changed = false;
+			if (!coasting && got_interrupt) {
+				PROFILE_SCOPE(PROF_INTERRUPT);
+				intrq_pending = false;
+				// One read and the clears of exactly the causes read, in
+				// a single submap switch. As the clears come before the
+				// status reads, a change after the read raises a new
+				// interrupt.
+				InterruptCauses irq;
+				decoder.select_submap(DEC_SUBMAP_INTR_VDP);
+				if (decoder.read_interrupts(irq, false)) {
+	#if LOGGING
+					LOG(LOG_I2C_READ_FAILED, decoder.address, (uint8_t)0x42);
+	#endif
+				}
+				decoder.interrupt_clear(irq, false);
+				decoder.select_submap(DEC_SUBMAP_USER);
+				intrq_cleared = now_ticks();
 
-			if (got_interrupt || check_once_more ||
-				interlace_status == INTERLACE_STATUS_UNKNOWN ||
-				freerun_status == FREERUN_STATUS_UNKNOWN)
-			{
 	#if DEBUG > 1
-				if (got_interrupt) {
-					serial << _T("Interrupt\r\n");
-					decoder.select_submap(DEC_SUBMAP_INTR_VDP);
-					uint8_t intrs1 = I2C_READ_ONE(decoder.address, 0x42);
-					uint8_t intrs2 = I2C_READ_ONE(decoder.address, 0x46);
-					uint8_t intrs3 = I2C_READ_ONE(decoder.address, 0x4a);
-					decoder.select_submap(DEC_SUBMAP_USER);
-					serial << _T("Interrupt status 1: 0x") << ashex(intrs1)
-						<< _T("\r\n");
-					serial << _T("Interrupt status 2: 0x") << ashex(intrs2)
-						<< _T("\r\n");
-					serial << _T("Interrupt status 3: 0x") << ashex(intrs3)
-						<< _T("\r\n");
-
-					if (intrs2 & 0x10) {
-						uint8_t new_field_status =
-							!!(I2C_READ_ONE(decoder.address, 0x45) & 0x10);
-						serial << _T("Field changed to ")
-							<< (new_field_status ? _T("even") : _T("odd"))
-							<< _T("\r\n");
-						serial << _T("\r\n");
-					}
+				LOG(LOG_INTERRUPT, irq.causes1, irq.causes2, irq.causes3);
+	#elif LOGGING
+				// Not the field changes, they come with every field.
+				if (irq.causes1 | irq.causes3 |
+					(irq.causes2 & ~INTR2_SD_FIELD_CHANGE))
+					LOG(LOG_INTERRUPT, irq.causes1, irq.causes2,
+						irq.causes3);
+	#endif
+				// Macrovision, CCAPD and manual interrupts are only
+				// logged.
+				if (irq.causes1 & (INTR1_SD_LOCK | INTR1_SD_UNLOCK |
+					INTR1_FREERUN_CHANGE))
+					status_changed = true;
+				if (irq.causes2 & INTR2_SD_FIELD_CHANGE) {
+	#if DEBUG > 1
+					LOG(LOG_FIELD_CHANGED, (uint8_t)!!(irq.raw2 & 0x10));
+	#endif
+					// Fields mean interlaced video.
+					if (interlace_status != INTERLACE_STATUS_INTERLACED)
+						status_changed = true;
 				}
-	#endif // DEBUG > 1
+				if (irq.causes3)
+					status_changed = true;
+			}
 
-				const uint8_t new_status1 = I2C_READ_ONE(decoder.address, 0x10);
+			if (!coasting && (status_changed || check_once_more ||
+				interlace_status == INTERLACE_STATUS_UNKNOWN ||
+				freerun_status == FREERUN_STATUS_UNKNOWN))
+			{
+				PROFILE_SCOPE(PROF_STATUS_POLL);
+				const uint8_t new_status1 = status1;
 	#if DEBUG
 				const uint8_t new_status2 = I2C_READ_ONE(decoder.address, 0x12);
 	#endif
@@ -938,47 +2018,10 @@ int main(void)
 
 					if (dec_vstd != 0xffu)
 						dec_vstd = (dec_status1 >> 4u) & 0x07u;
+	#if LOGGING
+					LOG(LOG_STATUS1, new_status1);
+	#endif
 	#if DEBUG
-					serial << _T("Status 1 changed:\r\n");
-					serial << _T("In lock: ") << asdec(new_status1 & 0x01)
-						<< _T("\r\n");
-					serial << _T("Lost lock: ") << asdec(!!(new_status1 & 0x02))
-						<< _T("\r\n");
-					serial << _T("fSC lock: ") << asdec(!!(new_status1 & 0x04))
-						<< _T("\r\n");
-					serial << _T("Follow PW: ") << asdec(!!(new_status1 & 0x08))
-						<< _T("\r\n");
-					serial << _T("Video standard: ");
-					switch (new_vstd) {
-					case 0x00:
-						serial << _T("NTSC M/J\r\n");
-						break;
-					case 0x01:
-						serial << _T("NTSC 4.43\r\n");
-						break;
-					case 0x02:
-						serial << _T("PAL M\r\n");
-						break;
-					case 0x03:
-						serial << _T("PAL 60\r\n");
-						break;
-					case 0x04:
-						serial << _T("PAL B/G/H/I/D\r\n");
-						break;
-					case 0x05:
-						serial << _T("SECAM\r\n");
-						break;
-					case 0x06:
-						serial << _T("PAL Combination N\r\n");
-						break;
-					case 0x07:
-						serial << _T("SECAM 525\r\n");
-						break;
-					}
-					serial << _T("Color kill: ") << asdec(!!(new_status1 & 0x80))
-						<< _T("\r\n");
-
-	#if 1
 					uint8_t fsc[4] = { 0, 0, 0, 0 };
 					for (uint8_t i = 0; i < 4; ++i)
 						fsc[i] = I2C_READ_ONE(encoder.address, 0x8c + i);
@@ -988,66 +2031,33 @@ int main(void)
 					fsc32 |= (uint32_t)fsc[1] << 8ul;
 					fsc32 |= (uint32_t)fsc[0];
 
-					// Actually, the calculation is more involved.
-					// See the ADV7391 datasheet, section "SD Subcarrier frequency
-					// control"
-					serial << _T("Subcarrier frequency reg: 0x") << ashex(fsc32)
-						<< _T("\r\n");
-					serial << _T("Subcarrier frequency reg: ") << asdec(fsc32)
-						<< _T("\r\n");
-	#endif
-
-					serial << _T("\r\n");
+					// See video_standards::fsc_word().
+					LOG(LOG_FSC_READBACK, fsc32);
 	#endif // DEBUG
 					if ((dec_vstd == 0xffu) || (new_vstd != dec_vstd)) {
 						dec_vstd = new_vstd;
-						encoder_setup_needed = true;
+						apply_standard_tuning(dec_vstd);
 					}
 				}
 				dec_status1 = new_status1;
 
 	#if DEBUG
 				if (new_status2 != dec_status2) {
-					serial << _T("Status 2 changed:\r\n");
-					serial << _T("Macrovision color striping detected: ")
-						<< asdec(!!(new_status2 & 0x01)) << _T("\r\n");
-					serial << _T("Macrovision color striping type: ")
-						<< asdec(!!(new_status2 & 0x02)) << _T("\r\n");
-					serial << _T("Macrovision pseudo sync pulses detected: ")
-						<< asdec(!!(new_status2 & 0x04)) << _T("\r\n");
-					serial << _T("Macrovision AGC pulses detected: ")
-						<< asdec(!!(new_status2 & 0x08)) << _T("\r\n");
-					serial << _T("Line length nonstandard: ")
-						<< asdec(!!(new_status2 & 0x10)) << _T("\r\n");
-					serial << _T("fSC nonstandard: ")
-						<< asdec(!!(new_status2 & 0x20)) << _T("\r\n");
-					serial << _T("\r\n");
+					LOG(LOG_STATUS2, new_status2);
 				}
 				dec_status2 = new_status2;
 	#endif
 
 				if (new_status3 != dec_status3) {
-	#if DEBUG
-					serial << _T("Status 3 changed:\r\n");
-					serial << _T("Horizontal lock: ") << asdec(new_status3 & 0x01)
-						<< _T("\r\n");
-					serial << _T("Frequency: ")
-						<< ((new_status3 & 0x04) ? _T("50") : _T("60"))
-						<< _T("\r\n");
-					serial << _T("Freerun active: ")
-						<< asdec(!!(new_status3 & 0x10)) << _T("\r\n");
-					serial << _T("Field length standard: ")
-						<< asdec(!!(new_status3 & 0x20)) << _T("\r\n");
-					serial << _T("Interlaced: ")
-						<< asdec(!!(new_status3 & 0x40)) << _T("\r\n");
-					serial << _T("PAL SW lock: ")
-						<< asdec(!!(new_status3 & 0x80)) << _T("\r\n");
-					serial << _T("\r\n");
+	#if LOGGING
+					LOG(LOG_STATUS3, new_status3);
 	#endif
 				}
 				dec_status3 = new_status3;
 				bool lock_flag = !!(dec_status1 & 0x01)
 					/* && !!(new_status3 & 0x01) */;
+				if (lock_flag && dec_vstd < NUM_VSTD)
+					learned_vstd[input_to_phys[curr_input]] = dec_vstd;
 				bool ilace_flag = !!(dec_status3 & 0x40);
 				bool freerun_flag = !!(dec_status3 & 0x10);
 				if (freerun_flag !=
@@ -1077,24 +2087,16 @@ int main(void)
 				if (encoder_setup_needed)
 					setup_encoder();
 
-				// Clear all interrupt flags...
-				if (got_interrupt) {
-					decoder.select_submap(DEC_SUBMAP_INTR_VDP);
-					decoder.interrupt_clear1(true, true, true, true, false);
-					decoder.interrupt_clear2(true, true, true, true, false);
-					decoder.interrupt_clear3(
-						true, true, true, true, true, true, false);
-					decoder.select_submap(DEC_SUBMAP_USER);
-				}
-
-				// ... but check the status registers once more in case something
-				// happened in the meanwhile.
-				check_once_more = got_interrupt;
+				// Check the status registers once more after a change, for
+				// what settles without an interrupt of its own, e.g. the
+				// interlace status after lock.
+				check_once_more = status_changed;
 			}
-			_delay_ms(10);
+			PROFILE_END(PROF_LOOP);
+			delay_ms(10);
 		}
 
-		I2c_HW.deinit();
+		i2c_deinit();
 
 		return 0;
 }
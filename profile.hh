@@ -0,0 +1,48 @@
+#ifndef KORYUU_PROFILE_HH
+#define KORYUU_PROFILE_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+
+// Section markers for cycle counting under simavr (host/simavr/): the
+// section id is written to GPIOR0 when a section is entered, with
+// PROFILE_END set when it is left. Sections nest, and the interrupts
+// that hit a section count towards it.
+namespace koryuu {
+    constexpr uint8_t PROFILE_END = 0x80;
+
+    // Keep in sync with SECTIONS in host/simavr/koryuu_simavr.cpp.
+    enum ProfileSection : uint8_t {
+        PROF_TICK_ISR = 1,
+        PROF_UDRE_ISR,
+        PROF_RX_ISR,
+        PROF_LOOP,         // One main loop iteration without the delay
+        PROF_STATUS_POLL,  // Status register check and reaction
+        PROF_SETUP_ENCODER,
+        PROF_SETUP_VIDEO,
+        PROF_INTERRUPT,    // Decoder interrupt read, clear and dispatch
+    };
+
+    inline void profile_begin(ProfileSection s)
+    {
+        hal::profile_mark(s);
+    }
+
+    inline void profile_end(ProfileSection s)
+    {
+        hal::profile_mark(s | PROFILE_END);
+    }
+
+    // Marks the enclosing scope.
+    class ProfileScope {
+        const ProfileSection section;
+    public:
+        YAAL_INLINE("ProfileScope()")
+        ProfileScope(ProfileSection s) : section(s) { profile_begin(s); }
+        YAAL_INLINE("~ProfileScope()")
+        ~ProfileScope() { profile_end(section); }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_PROFILE_HH
@@ -0,0 +1,158 @@
+#ifndef KORYUU_SCRUBBER_HH
+#define KORYUU_SCRUBBER_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+#include "adv7280.hh"
+#include "i2c_helpers.hh"
+
+// Register scrubbing: a brownout or an ESD hit can reset a chip to its
+// defaults without the MCU noticing. The scrubber follows the writes to
+// a few critical registers and reads them back one at a time; a
+// register that no longer holds what was written means the chip lost
+// its configuration.
+namespace koryuu {
+    enum ScrubChip : uint8_t {
+        SCRUB_DECODER = 0,
+        SCRUB_ENCODER = 1,
+        SCRUB_NONE = 0xff,
+    };
+
+    struct ScrubReg {
+        ScrubChip chip;
+        uint8_t reg;
+    };
+
+    constexpr uint8_t NUM_SCRUB_REGS = 10;
+
+    // In the order they are read back. Decoder registers are in the user
+    // map. All of them read back as written.
+    constexpr hal::FlashTable<ScrubReg, NUM_SCRUB_REGS> SCRUB_REGS
+            HAL_PROGMEM = {{
+        { SCRUB_DECODER, 0x00 }, // Input control
+        { SCRUB_ENCODER, 0x00 }, // Power mode
+        { SCRUB_DECODER, 0x02 }, // Autodetect enable (IRE mode pedestal)
+        { SCRUB_ENCODER, 0x02 }, // Mode 0 (color space)
+        { SCRUB_DECODER, 0x03 }, // Output control
+        { SCRUB_ENCODER, 0x80 }, // SD mode 1 (standard)
+        { SCRUB_ENCODER, 0x82 }, // SD mode 2 (output format, pedestal)
+        { SCRUB_ENCODER, 0x87 }, // SD mode 6 (brightness control)
+        { SCRUB_ENCODER, 0xa1 }, // SD brightness (IRE mode)
+        { SCRUB_ENCODER, 0x0b }, // DAC output levels (IRE mode)
+    }};
+
+    class Scrubber {
+        const uint8_t dec_addr;
+        const uint8_t enc_addr;
+        uint8_t expected[NUM_SCRUB_REGS];
+        uint16_t known;   // Bit per register written since the chip reset
+        uint8_t submap;   // Decoder submap last selected
+        uint8_t next;     // Register to read back next
+        uint16_t repairs[2];
+
+        static_assert(NUM_SCRUB_REGS <= 16, "known mask is too small");
+
+        void forget(ScrubChip chip) {
+            for (uint8_t i = 0; i < NUM_SCRUB_REGS; ++i)
+                if (SCRUB_REGS[i].chip == chip)
+                    known &= ~(1u << i);
+        }
+
+    public:
+        Scrubber(uint8_t dec, uint8_t enc)
+            : dec_addr(dec), enc_addr(enc), known(0),
+              submap(ad_decoder::DEC_SUBMAP_USER), next(0), repairs{ 0, 0 }
+        {}
+
+        // Follows a register write, see I2C_set_write_hook(). A software
+        // reset forgets what was written to the chip.
+        void note_write(uint8_t addr, uint8_t reg, uint8_t v) {
+            ScrubChip chip;
+            if (addr == dec_addr) {
+                if (reg == 0x0e) {
+                    submap = v;
+                    return;
+                }
+                if (reg == 0x0f && (v & 0x80)) {
+                    forget(SCRUB_DECODER);
+                    return;
+                }
+                if (submap != ad_decoder::DEC_SUBMAP_USER)
+                    return;
+                chip = SCRUB_DECODER;
+            }
+            else if (addr == enc_addr) {
+                if (reg == 0x17 && (v & 0x02)) {
+                    forget(SCRUB_ENCODER);
+                    return;
+                }
+                chip = SCRUB_ENCODER;
+            }
+            else {
+                return;
+            }
+            for (uint8_t i = 0; i < NUM_SCRUB_REGS; ++i) {
+                const ScrubReg r = SCRUB_REGS[i];
+                if (r.chip == chip && r.reg == reg) {
+                    expected[i] = v;
+                    known |= 1u << i;
+                    return;
+                }
+            }
+        }
+
+        // Reads back the next register written since its chip was reset.
+        // A register read twice with a value other than the one written
+        // is an incident: returns its chip, with the register and the
+        // values in reg, want and got. SCRUB_NONE otherwise.
+        ScrubChip step(uint8_t &reg, uint8_t &want, uint8_t &got) {
+            for (uint8_t n = 0; n < NUM_SCRUB_REGS; ++n) {
+                const uint8_t i = next;
+                next = next < NUM_SCRUB_REGS - 1 ? next + 1 : 0;
+                if (!(known & (1u << i)))
+                    continue;
+                const ScrubReg r = SCRUB_REGS[i];
+                if (r.chip == SCRUB_DECODER &&
+                    submap != ad_decoder::DEC_SUBMAP_USER)
+                {
+                    continue;
+                }
+                const uint8_t addr =
+                    r.chip == SCRUB_DECODER ? dec_addr : enc_addr;
+                got = i2c_helpers::I2C_READ_ONE(addr, r.reg);
+                // Once more, a single bad read is not worth a repair.
+                if (got == expected[i] ||
+                    (got = i2c_helpers::I2C_READ_ONE(addr, r.reg)) ==
+                        expected[i])
+                {
+                    return SCRUB_NONE;
+                }
+                reg = r.reg;
+                want = expected[i];
+                if (repairs[r.chip] != 0xffff)
+                    ++repairs[r.chip];
+                return r.chip;
+            }
+            return SCRUB_NONE;
+        }
+
+        // Writes the scrubbed registers of a chip as last written. The
+        // decoder user map must be selected, as it is after step().
+        void restore(ScrubChip chip) const {
+            const uint8_t addr = chip == SCRUB_DECODER ? dec_addr : enc_addr;
+            for (uint8_t i = 0; i < NUM_SCRUB_REGS; ++i) {
+                const ScrubReg r = SCRUB_REGS[i];
+                if (r.chip == chip && (known & (1u << i)))
+                    i2c_helpers::I2C_WRITE(addr, r.reg, expected[i]);
+            }
+        }
+
+        YAAL_INLINE("Scrubber::repair_count()")
+        uint16_t repair_count(ScrubChip chip) const {
+            return repairs[chip];
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_SCRUBBER_HH
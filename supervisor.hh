@@ -0,0 +1,141 @@
+#ifndef KORYUU_SUPERVISOR_HH
+#define KORYUU_SUPERVISOR_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+
+// Watchdog supervision: the watchdog runs from reset on and is kicked
+// at progress checkpoints, each naming the stage the firmware is in.
+// The stage survives the watchdog reset in .noinit RAM, and the next
+// boot records it with the reset flags (MCUSR) and the last I2C
+// transfer started into a ring in the EEPROM, read over the control
+// protocol (CMD_FAULTS).
+namespace koryuu {
+    enum Stage : uint8_t {
+        STAGE_BOOT = 0,     // Reset until the chips are powered up
+        STAGE_INIT = 1,     // Settings and the first video setup
+        STAGE_LOOP = 2,     // Main loop
+        STAGE_RECONFIG = 3, // Chip reset and setup
+        STAGE_UNKNOWN = 0x7f, // No valid checkpoint survived the reset
+    };
+    // Or'ed to the stage by a panic (a failed I2C write).
+    constexpr uint8_t STAGE_PANIC = 0x80;
+
+    // MCUSR bits.
+    constexpr uint8_t RESET_POWER_ON = 0x01;
+    constexpr uint8_t RESET_EXTERNAL = 0x02;
+    constexpr uint8_t RESET_BROWN_OUT = 0x04;
+    constexpr uint8_t RESET_WATCHDOG = 0x08;
+
+    struct FaultRecord {
+        uint8_t seq;   // Increments by one per record, wrapping
+        uint8_t mcusr;
+        uint8_t stage;
+        uint8_t i2c_addr;
+        uint8_t i2c_args; // As i2c_err_func() gets it, 0 for a read
+        uint8_t check;    // See checksum()
+    } __attribute__((packed));
+    static_assert(sizeof(FaultRecord) == 6, "FaultRecord size is wrong!");
+
+    constexpr uint8_t FAULT_RING_LEN = 8;
+
+    // Both an erased (0xff) and a zeroed record fail the check.
+    inline uint8_t checksum(const FaultRecord &r)
+    {
+        return ~(r.seq ^ r.mcusr ^ r.stage ^ r.i2c_addr ^ r.i2c_args);
+    }
+
+    // The checkpoint, in .noinit: garbage after a power-on reset, hence
+    // the complement.
+    struct Checkpoint {
+        uint8_t stage;
+        uint8_t inverse;
+    };
+    HAL_NOINIT Checkpoint checkpoint;
+
+    inline void checkpoint_set(uint8_t stage)
+    {
+        checkpoint.stage = stage;
+        checkpoint.inverse = ~stage;
+        hal::watchdog_kick();
+    }
+
+    inline uint8_t checkpoint_stage()
+    {
+        return (uint8_t)~checkpoint.inverse == checkpoint.stage ?
+            (uint8_t)checkpoint.stage : (uint8_t)STAGE_UNKNOWN;
+    }
+
+    // Puts the enclosing scope in a stage, back to the outer one after.
+    class CheckpointScope {
+        const uint8_t outer;
+    public:
+        YAAL_INLINE("CheckpointScope()")
+        CheckpointScope(Stage s) : outer(checkpoint.stage)
+        {
+            checkpoint_set(s);
+        }
+        YAAL_INLINE("~CheckpointScope()")
+        ~CheckpointScope() { checkpoint_set(outer); }
+    };
+
+    // The fault ring in the EEPROM. Records are written in slot order,
+    // so the newest is the end of the run of consecutive sequence
+    // numbers that starts at slot 0.
+    class FaultLog {
+        /* EEMEM */ FaultRecord *const eeprom_ring;
+
+        bool load(uint8_t slot, FaultRecord &r) const {
+            hal::eeprom_read(&r, &eeprom_ring[slot], sizeof(r));
+            return r.check == checksum(r);
+        }
+
+        // FAULT_RING_LEN if empty.
+        uint8_t newest(uint8_t &seq) const {
+            uint8_t n = FAULT_RING_LEN;
+            FaultRecord r;
+            for (uint8_t i = 0; i < FAULT_RING_LEN; ++i) {
+                if (!load(i, r))
+                    continue;
+                if (n == FAULT_RING_LEN || r.seq == (uint8_t)(seq + 1)) {
+                    n = i;
+                    seq = r.seq;
+                }
+            }
+            return n;
+        }
+
+    public:
+        FaultLog(/* EEMEM */ FaultRecord *const eep_r)
+            : eeprom_ring(eep_r)
+        {}
+
+        void record(FaultRecord r) {
+            uint8_t seq = 0xff;
+            const uint8_t n = newest(seq);
+            r.seq = seq + 1;
+            r.check = checksum(r);
+            const uint8_t slot = n < FAULT_RING_LEN - 1 ? n + 1 : 0;
+            hal::eeprom_update(&r, &eeprom_ring[slot], sizeof(r));
+        }
+
+        // Age 0 is the newest record. Returns false past the oldest.
+        bool get(uint8_t age, FaultRecord &r) const {
+            uint8_t seq = 0;
+            const uint8_t n = newest(seq);
+            if (n == FAULT_RING_LEN || age >= FAULT_RING_LEN)
+                return false;
+            const uint8_t slot = (n + FAULT_RING_LEN - age) % FAULT_RING_LEN;
+            return load(slot, r) && r.seq == (uint8_t)(seq - age);
+        }
+
+        void clear() {
+            const FaultRecord empty = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+            for (uint8_t i = 0; i < FAULT_RING_LEN; ++i)
+                hal::eeprom_update(&empty, &eeprom_ring[i], sizeof(empty));
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_SUPERVISOR_HH
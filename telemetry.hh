@@ -0,0 +1,219 @@
+#ifndef KORYUU_TELEMETRY_HH
+#define KORYUU_TELEMETRY_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include <string.h>
+#include "crc32.hh"
+
+namespace koryuu {
+    // Signal quality telemetry, sampled from the decoder status
+    // registers 0x10, 0x12 and 0x13. Dumped over the serial link in the
+    // binary format described at Telemetry::dump(), see
+    // tools/koryuu_telemetry.py.
+    enum TelemetryCounter : uint8_t {
+        TC_LOCK_LOSSES = 0,
+        TC_FSC_UNLOCKS,
+        TC_FREERUN_ENTRIES,
+        TC_COLOR_KILL_TOGGLES,
+        TC_MACROVISION,
+        TC_STD_CHANGES,
+        NUM_TELEMETRY_COUNTERS,
+    };
+
+    enum TelemetryEvent : uint8_t {
+        TE_LOCK_LOST = 0,     // Value: status 1
+        TE_LOCK_GAINED,       // Value: dropout histogram bucket
+        TE_FSC_UNLOCK,        // Value: status 1
+        TE_FREERUN,           // Value: 1 entered, 0 left
+        TE_COLOR_KILL,        // Value: 1 on, 0 off
+        TE_MACROVISION,       // Value: status 2 bits 3:0
+        TE_STD_CHANGE,        // Value: new video standard
+    };
+
+    struct TelemetryEntry {
+        uint16_t tick;
+        TelemetryEvent type;
+        uint8_t value;
+    } __attribute__((packed));
+
+    constexpr uint8_t TELEMETRY_VERSION = 1;
+    constexpr uint8_t TELEMETRY_RING_SIZE = 16;
+    // Dropout durations, bucket i counts dropouts shorter than
+    // 2^(i + 3) ticks; the last bucket counts the longer ones.
+    constexpr uint8_t TELEMETRY_HIST_BUCKETS = 8;
+    // Shortest dropout of the last bucket.
+    constexpr uint16_t TELEMETRY_LONG_DROPOUT =
+        1u << (TELEMETRY_HIST_BUCKETS + 1);
+
+    class Telemetry {
+        struct Data {
+            uint16_t tick_us;
+            uint16_t now;
+            uint16_t counters[NUM_TELEMETRY_COUNTERS];
+            uint16_t dropout_hist[TELEMETRY_HIST_BUCKETS];
+            uint8_t ring_count;
+            TelemetryEntry ring[TELEMETRY_RING_SIZE];
+        } __attribute__((packed)) d;
+        uint8_t ring_head;
+        uint8_t prev_status1;
+        uint8_t prev_status2;
+        uint8_t prev_status3;
+        uint16_t unlocked_since;
+        bool long_dropout; // Past TELEMETRY_LONG_DROPOUT, see age()
+        bool sampled;
+
+        void event(TelemetryEvent type, uint8_t value, uint16_t now) {
+            TelemetryEntry &e = d.ring[ring_head];
+            e.tick = now;
+            e.type = type;
+            e.value = value;
+            ring_head = (ring_head + 1) % TELEMETRY_RING_SIZE;
+            if (d.ring_count < TELEMETRY_RING_SIZE)
+                ++d.ring_count;
+        }
+
+        void count(TelemetryCounter c) {
+            if (d.counters[c] != 0xffffu)
+                ++d.counters[c];
+        }
+
+        static uint8_t dropout_bucket(uint16_t ticks) {
+            uint8_t b = 0;
+            ticks >>= 3;
+            while (ticks && b < TELEMETRY_HIST_BUCKETS - 1) {
+                ticks >>= 1;
+                ++b;
+            }
+            return b;
+        }
+
+    public:
+        Telemetry(uint16_t tick_us) {
+            memset(&d, 0, sizeof(d));
+            d.tick_us = tick_us;
+            ring_head = 0;
+            prev_status1 = prev_status2 = prev_status3 = 0;
+            unlocked_since = 0;
+            long_dropout = false;
+            sampled = false;
+        }
+
+        // Marks the current dropout as one for the last bucket once it
+        // gets there, before its 16-bit length can wrap. To be called
+        // more often than every 65535 - TELEMETRY_LONG_DROPOUT ticks,
+        // also while no status is sampled.
+        void age(uint16_t now) {
+            if (sampled && !(prev_status1 & 0x01) &&
+                    (uint16_t)(now - unlocked_since) >=
+                        TELEMETRY_LONG_DROPOUT)
+                long_dropout = true;
+        }
+
+        void sample(uint8_t status1, uint8_t status2, uint8_t status3,
+                uint16_t now) {
+            if (!sampled) {
+                sampled = true;
+                prev_status1 = status1;
+                prev_status2 = status2;
+                prev_status3 = status3;
+                return;
+            }
+
+            const uint8_t ch1 = status1 ^ prev_status1;
+            const uint8_t ch2 = status2 ^ prev_status2;
+            const uint8_t ch3 = status3 ^ prev_status3;
+            const bool locked = status1 & 0x01;
+
+            if (ch1 & 0x01) {
+                if (locked) {
+                    age(now);
+                    const uint8_t b = long_dropout ?
+                        TELEMETRY_HIST_BUCKETS - 1 :
+                        dropout_bucket((uint16_t)(now - unlocked_since));
+                    if (d.dropout_hist[b] != 0xffffu)
+                        ++d.dropout_hist[b];
+                    event(TE_LOCK_GAINED, b, now);
+                }
+                else {
+                    unlocked_since = now;
+                    long_dropout = false;
+                    count(TC_LOCK_LOSSES);
+                    event(TE_LOCK_LOST, status1, now);
+                }
+            }
+            if ((ch1 & 0x04) && locked && !(status1 & 0x04)) {
+                count(TC_FSC_UNLOCKS);
+                event(TE_FSC_UNLOCK, status1, now);
+            }
+            if (ch3 & 0x10) {
+                if (status3 & 0x10)
+                    count(TC_FREERUN_ENTRIES);
+                event(TE_FREERUN, !!(status3 & 0x10), now);
+            }
+            if (ch1 & 0x80) {
+                count(TC_COLOR_KILL_TOGGLES);
+                event(TE_COLOR_KILL, !!(status1 & 0x80), now);
+            }
+            if ((ch2 & 0x0f) && (status2 & 0x0f)) {
+                count(TC_MACROVISION);
+                event(TE_MACROVISION, status2 & 0x0f, now);
+            }
+            if ((ch1 & 0x70) && locked) {
+                count(TC_STD_CHANGES);
+                event(TE_STD_CHANGE, (status1 >> 4) & 0x07, now);
+            }
+
+            prev_status1 = status1;
+            prev_status2 = status2;
+            prev_status3 = status3;
+        }
+
+        YAAL_INLINE("Telemetry::counter()")
+        uint16_t counter(TelemetryCounter c) const {
+            return d.counters[c];
+        }
+
+        void reset() {
+            const uint16_t tick_us = d.tick_us;
+            memset(&d, 0, sizeof(d));
+            d.tick_us = tick_us;
+            ring_head = 0;
+        }
+
+        // Frame: 'K' 'T' version length payload crc32(payload), all
+        // little endian. Payload: tick length in us, current tick,
+        // counters, dropout histogram, number of ring entries, and the
+        // ring entries oldest first (tick, event, value).
+        template<typename Put>
+        void dump(uint16_t now, Put put) {
+            d.now = now;
+            const uint8_t hdr[] = { 'K', 'T', TELEMETRY_VERSION,
+                (uint8_t)(offsetof(Data, ring)
+                    + d.ring_count * sizeof(TelemetryEntry)) };
+            for (uint8_t i = 0; i < sizeof(hdr); ++i)
+                put(hdr[i]);
+
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(&d);
+            uint32_t crc = crc::crc32(p, offsetof(Data, ring));
+            for (uint8_t i = 0; i < offsetof(Data, ring); ++i)
+                put(p[i]);
+
+            uint8_t idx = (ring_head + TELEMETRY_RING_SIZE - d.ring_count)
+                % TELEMETRY_RING_SIZE;
+            for (uint8_t n = 0; n < d.ring_count; ++n) {
+                const TelemetryEntry &e = d.ring[idx];
+                crc = crc::crc32(&e, sizeof(e), &crc);
+                p = reinterpret_cast<const uint8_t *>(&e);
+                for (uint8_t i = 0; i < sizeof(e); ++i)
+                    put(p[i]);
+                idx = (idx + 1) % TELEMETRY_RING_SIZE;
+            }
+
+            for (uint8_t i = 0; i < 4; ++i)
+                put((uint8_t)(crc >> (8 * i)));
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_TELEMETRY_HH
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Koryuu control CLI: register dumps, batched register writes and live
+tuning over the serial port (see koryuu_proto.hh).
+
+    koryuu_ctl.py -p /dev/ttyUSB0 ping
+    koryuu_ctl.py -p /dev/ttyUSB0 dump user
+    koryuu_ctl.py -p /dev/ttyUSB0 write user:0x39=0xe4 encoder:0x83=0x74
+    koryuu_ctl.py -p /dev/ttyUSB0 get [VAR...]
+    koryuu_ctl.py -p /dev/ttyUSB0 set mode_ire=2 noise_reduction=3
+    koryuu_ctl.py -p /dev/ttyUSB0 save 0
+    koryuu_ctl.py -p /dev/ttyUSB0 faults [--clear]
+
+A batch of writes is applied as a whole, or not at all if any of it is
+invalid. 'save' stores the current state into a preset slot and makes
+it the boot default. 'faults' lists the resets by the watchdog or a
+brown-out, newest first (see supervisor.hh).
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import koryuu_log as kl
+import koryuu_proto as kp
+
+
+class ControlError(Exception):
+    pass
+
+
+class Device:
+    def __init__(self, port, timeout=2.0):
+        self.s = kp.Port(port)
+        self.timeout = timeout
+        self.parser = kp.Parser(kp.RESPONSE)
+
+    def call(self, cmd, payload=b""):
+        if len(payload) > kp.MAX_PAYLOAD:
+            raise ControlError("request too long")
+        self.s.write(kp.request(cmd, payload))
+        deadline = time.time() + self.timeout
+        while time.time() < deadline:
+            for rcmd, data, ok in self.parser.feed(self.s.read(512)):
+                if not ok:
+                    raise ControlError("response CRC mismatch")
+                if rcmd != cmd or not data:
+                    continue
+                if data[0] != kp.PS_OK:
+                    raise ControlError(kp.STATUS[data[0]]
+                                       if data[0] < len(kp.STATUS)
+                                       else "status %d" % data[0])
+                return data[1:]
+        raise ControlError("no response")
+
+    def ping(self):
+        d = self.call(kp.CMD_PING)
+        return d[0], d[1], d[2], d[3:].decode("ascii", "replace")
+
+    def dump(self, m):
+        d = self.call(kp.CMD_DUMP_MAP, bytes([m]))
+        return d[1:]
+
+    def write(self, writes):
+        payload = b"".join(bytes(w) for w in writes)
+        return self.call(kp.CMD_WRITE_BATCH, payload)[0]
+
+    def get(self, var):
+        return struct.unpack("<Bh", self.call(kp.CMD_GET_VAR,
+                                              bytes([var])))[1]
+
+    def set(self, var, value):
+        return struct.unpack("<Bh", self.call(
+            kp.CMD_SET_VAR, struct.pack("<Bh", var, value)))[1]
+
+    def save(self, slot):
+        return self.call(kp.CMD_SAVE, bytes([slot]))[0]
+
+    def faults(self, clear=False):
+        d = self.call(kp.CMD_FAULTS,
+                      bytes([kp.FAULTS_CLEAR if clear else 0]))
+        return [tuple(d[i:i + 5]) for i in range(1, 1 + 5 * d[0], 5)]
+
+
+def lookup(names, name):
+    if name in names:
+        return names.index(name)
+    try:
+        return int(name, 0)
+    except ValueError:
+        raise ControlError("unknown name %s, one of: %s"
+                           % (name, ", ".join(names)))
+
+
+def parse_write(arg):
+    try:
+        where, value = arg.split("=")
+        m, reg = where.split(":")
+        return lookup(kp.MAPS, m), int(reg, 0), int(value, 0)
+    except ValueError:
+        raise ControlError("bad write %s, expected MAP:REG=VALUE" % arg)
+
+
+def hexdump(data, out):
+    for row in range(0, len(data), 16):
+        out.write("%02x: %s\n" % (row, " ".join(
+            "%02x" % b for b in data[row:row + 16])))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("-p", "--port", required=True,
+                    help="serial port, or the pty of koryuu_standin.py")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    sub.add_parser("ping")
+    d = sub.add_parser("dump")
+    d.add_argument("map", help=", ".join(kp.MAPS))
+    w = sub.add_parser("write")
+    w.add_argument("writes", nargs="+", metavar="MAP:REG=VALUE")
+    g = sub.add_parser("get")
+    g.add_argument("vars", nargs="*", help=", ".join(kp.VARS))
+    s = sub.add_parser("set")
+    s.add_argument("vars", nargs="+", metavar="VAR=VALUE")
+    v = sub.add_parser("save")
+    v.add_argument("slot", type=int)
+    f = sub.add_parser("faults")
+    f.add_argument("--clear", action="store_true",
+                   help="clear the log after reading it")
+    args = ap.parse_args()
+
+    try:
+        dev = Device(args.port)
+        if args.cmd == "ping":
+            ver, maps, nvars, fw = dev.ping()
+            print("protocol %d, %d maps, %d variables, firmware %s"
+                  % (ver, maps, nvars, fw))
+        elif args.cmd == "dump":
+            hexdump(dev.dump(lookup(kp.MAPS, args.map)), sys.stdout)
+        elif args.cmd == "write":
+            writes = [parse_write(a) for a in args.writes]
+            print("%d registers written" % dev.write(writes))
+        elif args.cmd == "get":
+            names = args.vars or kp.VARS
+            for n in names:
+                print("%s = %d" % (n, dev.get(lookup(kp.VARS, n))))
+        elif args.cmd == "set":
+            for a in args.vars:
+                n, _, value = a.partition("=")
+                print("%s = %d" % (n, dev.set(lookup(kp.VARS, n),
+                                              int(value, 0))))
+        elif args.cmd == "save":
+            print("saved to preset %d" % dev.save(args.slot))
+        elif args.cmd == "faults":
+            for seq, mcusr, stage, addr, nargs in dev.faults(args.clear):
+                print("#%d: reset by %s in %s, last I2C transfer to "
+                      "0x%02x with %d arguments"
+                      % (seq, kl.mcusr(mcusr), kl.stage(stage), addr,
+                         nargs))
+    except ControlError as e:
+        sys.exit("error: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Expand the Koryuu tokenized log.
+
+The firmware sends log records ('K' 'L' id length arguments, see
+koryuu_log.hh) instead of text. This tool expands them with the message
+table generated from log_messages.def at build time.
+
+    koryuu_log.py table log_messages.def > koryuu-fw_log.json
+    koryuu_log.py decode --table koryuu-fw_log.json --port /dev/ttyUSB0
+    koryuu_log.py decode --table log_messages.def --file capture.bin
+
+Telemetry frames (see koryuu_telemetry.py) are skipped, any other bytes
+are passed through as text.
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+STANDARDS = ["NTSC M/J", "NTSC 4.43", "PAL M", "PAL 60", "PAL B/G/H/I/D",
+             "SECAM", "PAL Combination N", "SECAM 525"]
+
+
+def flags(v, names):
+    return ", ".join("%s %d" % (name, (v >> bit) & 1)
+                     for bit, name in names)
+
+
+def status1(v):
+    return "%s, video standard %s, %s" % (
+        flags(v, [(0, "in lock"), (1, "lost lock"), (2, "fSC lock"),
+                  (3, "follow PW")]),
+        STANDARDS[(v >> 4) & 7], flags(v, [(7, "color kill")]))
+
+
+def status2(v):
+    return flags(v, [(0, "Macrovision color striping detected"),
+                     (1, "Macrovision color striping type"),
+                     (2, "Macrovision pseudo sync pulses detected"),
+                     (3, "Macrovision AGC pulses detected"),
+                     (4, "line length nonstandard"),
+                     (5, "fSC nonstandard")])
+
+
+def status3(v):
+    return "horizontal lock %d, frequency %s, %s" % (
+        v & 1, "50" if v & 0x04 else "60",
+        flags(v, [(4, "freerun active"), (5, "field length standard"),
+                  (6, "interlaced"), (7, "PAL SW lock")]))
+
+
+def names(*n):
+    return lambda v: n[v] if v < len(n) else str(v)
+
+
+RESET_FLAGS = ["power-on", "reset pin", "brown-out", "watchdog"]
+STAGES = ["boot", "init", "main loop", "reconfiguration"]
+
+
+def mcusr(v):
+    return ", ".join(n for bit, n in enumerate(RESET_FLAGS)
+                     if v >> bit & 1) or "none"
+
+
+def stage(v):
+    s = STAGES[v & 0x7f] if v & 0x7f < len(STAGES) else (
+        "unknown" if v & 0x7f == 0x7f else str(v & 0x7f))
+    return s + (" (I2C write failed)" if v & 0x80 else "")
+
+
+def gesture(v):
+    if v == 0x40:
+        return "chord"
+    kinds = {0x10: "press", 0x20: "double press", 0x30: "long press"}
+    return "%s %s" % (("input", "option")[v & 1],
+                      kinds.get(v & 0xf0, "0x%02x" % v))
+
+
+DECODERS = {
+    "phys_input": names("CVBS", "SVIDEO", "COMPONENT"),
+    "i2p_mode": names("off", "line doubling", "deinterlacing"),
+    "lock_state": names("SCANNING", "ACQUIRING", "LOCKED", "HOLDOVER",
+                        "LOST"),
+    "comb_mode": names("Adaptive comb", "Notch"),
+    "field": names("odd", "even"),
+    "wake_cause": names("signal probe", "button", "control request"),
+    "mcusr": mcusr,
+    "chip": names("Decoder", "Encoder"),
+    "gesture": gesture,
+    "stage": stage,
+    "vstd": names(*STANDARDS),
+    "status1": status1,
+    "status2": status2,
+    "status3": status3,
+}
+
+SIZES = {"u8": 1, "x8": 1, "bool": 1, "u16": 2, "x16": 2,
+         "u32": 4, "x32": 4}
+PLACEHOLDER = re.compile(r"\{(\w+)(?::(\w+))?\}")
+MSG = re.compile(r"LOG_MSG\(\s*(\w+)\s*,((?:\s*\"(?:[^\"\\]|\\.)*\")+)\s*\)")
+
+
+def parse_def(text):
+    text = re.sub(r"//[^\n]*", "", text)
+    table = []
+    for m in MSG.finditer(text):
+        fmt = "".join(re.findall(r"\"((?:[^\"\\]|\\.)*)\"", m.group(2)))
+        table.append({"id": len(table), "name": m.group(1), "format": fmt})
+    return table
+
+
+def load_table(path):
+    with open(path) as f:
+        text = f.read()
+    if path.endswith(".json"):
+        return json.loads(text)
+    return parse_def(text)
+
+
+def expand(fmt, args):
+    pos = 0
+
+    def field(m):
+        nonlocal pos
+        kind, decoder = m.group(1), m.group(2)
+        if kind in ("str", "bytes"):
+            rest, pos = args[pos:], len(args)
+            if kind == "str":
+                return rest.decode("latin-1").rstrip()
+            return " ".join("0x%02x" % b for b in rest)
+        n = SIZES[kind]
+        if pos + n > len(args):
+            raise ValueError("record too short")
+        v = int.from_bytes(args[pos:pos + n], "little")
+        pos += n
+        if decoder:
+            return DECODERS.get(decoder, str)(v)
+        if kind.startswith("x"):
+            return "%0*x" % (2 * n, v)
+        return str(v)
+
+    text = PLACEHOLDER.sub(field, fmt)
+    if pos != len(args):
+        raise ValueError("record has %d extra bytes" % (len(args) - pos))
+    return text
+
+
+def records(buf, table):
+    """Splits buf into text and expanded records. Returns the lines and
+    the bytes left over at the end (an incomplete record)."""
+    out = []
+    text = bytearray()
+    i = 0
+    while i < len(buf):
+        tag = buf[i:i + 2]
+        if tag in (b"KL", b"KT") and len(buf) < i + 4:
+            break
+        if tag == b"KL":
+            mid, n = buf[i + 2], buf[i + 3]
+            if len(buf) < i + 4 + n:
+                break
+            args = bytes(buf[i + 4:i + 4 + n])
+            if text:
+                out.append(text.decode("latin-1"))
+                text = bytearray()
+            if mid < len(table):
+                try:
+                    out.append(expand(table[mid]["format"], args) + "\n")
+                except ValueError as e:
+                    out.append("<%s: %s>\n" % (table[mid]["name"], e))
+            else:
+                out.append("<unknown log id %d: %s>\n" % (mid, args.hex()))
+            i += 4 + n
+        elif tag == b"KT":
+            n = buf[i + 3]
+            if len(buf) < i + 4 + n + 4:
+                break
+            out.append("<telemetry frame>\n")
+            i += 4 + n + 4
+        else:
+            text.append(buf[i])
+            i += 1
+    if text:
+        out.append(text.decode("latin-1"))
+    return out, bytes(buf[i:])
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    t = sub.add_parser("table", help="generate the message table")
+    t.add_argument("defs", help="log_messages.def")
+    d = sub.add_parser("decode", help="expand a log")
+    d.add_argument("--table", required=True,
+                   help="generated table, or log_messages.def")
+    src = d.add_mutually_exclusive_group(required=True)
+    src.add_argument("--port", help="serial port of the Koryuu")
+    src.add_argument("--file", help="captured serial output")
+    args = ap.parse_args()
+
+    if args.cmd == "table":
+        with open(args.defs) as f:
+            json.dump(parse_def(f.read()), sys.stdout, indent=1)
+        sys.stdout.write("\n")
+        return
+
+    table = load_table(args.table)
+    if args.file:
+        with open(args.file, "rb") as f:
+            lines, rest = records(f.read(), table)
+        sys.stdout.write("".join(lines))
+        return
+
+    import serial  # pyserial
+    pending = b""
+    with serial.Serial(args.port, 9600, timeout=0.2) as s:
+        while True:
+            lines, pending = records(pending + s.read(256), table)
+            sys.stdout.write("".join(lines))
+            sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
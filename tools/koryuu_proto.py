@@ -0,0 +1,126 @@
+"""Framing of the Koryuu binary control protocol (see koryuu_proto.hh).
+
+Frame: 'K' type command length(u16) payload crc32, little endian. The
+CRC (zlib crc32) covers command, length and payload. Requests have type
+'C', responses type 'R' and the status as the first payload byte.
+"""
+
+import struct
+import zlib
+
+VERSION = 1
+REQUEST = b"C"
+RESPONSE = b"R"
+MAX_PAYLOAD = 60
+
+CMD_PING = 0x00
+CMD_DUMP_MAP = 0x01
+CMD_WRITE_BATCH = 0x02
+CMD_GET_VAR = 0x03
+CMD_SET_VAR = 0x04
+CMD_SAVE = 0x05
+CMD_FAULTS = 0x06
+
+FAULTS_CLEAR = 0x01
+
+STATUS = ["ok", "bad CRC", "unknown command", "bad argument", "too long"]
+PS_OK, PS_BAD_CRC, PS_UNKNOWN_COMMAND, PS_BAD_ARGUMENT, PS_TOO_LONG = \
+    range(5)
+
+MAPS = ["user", "user2", "intr_vdp", "map80", "vpp", "encoder"]
+VARS = ["input", "mode_ire", "noise_reduction", "i2p_mode",
+        "component_output", "rgb_color", "fsc_trim", "stack_unused",
+        "static_ram", "decoder_repairs", "encoder_repairs", "scanning_s",
+        "acquiring_s", "locked_s", "holdover_s", "lost_s", "i2p_latency_us"]
+NUM_PRESETS = 4
+
+
+def frame(kind, cmd, payload):
+    body = struct.pack("<BH", cmd, len(payload)) + bytes(payload)
+    return b"K" + kind + body + struct.pack("<I", zlib.crc32(body))
+
+
+def request(cmd, payload=b""):
+    return frame(REQUEST, cmd, payload)
+
+
+def response(cmd, status, data=b""):
+    return frame(RESPONSE, cmd, bytes([status]) + bytes(data))
+
+
+class Parser:
+    """Splits a byte stream into frames of one type. Log records ('K'
+    'L') and telemetry frames ('K' 'T') are skipped, other bytes are
+    collected in self.other."""
+
+    def __init__(self, kind):
+        self.kind = kind
+        self.buf = b""
+        self.other = bytearray()
+
+    def feed(self, data):
+        """Returns the complete frames as (command, payload, crc_ok)."""
+        self.buf += data
+        frames = []
+        i = 0
+        buf = self.buf
+        while i < len(buf):
+            if buf[i:i + 1] != b"K" or len(buf) < i + 2:
+                if buf[i:i + 1] == b"K":
+                    break
+                self.other.append(buf[i])
+                i += 1
+                continue
+            tag = buf[i + 1:i + 2]
+            if tag == b"L":
+                if len(buf) < i + 4 or len(buf) < i + 4 + buf[i + 3]:
+                    break
+                i += 4 + buf[i + 3]
+            elif tag == b"T":
+                if len(buf) < i + 4 or len(buf) < i + 8 + buf[i + 3]:
+                    break
+                i += 8 + buf[i + 3]
+            elif tag == self.kind:
+                if len(buf) < i + 5:
+                    break
+                cmd, n = struct.unpack_from("<BH", buf, i + 2)
+                end = i + 5 + n + 4
+                if len(buf) < end:
+                    break
+                crc, = struct.unpack_from("<I", buf, end - 4)
+                payload = buf[i + 5:end - 4]
+                ok = zlib.crc32(buf[i + 2:end - 4]) == crc
+                frames.append((cmd, payload, ok))
+                i = end
+            else:
+                self.other.append(buf[i])
+                i += 1
+        self.buf = buf[i:]
+        return frames
+
+
+class Port:
+    """Raw 9600 baud 8N1 serial port (or pty), without pyserial."""
+
+    def __init__(self, path, timeout=0.05):
+        import os
+        import termios
+        import tty
+        self.os = os
+        self.timeout = timeout
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[4] = attrs[5] = termios.B9600
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+
+    def write(self, data):
+        self.os.write(self.fd, data)
+
+    def read(self, n):
+        import select
+        r, _, _ = select.select([self.fd], [], [], self.timeout)
+        return self.os.read(self.fd, n) if r else b""
+
+    def close(self):
+        self.os.close(self.fd)
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Report the flash and RAM use of a Koryuu firmware image.
+
+Reads the symbol table of the ELF with avr-nm and sorts the symbols into
+flash, RAM (.data + .bss) and EEPROM by address. The RAM total is what
+the stack cannot use; on the ATmega328P the stack gets the rest of the
+2048 bytes.
+
+    koryuu_size.py koryuu-fw.elf > koryuu-fw_size.txt
+    koryuu_size.py --top 0 koryuu-fw.elf      all symbols
+
+The firmware can also report the stack never used at run time, see
+VAR_STACK_UNUSED in koryuu_proto.hh and the LOG_RAM_USAGE message.
+"""
+
+import argparse
+import subprocess
+import sys
+
+FLASH_SIZE = 32768
+RAM_SIZE = 2048
+EEPROM_SIZE = 1024
+
+# avr-gcc places the address spaces at these offsets in the ELF.
+RAM_BASE = 0x800000
+EEPROM_BASE = 0x810000
+
+
+def symbols(nm, elf):
+    out = subprocess.run([nm, "-S", "--size-sort", elf], check=True,
+                         stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    for line in out.splitlines():
+        f = line.split(None, 3)
+        if len(f) != 4:
+            continue
+        addr, size, kind, name = int(f[0], 16), int(f[1], 16), f[2], f[3]
+        if addr >= EEPROM_BASE:
+            yield "eeprom", name, kind, size
+        elif addr >= RAM_BASE:
+            yield "ram", name, kind, size
+        else:
+            yield "flash", name, kind, size
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("elf", help="firmware ELF")
+    ap.add_argument("--nm", default="avr-nm", help="nm of the toolchain")
+    ap.add_argument("--top", type=int, default=20,
+                    help="symbols listed per section, 0 for all")
+    args = ap.parse_args()
+
+    sections = {"flash": [], "ram": [], "eeprom": []}
+    for sec, name, kind, size in symbols(args.nm, args.elf):
+        sections[sec].append((size, kind, name))
+
+    totals = {s: sum(e[0] for e in v) for s, v in sections.items()}
+    out = sys.stdout
+    out.write("%s\n\n" % args.elf)
+    for sec, cap in (("flash", FLASH_SIZE), ("ram", RAM_SIZE),
+                     ("eeprom", EEPROM_SIZE)):
+        out.write("%-7s %6d of %6d bytes in symbols (%.1f%%)\n" % (
+            sec, totals[sec], cap, 100.0 * totals[sec] / cap))
+    out.write("stack   %6d bytes at most (RAM not in static data)\n"
+              % (RAM_SIZE - totals["ram"]))
+
+    for sec in ("ram", "flash", "eeprom"):
+        entries = sorted(sections[sec], reverse=True)
+        if args.top:
+            entries = entries[:args.top]
+        if not entries:
+            continue
+        out.write("\n%s, largest first:\n" % sec)
+        for size, kind, name in entries:
+            out.write("  %6d %s %s\n" % (size, kind, name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Stand-in Koryuu for testing the control tools without hardware.
+
+Opens a pseudo terminal, prints its path and answers control protocol
+requests (see koryuu_proto.hh) from register maps and state variables
+kept in memory, with the firmware's argument checks.
+
+    koryuu_standin.py &
+    koryuu_ctl.py -p /dev/pts/N ping
+"""
+
+import os
+import struct
+import sys
+import tty
+
+import koryuu_proto as kp
+
+# None: read only.
+VAR_RANGES = [(0, 4), (0, 5), (0, 3), (0, 2), (0, 1), (0, 1),
+              (-32768, 32767), None, None, None, None, None, None, None,
+              None, None, None]
+
+
+class StandIn:
+    def __init__(self):
+        self.maps = [bytearray(256) for _ in kp.MAPS]
+        self.vars = [4, 0, 0, 0, 1, 1, 0, 1200, 610, 0, 1, 2, 5, 3600, 1,
+                     0, 0]
+        self.presets = {}
+        self.boot_preset = None
+        # seq, MCUSR, stage, I2C address, I2C arguments; newest first.
+        self.faults = [(1, 0x08, 0x02, 0x20, 0), (0, 0x08, 0x83, 0x2a, 2)]
+        # A few power-on values, so that dumps are not all zero.
+        self.maps[0][0x10] = 0x45  # Status 1: locked, PAL B/G/H/I/D
+        self.maps[0][0x11] = 0x20  # Ident
+        self.maps[0][0x13] = 0x44  # Status 3: 50 Hz, interlaced
+        self.maps[5][0x80] = 0x71
+
+    def handle(self, cmd, p):
+        if cmd == kp.CMD_PING:
+            return kp.PS_OK, bytes([kp.VERSION, len(kp.MAPS),
+                                    len(kp.VARS)]) + b"1.1"
+        if cmd == kp.CMD_DUMP_MAP:
+            if len(p) != 1 or p[0] >= len(kp.MAPS):
+                return kp.PS_BAD_ARGUMENT, b""
+            return kp.PS_OK, bytes([p[0]]) + bytes(self.maps[p[0]])
+        if cmd == kp.CMD_WRITE_BATCH:
+            if len(p) % 3 or any(p[i] >= len(kp.MAPS)
+                                 for i in range(0, len(p), 3)):
+                return kp.PS_BAD_ARGUMENT, b""
+            for i in range(0, len(p), 3):
+                self.maps[p[i]][p[i + 1]] = p[i + 2]
+            return kp.PS_OK, bytes([len(p) // 3])
+        if cmd in (kp.CMD_GET_VAR, kp.CMD_SET_VAR):
+            if (len(p) != (1 if cmd == kp.CMD_GET_VAR else 3)
+                    or p[0] >= len(kp.VARS)):
+                return kp.PS_BAD_ARGUMENT, b""
+            if cmd == kp.CMD_SET_VAR:
+                v, = struct.unpack_from("<h", p, 1)
+                r = VAR_RANGES[p[0]]
+                if r is None or not r[0] <= v <= r[1]:
+                    return kp.PS_BAD_ARGUMENT, b""
+                self.vars[p[0]] = v
+            return kp.PS_OK, struct.pack("<Bh", p[0], self.vars[p[0]])
+        if cmd == kp.CMD_SAVE:
+            if len(p) != 1 or p[0] >= kp.NUM_PRESETS:
+                return kp.PS_BAD_ARGUMENT, b""
+            self.presets[p[0]] = (list(self.vars),
+                                  [bytes(m) for m in self.maps])
+            self.boot_preset = p[0]
+            return kp.PS_OK, bytes([p[0]])
+        if cmd == kp.CMD_FAULTS:
+            if len(p) != 1:
+                return kp.PS_BAD_ARGUMENT, b""
+            out = bytes([len(self.faults)]) + b"".join(
+                bytes(f) for f in self.faults)
+            if p[0] & kp.FAULTS_CLEAR:
+                self.faults = []
+            return kp.PS_OK, out
+        return kp.PS_UNKNOWN_COMMAND, b""
+
+    def serve(self, fd):
+        parser = kp.Parser(kp.REQUEST)
+        while True:
+            try:
+                data = os.read(fd, 256)
+            except OSError:
+                return
+            for cmd, payload, ok in parser.feed(data):
+                if not ok:
+                    status, out = kp.PS_BAD_CRC, b""
+                elif len(payload) > kp.MAX_PAYLOAD:
+                    status, out = kp.PS_TOO_LONG, b""
+                else:
+                    status, out = self.handle(cmd, payload)
+                os.write(fd, kp.response(cmd, status, out))
+
+
+def main():
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    print(os.ttyname(slave), flush=True)
+    try:
+        StandIn().serve(master)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
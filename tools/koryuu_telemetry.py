@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Fetch and render the Koryuu signal quality telemetry.
+
+Reads a telemetry frame (see telemetry.hh) either from the serial port,
+after sending the dump command, or from a file holding captured serial
+output. Debug text around the frame is skipped.
+
+    koryuu_telemetry.py --port /dev/ttyUSB0 [--reset]
+    koryuu_telemetry.py --file capture.bin
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+VERSION = 1
+COUNTERS = ["lock losses", "fSC unlocks", "freerun entries",
+            "color kill toggles", "Macrovision", "standard changes"]
+EVENTS = ["lock lost", "lock gained", "fSC unlock", "freerun",
+          "color kill", "Macrovision", "standard change"]
+STANDARDS = ["NTSC M/J", "NTSC 4.43", "PAL M", "PAL 60", "PAL B/G/H/I/D",
+             "SECAM", "PAL Combination N", "SECAM 525"]
+HIST_BUCKETS = 8
+FIXED = struct.Struct("<HH%dH%dHB" % (len(COUNTERS), HIST_BUCKETS))
+ENTRY = struct.Struct("<HBB")
+
+
+def find_frame(buf):
+    start = 0
+    while True:
+        i = buf.find(b"KT", start)
+        if i < 0 or len(buf) < i + 4:
+            return None
+        version, length = buf[i + 2], buf[i + 3]
+        end = i + 4 + length + 4
+        if version == VERSION and len(buf) >= end:
+            payload = buf[i + 4:i + 4 + length]
+            crc, = struct.unpack("<I", buf[end - 4:end])
+            if zlib.crc32(payload) == crc:
+                return payload
+        start = i + 1
+
+
+def parse(payload):
+    fields = FIXED.unpack_from(payload)
+    tick_us, now = fields[0], fields[1]
+    counters = fields[2:2 + len(COUNTERS)]
+    hist = fields[2 + len(COUNTERS):2 + len(COUNTERS) + HIST_BUCKETS]
+    n = fields[-1]
+    entries = [ENTRY.unpack_from(payload, FIXED.size + i * ENTRY.size)
+               for i in range(n)]
+    return tick_us, now, counters, hist, entries
+
+
+def bucket_label(b, tick_us):
+    limit_ms = (1 << (b + 3)) * tick_us / 1000.0
+    if b == HIST_BUCKETS - 1:
+        prev_ms = (1 << (b + 2)) * tick_us / 1000.0
+        return ">= %7.0f ms" % prev_ms
+    return "<  %7.0f ms" % limit_ms
+
+
+def describe(kind, value):
+    name = EVENTS[kind] if kind < len(EVENTS) else "event %d" % kind
+    if kind == 1:
+        return "%s (dropout bucket %d)" % (name, value)
+    if kind in (3, 4):
+        return "%s %s" % (name, "on" if value else "off")
+    if kind == 5:
+        return "%s flags 0x%x" % (name, value)
+    if kind == 6:
+        return "%s to %s" % (name, STANDARDS[value & 7])
+    return "%s (status 0x%02x)" % (name, value)
+
+
+def render(tick_us, now, counters, hist, entries, out=sys.stdout):
+    out.write("Counters:\n")
+    for name, value in zip(COUNTERS, counters):
+        out.write("  %-20s %5d\n" % (name, value))
+    out.write("Dropout durations:\n")
+    peak = max(hist) or 1
+    for b, value in enumerate(hist):
+        bar = "#" * (value * 40 // peak)
+        out.write("  %s %5d %s\n" % (bucket_label(b, tick_us), value, bar))
+    out.write("Recent transitions:\n")
+    for tick, kind, value in entries:
+        age_ms = ((now - tick) & 0xffff) * tick_us / 1000.0
+        out.write("  %9.0f ms ago  %s\n" % (age_ms, describe(kind, value)))
+
+
+def read_port(port, reset, timeout=3.0):
+    import serial  # pyserial
+    with serial.Serial(port, 9600, timeout=0.2) as s:
+        s.reset_input_buffer()
+        s.write(b"Z" if reset else b"T")
+        buf = b""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            buf += s.read(256)
+            payload = find_frame(buf)
+            if payload is not None:
+                return payload
+    return None
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    src = ap.add_mutually_exclusive_group(required=True)
+    src.add_argument("--port", help="serial port of the Koryuu")
+    src.add_argument("--file", help="captured serial output")
+    ap.add_argument("--reset", action="store_true",
+                    help="reset the counters after dumping")
+    args = ap.parse_args()
+
+    if args.port:
+        payload = read_port(args.port, args.reset)
+    else:
+        with open(args.file, "rb") as f:
+            payload = find_frame(f.read())
+    if payload is None:
+        sys.exit("no valid telemetry frame found")
+    render(*parse(payload))
+
+
+if __name__ == "__main__":
+    main()
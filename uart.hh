@@ -0,0 +1,250 @@
+#ifndef KORYUU_UART_HH
+#define KORYUU_UART_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "hal.hh"
+
+// String literal kept in flash, for Uart::operator<<().
+#define _F(s) (koryuu::FlashString{ HAL_PSTR(s) })
+
+namespace koryuu {
+    struct FlashString {
+        const char *p;
+    };
+
+    template<typename T>
+    struct DecFormat {
+        T v;
+    };
+
+    template<typename T>
+    struct HexFormat {
+        T v;
+    };
+
+    // Decimal and fixed width hexadecimal formatting.
+    template<typename T>
+    YAAL_INLINE("dec()")
+    DecFormat<T> dec(T v) {
+        return { v };
+    }
+
+    template<typename T>
+    YAAL_INLINE("hex()")
+    HexFormat<T> hex(T v) {
+        return { v };
+    }
+
+    // What Uart::put() does when the TX ring is full.
+    enum TxPolicy : uint8_t {
+        TX_DROP = 0,  // Drop the byte and count the overflow
+        TX_BLOCK = 1, // Wait for the UDRE interrupt to make room
+    };
+
+    // USART0, 8N1, with interrupt driven transmit and receive rings of
+    // TX_SIZE and RX_SIZE bytes. udre_isr() must be called from
+    // ISR(USART_UDRE_vect) and rx_isr() from ISR(USART_RX_vect).
+    template<uint8_t TX_SIZE, TxPolicy POLICY, uint8_t RX_SIZE = 16>
+    class Uart {
+        static_assert(TX_SIZE && !(TX_SIZE & (TX_SIZE - 1)) && TX_SIZE <= 128,
+            "TX ring size must be a power of two, at most 128");
+        static_assert(RX_SIZE && !(RX_SIZE & (RX_SIZE - 1)) && RX_SIZE <= 128,
+            "RX ring size must be a power of two, at most 128");
+        static constexpr uint8_t MASK = TX_SIZE - 1;
+        static constexpr uint8_t RX_MASK = RX_SIZE - 1;
+
+        uint8_t tx_buf[TX_SIZE];
+        volatile uint8_t tx_head; // Written only by put()
+        volatile uint8_t tx_tail; // Written only by udre_isr()
+        uint16_t overflows;
+        uint8_t rx_buf[RX_SIZE];
+        volatile uint8_t rx_head; // Written only by rx_isr()
+        volatile uint8_t rx_tail; // Written only by get()
+        volatile uint8_t rx_overflows;
+
+        // Moves the ring forward by hand while interrupts are disabled.
+        void poll_tx() {
+            if (hal::uart_data_empty())
+                udre_isr();
+        }
+
+        template<typename T>
+        void put_dec(T v) {
+            uint32_t u = v;
+            if (T(-1) < T(0) && (int32_t)v < 0) {
+                put('-');
+                u = -(int32_t)v;
+            }
+            char buf[10];
+            uint8_t n = 0;
+            do {
+                buf[n++] = '0' + u % 10;
+                u /= 10;
+            } while (u);
+            while (n)
+                put(buf[--n]);
+        }
+
+        template<typename T>
+        void put_hex(T v) {
+            for (int8_t shift = 8 * sizeof(T) - 4; shift >= 0; shift -= 4) {
+                const uint8_t d = ((uint32_t)v >> shift) & 0x0f;
+                put(d < 10 ? '0' + d : 'a' - 10 + d);
+            }
+        }
+
+    public:
+        Uart()
+            : tx_head(0), tx_tail(0), overflows(0), rx_head(0), rx_tail(0),
+              rx_overflows(0)
+        {}
+
+        void setup(uint32_t baud) {
+            hal::uart_setup(baud);
+        }
+
+        void udre_isr() {
+            uint8_t t = tx_tail;
+            if (t == tx_head) {
+                hal::uart_tx_irq(false);
+                return;
+            }
+            hal::uart_put_data(tx_buf[t]);
+            t = (t + 1) & MASK;
+            tx_tail = t;
+            if (t == tx_head)
+                hal::uart_tx_irq(false);
+        }
+
+        // Queues a byte. Returns false if it was dropped.
+        bool put(uint8_t c, TxPolicy policy = POLICY) {
+            const uint8_t h = tx_head;
+            const uint8_t next = (h + 1) & MASK;
+            while (next == tx_tail) {
+                if (policy == TX_DROP) {
+                    if (overflows != 0xffffu)
+                        ++overflows;
+                    return false;
+                }
+                if (!hal::irq_enabled())
+                    poll_tx();
+                hal::busy_wait();
+            }
+            tx_buf[h] = c;
+            tx_head = next;
+            hal::uart_tx_irq(true);
+            return true;
+        }
+
+        // Free space in the ring.
+        uint8_t room() const {
+            return (uint8_t)(tx_tail - tx_head - 1) & MASK;
+        }
+
+        // Makes sure n bytes fit into the ring, so that a record is
+        // queued or dropped as a whole. Returns false if it must be
+        // dropped. Records longer than the ring only fit when blocking.
+        bool reserve(uint8_t n, TxPolicy policy = POLICY) {
+            if (policy == TX_BLOCK && n >= TX_SIZE)
+                return true;
+            while (room() < n) {
+                if (policy == TX_DROP) {
+                    overflows = (uint16_t)(overflows + n) < overflows ?
+                        0xffffu : overflows + n;
+                    return false;
+                }
+                if (!hal::irq_enabled())
+                    poll_tx();
+                hal::busy_wait();
+            }
+            return true;
+        }
+
+        // Binary frames are never dropped partially.
+        void write(const void *data, uint8_t n) {
+            const uint8_t *p = static_cast<const uint8_t *>(data);
+            while (n--)
+                put(*p++, TX_BLOCK);
+        }
+
+        void rx_isr() {
+            const uint8_t c = hal::uart_get_data();
+            const uint8_t h = rx_head;
+            const uint8_t next = (h + 1) & RX_MASK;
+            if (next == rx_tail) {
+                if (rx_overflows != 0xffu)
+                    rx_overflows = rx_overflows + 1;
+                return;
+            }
+            rx_buf[h] = c;
+            rx_head = next;
+        }
+
+        // Returns false if no byte has been received.
+        bool get(uint8_t &c) {
+            const uint8_t t = rx_tail;
+            if (t == rx_head)
+                return false;
+            c = rx_buf[t];
+            rx_tail = (t + 1) & RX_MASK;
+            return true;
+        }
+
+        // Waits until the ring is empty, e.g. before changing OSCCAL.
+        void flush() {
+            while (tx_tail != tx_head) {
+                if (!hal::irq_enabled())
+                    poll_tx();
+                hal::busy_wait();
+            }
+            while (!hal::uart_data_empty())
+                hal::busy_wait();
+        }
+
+        // Bytes dropped because the ring was full.
+        YAAL_INLINE("Uart::overflow_count()")
+        uint16_t overflow_count() const {
+            return overflows;
+        }
+
+        // Received bytes lost because the receive ring was full.
+        YAAL_INLINE("Uart::rx_overflow_count()")
+        uint8_t rx_overflow_count() const {
+            return rx_overflows;
+        }
+
+        Uart &operator<<(char c) {
+            put(c);
+            return *this;
+        }
+
+        Uart &operator<<(const char *s) {
+            while (*s)
+                put(*s++);
+            return *this;
+        }
+
+        Uart &operator<<(FlashString s) {
+            char c;
+            const char *p = s.p;
+            while ((c = hal::flash_read_byte(p++)))
+                put(c);
+            return *this;
+        }
+
+        template<typename T>
+        Uart &operator<<(DecFormat<T> f) {
+            put_dec(f.v);
+            return *this;
+        }
+
+        template<typename T>
+        Uart &operator<<(HexFormat<T> f) {
+            put_hex(f.v);
+            return *this;
+        }
+    };
+}
+#endif // __YAAL__
+#endif // KORYUU_UART_HH
@@ -0,0 +1,108 @@
+#ifndef VIDEO_STANDARDS_HH
+#define VIDEO_STANDARDS_HH
+#include <yaal/requirements.hh>
+
+#ifdef __YAAL__
+#include "adv7280.hh"
+
+namespace video_standards {
+    using ad_decoder::AutoDetectSelection;
+    // Video standards as reported by the ADV7280A, status 1 bits 6:4.
+    enum VideoStandard : uint8_t {
+        VSTD_NTSC_MJ     = 0x00,
+        VSTD_NTSC_443    = 0x01,
+        VSTD_PAL_M       = 0x02,
+        VSTD_PAL_60      = 0x03,
+        VSTD_PAL_BGHID   = 0x04,
+        VSTD_SECAM       = 0x05,
+        VSTD_PAL_COMB_N  = 0x06,
+        VSTD_SECAM_525   = 0x07,
+        NUM_VSTD,
+        VSTD_UNKNOWN     = 0xff,
+    };
+
+    // ADV7391 SD subcarrier frequency register value (0x8c-0x8f):
+    // round(2^32 * f_sc / f_clk), with the 27 MHz encoder clock.
+    // Frequencies are in units of 0.01 Hz.
+    constexpr uint32_t ENC_CLK_CHZ = 2700000000UL;
+
+    constexpr uint32_t fsc_word(uint32_t f_sc_chz)
+    {
+        return (uint32_t)((((uint64_t)f_sc_chz << 32) + ENC_CLK_CHZ / 2)
+            / ENC_CLK_CHZ);
+    }
+
+    constexpr uint32_t SC_PAL_CHZ = 443361875UL; // 4.43361875 MHz
+
+    // Reference value from the ADV7391 datasheet.
+    static_assert(fsc_word(SC_PAL_CHZ) == 0x2a098acbUL,
+        "PAL subcarrier word is wrong!");
+
+    // ADV7391 SD mode register 0x80:
+    // SSAF luma filter, 2 MHz chroma filter, standard in bits 1:0.
+    constexpr uint8_t ENC_MODE_PAL_BDGHI = 0x71;
+    constexpr uint8_t ENC_MODE_PAL_M     = 0x72;
+
+    // ADV7280A comb control (0x38 NTSC, 0x39 PAL): 5-line adaptive, or
+    // luma and chroma comb disabled, i.e. notch filtering.
+    constexpr uint8_t COMB_ADAPTIVE_5LINE = 0xc0;
+    constexpr uint8_t COMB_NOTCH          = 0xe4;
+
+    // The output is always PAL: PAL 60 for 525 line sources (PAL M
+    // timing with the 4.43 MHz subcarrier) and PAL B/D/G/H/I for 625
+    // line sources, never with a pedestal; the output levels follow the
+    // IRE mode, see set_video_range().
+    struct StandardTuning {
+        uint8_t enc_mode;   // Encoder 0x80
+        uint32_t fsc;       // Encoder 0x8c-0x8f, see fsc_word()
+        uint8_t comb;       // Decoder 0x38 or 0x39, see comb_is_pal
+        bool comb_is_pal;   // Comb filter of the PAL decoder
+        bool has_comb;      // SECAM is not comb filtered
+    };
+
+    constexpr uint32_t FSC_PAL_443 = fsc_word(SC_PAL_CHZ);
+
+    constexpr koryuu::hal::FlashTable<StandardTuning, NUM_VSTD>
+            STANDARD_TUNING HAL_PROGMEM = {{
+        [VSTD_NTSC_MJ]    = { ENC_MODE_PAL_M, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, false, true },
+        [VSTD_NTSC_443]   = { ENC_MODE_PAL_M, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, false, true },
+        [VSTD_PAL_M]      = { ENC_MODE_PAL_M, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, true, true },
+        [VSTD_PAL_60]     = { ENC_MODE_PAL_M, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, true, true },
+        [VSTD_PAL_BGHID]  = { ENC_MODE_PAL_BDGHI, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, true, true },
+        [VSTD_SECAM]      = { ENC_MODE_PAL_BDGHI, FSC_PAL_443,
+                              0x00, false, false },
+        [VSTD_PAL_COMB_N] = { ENC_MODE_PAL_BDGHI, FSC_PAL_443,
+                              COMB_ADAPTIVE_5LINE, true, true },
+        [VSTD_SECAM_525]  = { ENC_MODE_PAL_M, FSC_PAL_443,
+                              0x00, false, false },
+    }};
+
+    // Autodetection restricted to the family of a standard, or the full
+    // PAL/NTSC/SECAM search for VSTD_UNKNOWN and SECAM 525, which has
+    // no selection of its own. The pedestal selects the variants with
+    // one: NTSC M over NTSC J, PAL N over PAL B/G/H/I/D and the
+    // pedestal PAL M and PAL Combination N.
+    constexpr AutoDetectSelection autodetection_for(uint8_t vstd,
+            bool pedestal)
+    {
+        using namespace ad_decoder;
+        return
+            vstd == VSTD_NTSC_MJ    ? (pedestal ? AD_NTSCM : AD_NTSCJ) :
+            vstd == VSTD_NTSC_443   ? AD_NTSC443 :
+            vstd == VSTD_PAL_M      ? (pedestal ? AD_PALM_P : AD_PALM) :
+            vstd == VSTD_PAL_60     ? AD_PAL60 :
+            vstd == VSTD_PAL_BGHID  ? (pedestal ? AD_PALN : AD_PALBGHID) :
+            vstd == VSTD_SECAM      ? AD_SECAM :
+            vstd == VSTD_PAL_COMB_N ?
+                (pedestal ? AD_PAL_COMBI_N_P : AD_PAL_COMBI_N) :
+            pedestal ? AD_PALN_NTSCM_SECAM : AD_PALBGHID_NTSCJ_SECAM;
+    }
+}
+
+#endif // __YAAL__
+#endif // VIDEO_STANDARDS_HH